@@ -0,0 +1,239 @@
+#define VESUVIUS_IMPL
+#include "vesuvius-c.h"
+#include <stdio.h>
+
+// Microbenchmarks of the chunk kernels, codecs and mesh readers and writers, on synthetic data
+//     - each benchmark is repeated until it has run for --min-time seconds, then reports the mean time of one run
+//     - prints one tab separated line per benchmark: the items processed per run (voxels, or vertices for
+//       meshes), the runs, milliseconds per run, items per second and GB per second of input
+//     - benchmarks whose name doesn't contain the filter, if one is given, are skipped
+//
+// usage: vesuvius_bench [filter] [--size 128] [--min-time 0.5]
+
+#define MESH_SIZE 64  // marching cubes allocates for the worst case, so meshes come from a smaller chunk
+
+typedef struct {
+    s32 size;
+    chunk *f32_chunk;       // size^3 voxels in 0..255
+    tchunk *u8_chunk;       // the same voxels as uint8
+    chunk *graft_dest;
+    void *compressed;
+    int compressed_len;
+    zarr_metadata metadata;
+    chunk *mesh_field;      // MESH_SIZE^3 distances from the center
+    f32 *vertices;
+    s32 *indices;
+    s32 vertex_count;
+    s32 index_count;
+    const char *obj_path;
+    const char *ply_path;
+} bench_data;
+
+static const char *filter = NULL;
+static double min_time = 0.5;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *name, const char *unit, s64 items, s64 bytes, void (*fn)(bench_data *), bench_data *data) {
+    if (filter && strstr(name, filter) == NULL) {
+        return;
+    }
+    fn(data);  // warm up the caches and the buffer pool
+    int runs = 0;
+    double start = now_seconds(), elapsed = 0;
+    do {
+        fn(data);
+        runs++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_time);
+    double per_run = elapsed / runs;
+    printf("%s\t%s\t%lld\t%d\t%.3f\t%.4g\t%.3f\n", name, unit, (long long)items, runs, per_run * 1e3, items / per_run, bytes / per_run / 1e9);
+    fflush(stdout);
+}
+
+static void bench_compress(bench_data *d) {
+    void *compressed = NULL;
+    if (vs_zarr_compress_tchunk(d->u8_chunk, d->metadata, &compressed) > 0) {
+        free(compressed);
+    }
+}
+
+static void bench_decompress(bench_data *d) {
+    vs_tchunk_free(vs_zarr_decompress_tchunk(d->compressed_len, d->compressed, d->metadata));
+}
+
+static void bench_u8_to_f32(bench_data *d) {
+    vs_chunk_free(vs_tchunk_to_chunk(d->u8_chunk));
+}
+
+static void bench_f32_to_u8(bench_data *d) {
+    vs_tchunk_free(vs_chunk_to_tchunk(d->f32_chunk, VS_U8));
+}
+
+static void bench_graft(bench_data *d) {
+    // a region offset on every axis, so rows don't line up with the start of the chunk
+    s32 half = d->size / 2;
+    vs_chunk_graft(d->graft_dest, d->f32_chunk, (s32[3]){half / 2, half / 2, half / 2}, (s32[3]){1, 1, 1}, (s32[3]){half, half, half});
+}
+
+static void bench_maxpool(bench_data *d) { vs_chunk_free(vs_maxpool(d->f32_chunk, 2, 2)); }
+static void bench_avgpool(bench_data *d) { vs_chunk_free(vs_avgpool(d->f32_chunk, 2, 2)); }
+static void bench_sumpool(bench_data *d) { vs_chunk_free(vs_sumpool(d->f32_chunk, 2, 2)); }
+static void bench_tchunk_maxpool(bench_data *d) { vs_tchunk_free(vs_tchunk_maxpool(d->u8_chunk, 2, 2)); }
+static void bench_tchunk_avgpool(bench_data *d) { vs_tchunk_free(vs_tchunk_avgpool(d->u8_chunk, 2, 2)); }
+static void bench_unsharp(bench_data *d) { vs_chunk_free(vs_unsharp_mask_3d(d->f32_chunk, 1.0f, 3)); }
+static void bench_normalize(bench_data *d) { vs_chunk_free(vs_normalize_chunk(d->f32_chunk)); }
+static void bench_transpose(bench_data *d) { vs_chunk_free(vs_transpose(d->f32_chunk, "xyz")); }
+
+static void bench_chunk_histogram(bench_data *d) {
+    vs_histogram_free(vs_chunk_histogram(d->f32_chunk->data, d->size, d->size, d->size, 256));
+}
+
+static void bench_tchunk_histogram(bench_data *d) {
+    vs_histogram_free(vs_tchunk_histogram(d->u8_chunk, 256));
+}
+
+static void bench_march_cubes(bench_data *d) {
+    f32 *vertices = NULL;
+    s32 *indices = NULL;
+    s32 vertex_count = 0, index_count = 0;
+    vs_march_cubes(d->mesh_field->data, MESH_SIZE, MESH_SIZE, MESH_SIZE, MESH_SIZE / 3.0f,
+                   &vertices, &indices, &vertex_count, &index_count);
+    free(vertices);
+    free(indices);
+}
+
+static void bench_obj_write(bench_data *d) {
+    vs_write_obj(d->obj_path, d->vertices, d->indices, d->vertex_count, d->index_count);
+}
+
+static void bench_obj_read(bench_data *d) {
+    f32 *vertices = NULL;
+    s32 *indices = NULL;
+    s32 vertex_count = 0, index_count = 0;
+    vs_read_obj(d->obj_path, &vertices, &indices, &vertex_count, &index_count);
+    free(vertices);
+    free(indices);
+}
+
+static void bench_ply_write(bench_data *d) {
+    vs_ply_write(d->ply_path, d->vertices, NULL, d->indices, d->vertex_count, d->index_count);
+}
+
+static void bench_ply_read(bench_data *d) {
+    f32 *vertices = NULL, *normals = NULL;
+    s32 *indices = NULL;
+    s32 vertex_count = 0, normal_count = 0, index_count = 0;
+    vs_ply_read(d->ply_path, &vertices, &normals, &indices, &vertex_count, &normal_count, &index_count);
+    free(vertices);
+    free(normals);
+    free(indices);
+}
+
+static s64 file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+// concentric sheets with some noise, like the server in testserver.c, and a sphere to mesh
+static int make_data(bench_data *d) {
+    s32 dims[3] = {d->size, d->size, d->size};
+    s32 mesh_dims[3] = {MESH_SIZE, MESH_SIZE, MESH_SIZE};
+    d->f32_chunk = vs_chunk_new(dims);
+    d->graft_dest = vs_chunk_new(dims);
+    d->mesh_field = vs_chunk_new(mesh_dims);
+    if (d->f32_chunk == NULL || d->graft_dest == NULL || d->mesh_field == NULL) {
+        return 1;
+    }
+    u32 seed = 12345;
+    for (s32 z = 0; z < d->size; z++) {
+        for (s32 y = 0; y < d->size; y++) {
+            for (s32 x = 0; x < d->size; x++) {
+                f32 dy = y - d->size / 2.0f, dx = x - d->size / 2.0f;
+                s32 r = (s32)sqrtf(dy * dy + dx * dx);
+                seed = seed * 1664525u + 1013904223u;
+                vs_chunk_set(d->f32_chunk, z, y, x, (f32)((r % 12 < 4 ? 160 : 40) + (seed >> 27)));
+            }
+        }
+    }
+    for (s32 z = 0; z < MESH_SIZE; z++) {
+        for (s32 y = 0; y < MESH_SIZE; y++) {
+            for (s32 x = 0; x < MESH_SIZE; x++) {
+                f32 c = MESH_SIZE / 2.0f;
+                vs_chunk_set(d->mesh_field, z, y, x, sqrtf((z - c) * (z - c) + (y - c) * (y - c) + (x - c) * (x - c)));
+            }
+        }
+    }
+
+    d->u8_chunk = vs_chunk_to_tchunk(d->f32_chunk, VS_U8);
+    d->metadata = (zarr_metadata){.chunks = {d->size, d->size, d->size}, .dtype = "|u1",
+                                  .compressor = {.id = "blosc", .cname = "zstd", .clevel = 3, .shuffle = 1}};
+    d->compressed_len = d->u8_chunk ? vs_zarr_compress_tchunk(d->u8_chunk, d->metadata, &d->compressed) : 0;
+    if (d->compressed_len <= 0) {
+        return 1;
+    }
+    return vs_march_cubes(d->mesh_field->data, MESH_SIZE, MESH_SIZE, MESH_SIZE, MESH_SIZE / 3.0f,
+                          &d->vertices, &d->indices, &d->vertex_count, &d->index_count) != 0;
+}
+
+int main(int argc, char **argv) {
+    bench_data d = {.size = 128, .obj_path = "./vesuvius_bench.obj", .ply_path = "./vesuvius_bench.ply"};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) d.size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) min_time = atof(argv[++i]);
+        else if (argv[i][0] != '-') filter = argv[i];
+        else d.size = 0;
+    }
+    if (d.size < 4 || min_time < 0) {
+        fprintf(stderr, "usage: %s [filter] [--size 128] [--min-time 0.5]\n", argv[0]);
+        return 1;
+    }
+    if (make_data(&d)) {
+        fprintf(stderr, "failed to make the benchmark data\n");
+        return 1;
+    }
+
+    s64 voxels = (s64)d.size * d.size * d.size;
+    s64 mesh_voxels = (s64)MESH_SIZE * MESH_SIZE * MESH_SIZE;
+    s64 graft_voxels = (s64)(d.size / 2) * (d.size / 2) * (d.size / 2);
+    printf("benchmark\tunit\titems\truns\tms_per_run\titems_per_s\tgb_per_s\n");
+    run("zarr_compress_u8", "voxels", voxels, voxels, bench_compress, &d);
+    run("zarr_decompress_u8", "voxels", voxels, d.compressed_len, bench_decompress, &d);
+    run("u8_to_f32", "voxels", voxels, voxels, bench_u8_to_f32, &d);
+    run("f32_to_u8", "voxels", voxels, voxels * 4, bench_f32_to_u8, &d);
+    run("chunk_graft", "voxels", graft_voxels, graft_voxels * 4, bench_graft, &d);
+    run("maxpool", "voxels", voxels, voxels * 4, bench_maxpool, &d);
+    run("avgpool", "voxels", voxels, voxels * 4, bench_avgpool, &d);
+    run("sumpool", "voxels", voxels, voxels * 4, bench_sumpool, &d);
+    run("tchunk_maxpool_u8", "voxels", voxels, voxels, bench_tchunk_maxpool, &d);
+    run("tchunk_avgpool_u8", "voxels", voxels, voxels, bench_tchunk_avgpool, &d);
+    run("unsharp_mask_3d", "voxels", voxels, voxels * 4, bench_unsharp, &d);
+    run("normalize_chunk", "voxels", voxels, voxels * 4, bench_normalize, &d);
+    run("transpose", "voxels", voxels, voxels * 4, bench_transpose, &d);
+    run("chunk_histogram", "voxels", voxels, voxels * 4, bench_chunk_histogram, &d);
+    run("tchunk_histogram_u8", "voxels", voxels, voxels, bench_tchunk_histogram, &d);
+    run("march_cubes", "voxels", mesh_voxels, mesh_voxels * 4, bench_march_cubes, &d);
+
+    // the readers are timed on the files the writers leave behind
+    bench_obj_write(&d);
+    bench_ply_write(&d);
+    run("obj_write", "vertices", d.vertex_count, file_size(d.obj_path), bench_obj_write, &d);
+    run("obj_read", "vertices", d.vertex_count, file_size(d.obj_path), bench_obj_read, &d);
+    run("ply_write", "vertices", d.vertex_count, file_size(d.ply_path), bench_ply_write, &d);
+    run("ply_read", "vertices", d.vertex_count, file_size(d.ply_path), bench_ply_read, &d);
+    remove(d.obj_path);
+    remove(d.ply_path);
+
+    vs_chunk_free(d.f32_chunk);
+    vs_tchunk_free(d.u8_chunk);
+    vs_chunk_free(d.graft_dest);
+    vs_chunk_free(d.mesh_field);
+    free(d.compressed);
+    free(d.vertices);
+    free(d.indices);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#define VESUVIUS_IMPL
+#include "vesuvius-c.h"
+#include <stdio.h>
+
+// Times region reads over HTTP, against vesuvius_testserver or any other zarr
+//     - every run opens the volume afresh without a disk cache and drops the idle connections first,
+//       so the cold read pays for connecting and downloading every block, and the warm read of the
+//       same region right after comes from the in-memory cache
+//     - the region is repeated at several download concurrencies, see set_max_parallel_downloads
+//     - prints one tab separated line per concurrency with the median of the runs
+//
+// usage: vesuvius_netbench [url] [--roi 256] [--runs 3]
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    const char *url = "http://localhost:8080";
+    s32 roi = 256;
+    int runs = 3;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--roi") == 0 && i + 1 < argc) roi = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+        else if (argv[i][0] != '-') url = argv[i];
+        else roi = 0;
+    }
+    if (roi <= 0 || runs <= 0 || runs > 64) {
+        fprintf(stderr, "usage: %s [url] [--roi 256] [--runs 3]\n", argv[0]);
+        return 1;
+    }
+
+    int concurrencies[] = {1, 4, 16, 64};
+    printf("concurrency\tblocks\tcold_ms\twarm_ms\tblocks_per_s\n");
+    for (int c = 0; c < (int)(sizeof(concurrencies) / sizeof(concurrencies[0])); c++) {
+        set_max_parallel_downloads(concurrencies[c]);
+        double cold[64], warm[64];
+        int nblocks = 0;
+        for (int r = 0; r < runs; r++) {
+            close_idle_connections();
+            volume *vol = vs_vol_new_store(vs_store_http_new(url), NULL);
+            if (vol == NULL) {
+                fprintf(stderr, "could not open %s\n", url);
+                return 1;
+            }
+            // background read-ahead would compete with the reads being timed
+            vs_vol_set_readahead(vol, 0);
+            s32 start[3] = {0, 0, 0};
+            s32 dims[3];
+            nblocks = 1;
+            for (int i = 0; i < 3; i++) {
+                dims[i] = MIN(roi, vol->metadata.shape[i]);
+                nblocks *= (dims[i] + vol->metadata.chunks[i] - 1) / vol->metadata.chunks[i];
+            }
+
+            double t = now_seconds();
+            tchunk *first = vs_vol_get_tchunk(vol, start, dims);
+            cold[r] = now_seconds() - t;
+            t = now_seconds();
+            tchunk *second = vs_vol_get_tchunk(vol, start, dims);
+            warm[r] = now_seconds() - t;
+            if (first == NULL || second == NULL) {
+                fprintf(stderr, "could not read the region from %s\n", url);
+                return 1;
+            }
+            vs_tchunk_free(first);
+            vs_tchunk_free(second);
+            vs_vol_free(vol);
+        }
+        qsort(cold, runs, sizeof(double), compare_doubles);
+        qsort(warm, runs, sizeof(double), compare_doubles);
+        printf("%d\t%d\t%.2f\t%.2f\t%.1f\n", concurrencies[c], nblocks, cold[runs / 2] * 1e3, warm[runs / 2] * 1e3, nblocks / cold[runs / 2]);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #define VESUVIUS_IMPL
 #include "vesuvius-c.h"
 
@@ -6,6 +7,18 @@
 #define TEST_ZARRAY_URL "https://dl.ash2txt.org/full-scrolls/Scroll1/PHercParis4.volpkg/volumes_zarr_standardized/54keV_7.91um_Scroll1A.zarr/0/.zarray"
 #define TEST_ZARR_BLOCK_URL "https://dl.ash2txt.org/full-scrolls/Scroll1/PHercParis4.volpkg/volumes_zarr_standardized/54keV_7.91um_Scroll1A.zarr/0/30/30/30"
 
+#include <ftw.h>
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+  (void)st; (void)flag; (void)ftw;
+  return remove(path);
+}
+
+// delete a directory a test wrote, with everything in it
+static void remove_tree(const char* path) {
+  nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
 int testcurl() {
   printf("%s\n",__FUNCTION__);
   int ret = 0;
@@ -309,6 +322,1359 @@ int testvol() {
   return ret;
 }
 
+int testcache() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  LRUCache* mycache = init_cache();
+  if (mycache == NULL) { ret = 1; goto cleanup; }
+
+  // enough entries to force several bucket resizes, every one must stay reachable
+  for (int i = 0; i < 4096; i++) {
+    MemoryChunk c = {.data = malloc(16), .size = 16};
+    release_cache(mycache, put_cache(mycache, i % 16, (i / 16) % 16, i / 256, c));
+  }
+  if (cache_count(mycache) != 4096 || cache_bytes(mycache) != 4096 * 16) { ret = 1; goto cleanup; }
+  for (int i = 0; i < 4096; i++) {
+    LRUNode* node = get_cache(mycache, i % 16, (i / 16) % 16, i / 256);
+    if (node == NULL) { ret = 1; goto cleanup; }
+    release_cache(mycache, node);
+  }
+
+  // shrinking the budget evicts the least recently used entries, whichever shard they are in
+  set_cache_max_bytes(mycache, 100 * 16);
+  if (cache_count(mycache) != 100 || cache_bytes(mycache) != 100 * 16) { ret = 1; goto cleanup; }
+  if (get_cache(mycache, 0, 0, 0) != NULL) { ret = 1; goto cleanup; }
+  LRUNode* recent = get_cache(mycache, 15, 15, 15);
+  if (recent == NULL) { ret = 1; goto cleanup; }
+  release_cache(mycache, recent);
+
+  // a pinned entry stays readable after it is replaced and evicted
+  MemoryChunk first = {.data = calloc(1, 16), .size = 16};
+  LRUNode* pinned = put_cache(mycache, 15, 15, 15, first);
+  MemoryChunk big = {.data = malloc(64), .size = 64};
+  release_cache(mycache, put_cache(mycache, 15, 15, 15, big));
+  if (pinned->chunk.data[15] != 0) { ret = 1; goto cleanup; }
+  release_cache(mycache, pinned);
+  LRUNode* replaced = get_cache(mycache, 15, 15, 15);
+  if (replaced == NULL || replaced->chunk.size != 64) { ret = 1; goto cleanup; }
+  release_cache(mycache, replaced);
+  // replacing an entry must not leave a stale node behind
+  if (cache_count(mycache) > 100 || cache_bytes(mycache) > 100 * 16) { ret = 1; goto cleanup; }
+
+  // the budget is shared by the shards, so chunks far larger than a shard's share of it stay cached
+  set_cache_max_bytes(mycache, 4 << 20);
+  for (int i = 0; i < 4; i++) {
+    MemoryChunk c = {.data = malloc(1 << 20), .size = 1 << 20};
+    release_cache(mycache, put_cache(mycache, 100 + i, 0, 0, c));
+  }
+  if (cache_count(mycache) != 4 || cache_bytes(mycache) != 4 << 20) { ret = 1; goto cleanup; }
+  // and the chunk just inserted is never evicted, even if it alone is over the budget
+  MemoryChunk huge = {.data = malloc(5 << 20), .size = 5 << 20};
+  release_cache(mycache, put_cache(mycache, 200, 0, 0, huge));
+  if (cache_count(mycache) != 1 || cache_bytes(mycache) != 5 << 20) { ret = 1; goto cleanup; }
+
+  cleanup:
+  free_cache(mycache);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+static void* testcache_worker(void* arg) {
+  LRUCache* mycache = arg;
+  for (int i = 0; i < 20000; i++) {
+    int key = (i * 7919) % 512;
+    LRUNode* node = get_cache(mycache, key, key / 8, key / 64);
+    if (node == NULL) {
+      MemoryChunk c = {.data = malloc(256), .size = 256};
+      memset(c.data, key & 0xff, 256);
+      node = put_cache(mycache, key, key / 8, key / 64, c);
+    }
+    if (node->chunk.data[255] != (key & 0xff)) { return (void*)1; }
+    release_cache(mycache, node);
+  }
+  return NULL;
+}
+
+int testcachethreads() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  pthread_t threads[8];
+  LRUCache* mycache = init_cache();
+  if (mycache == NULL) { return 1; }
+  // small enough that the threads keep evicting each other's entries
+  set_cache_max_bytes(mycache, 64 * 256);
+
+  for (int i = 0; i < 8; i++) {
+    pthread_create(&threads[i], NULL, testcache_worker, mycache);
+  }
+  for (int i = 0; i < 8; i++) {
+    void* result;
+    pthread_join(threads[i], &result);
+    if (result != NULL) { ret = 1; }
+  }
+  if (cache_bytes(mycache) > 64 * 256) { ret = 1; }
+
+  free_cache(mycache);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+static int singleflight_loads = 0;
+static pthread_mutex_t singleflight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* testsingleflight_worker(void* arg) {
+  LRUCache* mycache = arg;
+  LRUNode* node = NULL;
+  int status = claim_cache(mycache, 1, 2, 3, 1, &node);
+  if (status == CACHE_CLAIMED) {
+    pthread_mutex_lock(&singleflight_lock);
+    singleflight_loads++;
+    pthread_mutex_unlock(&singleflight_lock);
+    usleep(50000); // give the other threads time to pile up behind this load
+    MemoryChunk c = {.data = malloc(32), .size = 32};
+    memset(c.data, 7, 32);
+    node = complete_cache(mycache, 1, 2, 3, &c);
+  } else if (status != CACHE_HIT) {
+    return (void*)1;
+  }
+  if (node == NULL || node->chunk.data[31] != 7) { return (void*)1; }
+  release_cache(mycache, node);
+  return NULL;
+}
+
+int testsingleflight() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  pthread_t threads[8];
+  LRUCache* mycache = init_cache();
+  if (mycache == NULL) { return 1; }
+
+  for (int i = 0; i < 8; i++) {
+    pthread_create(&threads[i], NULL, testsingleflight_worker, mycache);
+  }
+  for (int i = 0; i < 8; i++) {
+    void* result;
+    pthread_join(threads[i], &result);
+    if (result != NULL) { ret = 1; }
+  }
+  if (singleflight_loads != 1) { ret = 1; }
+
+  // a failed load is reported to the caller that didn't load it, and the next claim retries
+  LRUNode* node = NULL;
+  if (claim_cache(mycache, 4, 5, 6, 1, &node) != CACHE_CLAIMED) { ret = 1; }
+  if (claim_cache(mycache, 4, 5, 6, 0, &node) != CACHE_PENDING) { ret = 1; }
+  if (complete_cache(mycache, 4, 5, 6, NULL) != NULL) { ret = 1; }
+  if (claim_cache(mycache, 4, 5, 6, 1, &node) != CACHE_CLAIMED) { ret = 1; }
+  complete_cache(mycache, 4, 5, 6, NULL);
+
+  free_cache(mycache);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+typedef struct {
+  long sizes[4];
+  long codes[4];
+  int calls;
+} paralleldownload_result;
+
+static void paralleldownload_done(int index, MemoryChunk* body, long http_code, void* userdata) {
+  paralleldownload_result* result = userdata;
+  result->sizes[index] = body->data ? (long)body->size : -1;
+  result->codes[index] = http_code;
+  result->calls++;
+  free(body->data);
+}
+
+int testparalleldownload() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  char* urls[4] = {
+    TEST_ZARR_BLOCK_URL,
+    TEST_ZARRAY_URL,
+    TEST_ZARR_BLOCK_URL,
+    TEST_ZARR_URL "not/a/block",
+  };
+  paralleldownload_result result = {0};
+  void* block = NULL;
+
+  long block_size = vs_download(TEST_ZARR_BLOCK_URL, &block);
+  if (block_size <= 0) { ret = 1; goto cleanup; }
+
+  if (download_parallel(urls, 4, 2, paralleldownload_done, &result) != 0) { ret = 1; goto cleanup; }
+  if (result.calls != 4) { ret = 1; goto cleanup; }
+  if (result.codes[0] != 200 || result.sizes[0] != block_size) { ret = 1; goto cleanup; }
+  if (result.codes[1] != 200 || result.sizes[1] <= 0) { ret = 1; goto cleanup; }
+  if (result.codes[2] != 200 || result.sizes[2] != block_size) { ret = 1; goto cleanup; }
+  if (result.codes[3] != 404) { ret = 1; goto cleanup; }
+
+  cleanup:
+  free(block);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+static void testconnectionreuse_done(int index, MemoryChunk* body, long http_code, void* userdata) {
+  (void)index;
+  (void)http_code;
+  (void)userdata;
+  free(body->data);
+  body->data = NULL;
+}
+
+int testconnectionreuse() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  long connects = -1;
+  void* buf = NULL;
+
+  // the first download may or may not find a live connection, the second one must reuse it
+  if (vs_download(TEST_ZARRAY_URL, &buf) <= 0) { ret = 1; goto cleanup; }
+  free(buf);
+  buf = NULL;
+
+  CURL* curl = acquire_curl_handle(TEST_ZARRAY_URL);
+  if (curl == NULL) { ret = 1; goto cleanup; }
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  if (curl_easy_perform(curl) != CURLE_OK) { ret = 1; }
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  release_curl_handle(curl);
+  if (connects != 0) { ret = 1; }
+
+  // parallel downloads leave their connection with a pooled multi handle, which the next batch reuses
+  char* urls[1] = {TEST_ZARRAY_URL};
+  if (download_parallel(urls, 1, 1, testconnectionreuse_done, NULL) != 0) { ret = 1; goto cleanup; }
+  CURLM* multi = acquire_multi_handle();
+  if (multi == NULL || (curl = acquire_curl_handle(TEST_ZARRAY_URL)) == NULL) { ret = 1; goto cleanup; }
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  curl_multi_add_handle(multi, curl);
+  int running = 1;
+  while (running > 0 && curl_multi_perform(multi, &running) == CURLM_OK) {
+    if (running > 0) curl_multi_poll(multi, NULL, 0, 1000, NULL);
+  }
+  connects = -1;
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  curl_multi_remove_handle(multi, curl);
+  release_curl_handle(curl);
+  release_multi_handle(multi, 0);
+  if (connects != 0) { ret = 1; }
+
+  cleanup:
+  free(buf);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testprefetch() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* mychunk = NULL;
+  volume* vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL);
+  if (vol == NULL) { return 1; }
+
+  s32 start[3] = {2048, 2048, 2048};
+  s32 dims[3] = {256, 256, 256};
+  int nblocks = 1;
+  for (int i = 0; i < 3; i++) {
+    nblocks *= (start[i] + dims[i] - 1) / vol->metadata.chunks[i] - start[i] / vol->metadata.chunks[i] + 1;
+  }
+
+  if (vs_vol_prefetch(vol, start, dims) != 0) { ret = 1; goto cleanup; }
+  // queueing the same region again while it loads must not load anything twice
+  if (vs_vol_prefetch(vol, start, dims) != 0) { ret = 1; goto cleanup; }
+  vs_vol_prefetch_wait(vol);
+  if (cache_count(vol->cache) != nblocks) { ret = 1; goto cleanup; }
+
+  // the blocking read is served from memory now
+  if ((mychunk = vs_vol_get_chunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  if (cache_count(vol->cache) != nblocks) { ret = 1; goto cleanup; }
+
+  cleanup:
+  vs_chunk_free(mychunk);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testreadahead() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  slice* myslice = NULL;
+  volume* vol = NULL;
+
+  // stepping along z by one slice only asks for the layer ahead once per chunk layer
+  SweepTracker sweep = {0};
+  int blocks[3] = {128, 128, 128};
+  int dims[3] = {1, 64, 64};
+  int ahead_start[3], ahead_dims[3];
+  int requests = 0;
+  for (int z = 0; z < 256; z++) {
+    if (track_sweep(&sweep, (int[3]){z, 32, 32}, dims, blocks, 1, ahead_start, ahead_dims)) {
+      requests++;
+      if (ahead_start[0] != (z / 128 + 1) * 128 || ahead_dims[0] != 128 || ahead_dims[1] != 64) { ret = 1; goto cleanup; }
+    }
+  }
+  if (requests != 2) { ret = 1; goto cleanup; }
+  // a jump on a second axis is not a sweep
+  if (track_sweep(&sweep, (int[3]){300, 100, 32}, dims, blocks, 1, ahead_start, ahead_dims)) { ret = 1; goto cleanup; }
+
+  vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL);
+  if (vol == NULL) { ret = 1; goto cleanup; }
+  myslice = vs_slice_new((int[2]){64, 64});
+  s32 bz = vol->metadata.chunks[0], by = vol->metadata.chunks[1], bx = vol->metadata.chunks[2];
+  for (int z = 2048; z < 2048 + SWEEP_MIN_STEPS + 1; z++) {
+    if (vs_slice_fill(myslice, vol, (int[3]){z, 2048, 2048}, 0)) { ret = 1; goto cleanup; }
+  }
+  vs_vol_prefetch_wait(vol);
+  LRUNode* next = get_cache(vol->cache, 2048 / bx, 2048 / by, 2048 / bz + 1);
+  if (next == NULL) { ret = 1; goto cleanup; }
+  release_cache(vol->cache, next);
+
+  cleanup:
+  vs_slice_free(myslice);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testdiskcache() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  unsigned char raw[8 * 8 * 8];
+  unsigned char compressed[sizeof(raw) + BLOSC2_MAX_OVERHEAD];
+  MemoryChunk chunk = {0};
+  MemoryChunk ondisk = {0};
+
+  // the legacy disk cache lives under the working directory, so run in a scratch one
+  char cwd[1024];
+  char tmpdir[] = "/tmp/vesuvius-testdiskcache-XXXXXX";
+  if (getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(tmpdir) == NULL) { return 1; }
+  if (chdir(tmpdir) != 0) { remove_tree(tmpdir); return 1; }
+
+  // point the legacy API at a volume that only exists in the disk cache
+  char saved_url[URL_SIZE];
+  strcpy(saved_url, ZARR_URL);
+  int saved_chunks[3] = {CHUNK_SIZE_Z, CHUNK_SIZE_Y, CHUNK_SIZE_X};
+  LRUCache* saved_cache = cache;
+  snprintf(ZARR_URL, URL_SIZE, "http://localhost:1/testdiskcache.zarr/0/");
+  CHUNK_SIZE_Z = CHUNK_SIZE_Y = CHUNK_SIZE_X = 8;
+  cache = init_cache();
+
+  for (int i = 0; i < (int)sizeof(raw); i++) raw[i] = i % 7;
+  int len = blosc2_compress(5, 1, 1, raw, sizeof(raw), compressed, sizeof(compressed));
+  if (len <= 0) { ret = 1; goto cleanup; }
+
+  // chunks are stored compressed, as they come from the server
+  MemoryChunk written = {.data = compressed, .size = len};
+  if (write_chunk_to_disk(1, 2, 3, &written) != 0) { ret = 1; goto cleanup; }
+  if (read_chunk_from_disk(1, 2, 3, &ondisk) != 0) { ret = 1; goto cleanup; }
+  if (ondisk.size != (size_t)len || memcmp(ondisk.data, compressed, len) != 0) { ret = 1; goto cleanup; }
+
+  // and decompressed when loaded
+  if (fetch_zarr_chunk(1, 2, 3, &chunk) != 0) { ret = 1; goto cleanup; }
+  if (chunk.size != sizeof(raw) || memcmp(chunk.data, raw, sizeof(raw)) != 0) { ret = 1; goto cleanup; }
+
+  // caches from before chunks were stored compressed hold the raw voxels
+  written = (MemoryChunk){.data = raw, .size = sizeof(raw)};
+  if (write_chunk_to_disk(4, 5, 6, &written) != 0) { ret = 1; goto cleanup; }
+  release_zarr_chunk(&chunk);
+  if (fetch_zarr_chunk(4, 5, 6, &chunk) != 0) { ret = 1; goto cleanup; }
+  if (chunk.size != sizeof(raw) || memcmp(chunk.data, raw, sizeof(raw)) != 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  release_zarr_chunk(&chunk);
+  free(ondisk.data);
+  free_cache(cache);
+  cache = saved_cache;
+  strcpy(ZARR_URL, saved_url);
+  CHUNK_SIZE_Z = saved_chunks[0]; CHUNK_SIZE_Y = saved_chunks[1]; CHUNK_SIZE_X = saved_chunks[2];
+  if (chdir(cwd) != 0) { ret = 1; }
+  remove_tree(tmpdir);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testvolblockcache() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* mychunk = NULL;
+  void* served = NULL;
+  unsigned char* ondisk = NULL;
+  FILE* fp = NULL;
+  volume* vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL);
+  if (vol == NULL) { return 1; }
+
+  // make sure block 30/30/30 has to be downloaded
+  char blockpath[1024];
+  snprintf(blockpath, sizeof(blockpath), "%s/30/30/30", vol->cache_dir);
+  remove(blockpath);
+
+  s32 start[3] = {30 * vol->metadata.chunks[0], 30 * vol->metadata.chunks[1], 30 * vol->metadata.chunks[2]};
+  s32 dims[3] = {vol->metadata.chunks[0], vol->metadata.chunks[1], vol->metadata.chunks[2]};
+  if ((mychunk = vs_vol_get_chunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+
+  // the disk cache holds the block byte for byte as the server sent it
+  long len = vs_download(TEST_ZARR_BLOCK_URL, &served);
+  if (len <= 0) { ret = 1; goto cleanup; }
+  if ((fp = fopen(blockpath, "rb")) == NULL) { ret = 1; goto cleanup; }
+  fseek(fp, 0, SEEK_END);
+  if (ftell(fp) != len) { ret = 1; goto cleanup; }
+  rewind(fp);
+  ondisk = malloc(len);
+  if (fread(ondisk, 1, len, fp) != (size_t)len || memcmp(ondisk, served, len) != 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  if (fp) fclose(fp);
+  free(ondisk);
+  free(served);
+  vs_chunk_free(mychunk);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testtchunk() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* mychunk = NULL;
+  chunk* floats = NULL;
+  tchunk* typed = NULL;
+  tchunk* pooled = NULL;
+  histogram* hist = NULL;
+  histogram* typedhist = NULL;
+  volume* vol = NULL;
+
+  // voxels keep their dtype, floats are clamped when stored
+  typed = vs_tchunk_new((s32[3]){5, 6, 7}, VS_U8);
+  for (int z = 0; z < 5; z++) for (int y = 0; y < 6; y++) for (int x = 0; x < 7; x++) {
+    vs_tchunk_set(typed, z, y, x, (z * 31 + y * 17 + x * 13) % 256);
+  }
+  vs_tchunk_set(typed, 0, 0, 0, 300.0f);
+  vs_tchunk_set(typed, 0, 0, 1, -5.0f);
+  if (vs_tchunk_get(typed, 0, 0, 0) != 255.0f || vs_tchunk_get(typed, 0, 0, 1) != 0.0f) { ret = 1; goto cleanup; }
+
+  floats = vs_tchunk_to_chunk(typed);
+  for (int z = 0; z < 5; z++) for (int y = 0; y < 6; y++) for (int x = 0; x < 7; x++) {
+    if (vs_chunk_get(floats, z, y, x) != vs_tchunk_get(typed, z, y, x)) { ret = 1; goto cleanup; }
+  }
+
+  // pooling works on the stored voxels, windows are clipped at the edges
+  pooled = vs_tchunk_maxpool(typed, 2, 2);
+  if (pooled->dtype != VS_U8 || pooled->dims[0] != 3 || pooled->dims[1] != 3 || pooled->dims[2] != 4) { ret = 1; goto cleanup; }
+  for (int z = 0; z < 3; z++) for (int y = 0; y < 3; y++) for (int x = 0; x < 4; x++) {
+    f32 max = 0.0f;
+    for (int zi = 2 * z; zi < 2 * z + 2 && zi < 5; zi++)
+      for (int yi = 2 * y; yi < 2 * y + 2 && yi < 6; yi++)
+        for (int xi = 2 * x; xi < 2 * x + 2 && xi < 7; xi++) max = fmaxf(max, vs_tchunk_get(typed, zi, yi, xi));
+    if (vs_tchunk_get(pooled, z, y, x) != max) { ret = 1; goto cleanup; }
+  }
+  vs_tchunk_free(pooled);
+  pooled = vs_tchunk_avgpool(typed, 5, 5);
+  f32 sum = 0.0f;
+  for (int i = 0; i < 5 * 5 * 5; i++) sum += vs_tchunk_get(typed, i / 25, i / 5 % 5, i % 5);
+  if (vs_tchunk_get(pooled, 0, 0, 0) != roundf(sum / 125)) { ret = 1; goto cleanup; }
+
+  // the histogram of a u8 chunk matches the float one
+  hist = vs_chunk_histogram(floats->data, 5, 6, 7, 16);
+  typedhist = vs_tchunk_histogram(typed, 16);
+  if (hist->min_value != typedhist->min_value || hist->max_value != typedhist->max_value) { ret = 1; goto cleanup; }
+  for (int i = 0; i < 16; i++) {
+    if (hist->bins[i] != typedhist->bins[i]) { ret = 1; goto cleanup; }
+  }
+
+  // the volume hands out the same voxels as u8 as it does as floats
+  vs_tchunk_free(typed);
+  typed = NULL;
+  if ((vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL)) == NULL) { ret = 1; goto cleanup; }
+  if ((typed = vs_vol_get_tchunk(vol, (s32[3]){2048, 2048, 2048}, (s32[3]){128, 128, 128})) == NULL) { ret = 1; goto cleanup; }
+  if ((mychunk = vs_vol_get_chunk(vol, (s32[3]){2048, 2048, 2048}, (s32[3]){128, 128, 128})) == NULL) { ret = 1; goto cleanup; }
+  if (typed->dtype != VS_U8) { ret = 1; goto cleanup; }
+  for (int i = 0; i < 128 * 128 * 128; i++) {
+    if (mychunk->data[i] != typed->data[i]) { ret = 1; goto cleanup; }
+  }
+
+  cleanup:
+  vs_histogram_free(hist);
+  vs_histogram_free(typedhist);
+  vs_tchunk_free(pooled);
+  vs_tchunk_free(typed);
+  vs_chunk_free(floats);
+  vs_chunk_free(mychunk);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testzarr16() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  tchunk* block = NULL;
+  tchunk* decoded = NULL;
+  chunk* floats = NULL;
+  void* compressed = NULL;
+  u16* raw = NULL;
+  const char* dtypes[] = {"<u2", ">u2"};
+
+  // odd dimensions so the vector kernels also have to handle a tail
+  s32 dims[3] = {3, 5, 7};
+  s32 count = 3 * 5 * 7;
+  block = vs_tchunk_new(dims, VS_U16);
+  u16* values = (u16*)block->data;
+  for (int i = 0; i < count; i++) values[i] = (u16)(i * 617 + 1);
+
+  for (int d = 0; d < 2; d++) {
+    zarr_metadata metadata = {.chunks = {3, 5, 7}, .compressor = {.cname = "lz4", .clevel = 5, .shuffle = 1}};
+    strcpy(metadata.dtype, dtypes[d]);
+
+    int len = vs_zarr_compress_tchunk(block, metadata, &compressed);
+    if (len <= 0) { ret = 1; goto cleanup; }
+
+    // the block is stored in the byte order of the dtype
+    raw = malloc(count * sizeof(u16));
+    if (blosc2_decompress(compressed, len, raw, count * sizeof(u16)) != count * (int)sizeof(u16)) { ret = 1; goto cleanup; }
+    for (int i = 0; i < count; i++) {
+      u8* bytes = (u8*)&raw[i];
+      u16 stored = d == 0 ? (u16)(bytes[0] | bytes[1] << 8) : (u16)(bytes[0] << 8 | bytes[1]);
+      if (stored != values[i]) { ret = 1; goto cleanup; }
+    }
+
+    // and comes back in host order
+    if ((decoded = vs_zarr_decompress_tchunk(len, compressed, metadata)) == NULL) { ret = 1; goto cleanup; }
+    if ((floats = vs_zarr_decompress_chunk(len, compressed, metadata)) == NULL) { ret = 1; goto cleanup; }
+    if (decoded->dtype != VS_U16 || memcmp(decoded->data, block->data, count * sizeof(u16)) != 0) { ret = 1; goto cleanup; }
+    for (int i = 0; i < count; i++) {
+      if (floats->data[i] != values[i]) { ret = 1; goto cleanup; }
+    }
+
+    // floats are clamped to the u16 range when written
+    free(compressed);
+    compressed = NULL;
+    floats->data[0] = -3.0f;
+    floats->data[1] = 70000.0f;
+    floats->data[count - 1] = 1234.75f;
+    vs_tchunk_free(decoded);
+    decoded = NULL;
+    if ((len = vs_zarr_compress_chunk(floats, metadata, &compressed)) <= 0) { ret = 1; goto cleanup; }
+    if ((decoded = vs_zarr_decompress_tchunk(len, compressed, metadata)) == NULL) { ret = 1; goto cleanup; }
+    u16* clamped = (u16*)decoded->data;
+    if (clamped[0] != 0 || clamped[1] != 65535 || clamped[count - 1] != 1234 || clamped[2] != values[2]) { ret = 1; goto cleanup; }
+
+    free(raw);
+    raw = NULL;
+    free(compressed);
+    compressed = NULL;
+    vs_tchunk_free(decoded);
+    decoded = NULL;
+    vs_chunk_free(floats);
+    floats = NULL;
+  }
+
+  cleanup:
+  free(raw);
+  free(compressed);
+  vs_tchunk_free(block);
+  vs_tchunk_free(decoded);
+  vs_chunk_free(floats);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testconvert() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* floats = NULL;
+  tchunk* bytes = NULL;
+  tchunk* shorts = NULL;
+  chunk* back = NULL;
+
+  // every length up to a few vectors, so the vector loops and their scalar tails are both covered
+  for (int n = 1; n <= 100 && ret == 0; n++) {
+    floats = vs_chunk_new((s32[3]){1, 1, n});
+    for (int i = 0; i < n; i++) floats->data[i] = (i * 7919 % 1000) * 80.0f - 10000.0f + 0.75f;
+    floats->data[0] = NAN;
+    floats->data[n - 1] = n % 2 ? INFINITY : -INFINITY;
+
+    bytes = vs_chunk_to_tchunk(floats, VS_U8);
+    shorts = vs_chunk_to_tchunk(floats, VS_U16);
+    for (int i = 0; i < n; i++) {
+      f32 v = floats->data[i];
+      u8 b = v > 0.0f ? (v < 255.0f ? (u8)v : 255) : 0;
+      u16 h = v > 0.0f ? (v < 65535.0f ? (u16)v : 65535) : 0;
+      if (bytes->data[i] != b || ((u16*)shorts->data)[i] != h) { ret = 1; }
+    }
+
+    back = vs_tchunk_to_chunk(bytes);
+    for (int i = 0; i < n; i++) {
+      if (back->data[i] != bytes->data[i]) { ret = 1; }
+    }
+    vs_chunk_free(back);
+    back = vs_tchunk_to_chunk(shorts);
+    for (int i = 0; i < n; i++) {
+      if (back->data[i] != ((u16*)shorts->data)[i]) { ret = 1; }
+    }
+
+    vs_chunk_free(back);
+    vs_tchunk_free(shorts);
+    vs_tchunk_free(bytes);
+    vs_chunk_free(floats);
+    back = NULL; shorts = NULL; bytes = NULL; floats = NULL;
+  }
+
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testzarrv3() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  const char* zarr_json =
+    "{\"zarr_format\": 3, \"node_type\": \"array\", \"shape\": [1024, 2048, 4096], \"data_type\": \"uint16\","
+    " \"chunk_grid\": {\"name\": \"regular\", \"configuration\": {\"chunk_shape\": [512, 512, 512]}},"
+    " \"chunk_key_encoding\": {\"name\": \"default\", \"configuration\": {\"separator\": \"/\"}},"
+    " \"fill_value\": 0,"
+    " \"codecs\": [{\"name\": \"sharding_indexed\", \"configuration\": {"
+    "   \"chunk_shape\": [128, 128, 128],"
+    "   \"codecs\": [{\"name\": \"bytes\", \"configuration\": {\"endian\": \"big\"}},"
+    "              {\"name\": \"blosc\", \"configuration\": {\"cname\": \"zstd\", \"clevel\": 3, \"shuffle\": \"bitshuffle\", \"typesize\": 2, \"blocksize\": 0}}],"
+    "   \"index_codecs\": [{\"name\": \"bytes\", \"configuration\": {\"endian\": \"little\"}}, {\"name\": \"crc32c\"}],"
+    "   \"index_location\": \"end\"}}]}";
+
+  zarr_metadata metadata = {0};
+  if (vs_zarr_parse_metadata(zarr_json, &metadata) != 0) { ret = 1; goto cleanup; }
+  if (metadata.zarr_format != 3 || metadata.shape[2] != 4096) { ret = 1; goto cleanup; }
+  // the shard is the stored object, the inner chunks are the blocks that are read
+  if (metadata.shard_shape[0] != 512 || metadata.chunks[0] != 128 || metadata.chunks[2] != 128) { ret = 1; goto cleanup; }
+  if (metadata.shard_index_at_start || !metadata.shard_index_crc) { ret = 1; goto cleanup; }
+  if (!metadata.key_prefix || metadata.separator != '/') { ret = 1; goto cleanup; }
+  if (strcmp(metadata.dtype, ">u2") != 0 || strcmp(metadata.compressor.cname, "zstd") != 0 ||
+      metadata.compressor.shuffle != 2 || metadata.compressor.clevel != 3) { ret = 1; goto cleanup; }
+
+  // codecs this library can't decode are refused up front
+  zarr_metadata unsupported = {0};
+  if (vs_zarr_parse_metadata("{\"zarr_format\": 3, \"data_type\": \"uint8\", \"codecs\": [{\"name\": \"bytes\"}, {\"name\": \"gzip\"}]}",
+                             &unsupported) == 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testunaligned() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* block = NULL;
+  chunk* roi = NULL;
+  chunk* edge = NULL;
+  volume* vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL);
+  if (vol == NULL) { return 1; }
+
+  s32 start[3] = {30 * vol->metadata.chunks[0], 30 * vol->metadata.chunks[1], 30 * vol->metadata.chunks[2]};
+  s32 dims[3] = {vol->metadata.chunks[0], vol->metadata.chunks[1], vol->metadata.chunks[2]};
+  if ((block = vs_vol_get_chunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+
+  // a region that lines up with nothing matches the same voxels of the whole block
+  s32 roi_start[3] = {start[0] + 3, start[1] + 5, start[2] + 7};
+  s32 roi_dims[3] = {20, 30, 40};
+  if ((roi = vs_chunk_new(roi_dims)) == NULL) { ret = 1; goto cleanup; }
+  if (vs_chunk_fill(roi, vol, roi_start)) { ret = 1; goto cleanup; }
+  for (int z = 0; z < roi_dims[0]; z++) {
+    for (int y = 0; y < roi_dims[1]; y++) {
+      for (int x = 0; x < roi_dims[2]; x++) {
+        if (vs_chunk_get(roi, z, y, x) != vs_chunk_get(block, z + 3, y + 5, x + 7)) { ret = 1; goto cleanup; }
+      }
+    }
+  }
+
+  // a region hanging off the far corner of the volume is clipped, the voxels past the edge are 0
+  s32 edge_start[3] = {vol->metadata.shape[0] - 4, vol->metadata.shape[1] - 4, vol->metadata.shape[2] - 4};
+  s32 edge_dims[3] = {8, 8, 8};
+  if ((edge = vs_vol_get_chunk(vol, edge_start, edge_dims)) == NULL) { ret = 1; goto cleanup; }
+  for (int z = 0; z < edge_dims[0]; z++) {
+    for (int y = 0; y < edge_dims[1]; y++) {
+      for (int x = 0; x < edge_dims[2]; x++) {
+        if ((z >= 4 || y >= 4 || x >= 4) && vs_chunk_get(edge, z, y, x) != 0.0f) { ret = 1; goto cleanup; }
+      }
+    }
+  }
+
+  // regions must start inside the volume
+  s32 outside[3] = {vol->metadata.shape[0], 0, 0};
+  if (vs_chunk_fill(roi, vol, outside) == 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  vs_chunk_free(block);
+  vs_chunk_free(roi);
+  vs_chunk_free(edge);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testgraft() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  s32 dims[3] = {128, 128, 128};
+  s32 big_dims[3] = {264, 128, 128};
+  s32 split_dims[3] = {256, 128, 128};
+  chunk* src = vs_chunk_new(dims);
+  chunk* dest = vs_chunk_new(dims);
+  chunk* big = vs_chunk_new(big_dims);
+  chunk* split = vs_chunk_new(split_dims);
+  chunk* serial = vs_chunk_new(split_dims);
+  if (src == NULL || dest == NULL || big == NULL || split == NULL || serial == NULL) { ret = 1; goto cleanup; }
+  for (int z = 0; z < dims[0]; z++) {
+    for (int y = 0; y < dims[1]; y++) {
+      for (int x = 0; x < dims[2]; x++) {
+        vs_chunk_set(src, z, y, x, (f32)(z * 10000 + y * 100 + x));
+      }
+    }
+  }
+
+  // a region narrower than the chunks is copied row by row
+  s32 src_start[3] = {5, 6, 7};
+  s32 dest_start[3] = {1, 2, 3};
+  s32 region[3] = {100, 50, 60};
+  memset(dest->data, 0, sizeof(f32) * dims[0] * dims[1] * dims[2]);
+  if (vs_chunk_graft(dest, src, src_start, dest_start, region)) { ret = 1; goto cleanup; }
+  for (int z = 0; z < region[0]; z++) {
+    for (int y = 0; y < region[1]; y++) {
+      for (int x = 0; x < region[2]; x++) {
+        if (vs_chunk_get(dest, z + 1, y + 2, x + 3) != vs_chunk_get(src, z + 5, y + 6, x + 7)) { ret = 1; goto cleanup; }
+      }
+    }
+  }
+  if (vs_chunk_get(dest, 0, 0, 0) != 0.0f || vs_chunk_get(dest, 1, 2, 63) != 0.0f) { ret = 1; goto cleanup; }
+
+  // full width planes split across threads, 256 * 128 * 128 voxels is enough for all 4 to get a slab
+  // (see VS_GRAFT_THREAD_VOXELS), and the result matches the single threaded copy
+  for (s64 i = 0; i < (s64)big_dims[0] * big_dims[1] * big_dims[2]; i++) {
+    big->data[i] = (f32)i;
+  }
+  s32 plane_start[3] = {8, 0, 0};
+  s32 origin[3] = {0, 0, 0};
+  memset(split->data, 0, sizeof(f32) * split_dims[0] * split_dims[1] * split_dims[2]);
+  memset(serial->data, 0, sizeof(f32) * split_dims[0] * split_dims[1] * split_dims[2]);
+  if (vs_chunk_graft_mt(split, big, plane_start, origin, split_dims, 4)) { ret = 1; goto cleanup; }
+  if (vs_chunk_graft(serial, big, plane_start, origin, split_dims)) { ret = 1; goto cleanup; }
+  if (memcmp(split->data, serial->data, sizeof(f32) * split_dims[0] * split_dims[1] * split_dims[2]) != 0) { ret = 1; goto cleanup; }
+  for (int z = 0; z < split_dims[0]; z += 85) {
+    if (vs_chunk_get(split, z, 127, 127) != vs_chunk_get(big, z + 8, 127, 127)) { ret = 1; goto cleanup; }
+  }
+
+  // regions must fit in both chunks
+  s32 too_big[3] = {128, 128, 128};
+  if (vs_chunk_graft(dest, src, src_start, origin, too_big) == 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  vs_chunk_free(src);
+  vs_chunk_free(dest);
+  vs_chunk_free(big);
+  vs_chunk_free(split);
+  vs_chunk_free(serial);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testmissingblock() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* mychunk = NULL;
+  FILE* fp = NULL;
+  volume* vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL);
+  if (vol == NULL) { return 1; }
+
+  // record block 30/30/30 as missing, it is then read as the fill value without being downloaded
+  char blockpath[1024];
+  char missingpath[1100];
+  snprintf(blockpath, sizeof(blockpath), "%s/30/30/30", vol->cache_dir);
+  snprintf(missingpath, sizeof(missingpath), "%s.missing", blockpath);
+  remove(blockpath);
+  if ((fp = fopen(missingpath, "wb")) == NULL) { ret = 1; goto cleanup; }
+  fclose(fp);
+  vol->metadata.fill_value = 7;
+
+  s32 start[3] = {30 * vol->metadata.chunks[0] - 1, 30 * vol->metadata.chunks[1], 30 * vol->metadata.chunks[2]};
+  s32 dims[3] = {2, vol->metadata.chunks[1], vol->metadata.chunks[2]};
+  if ((mychunk = vs_vol_get_chunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  for (int y = 0; y < dims[1]; y++) {
+    for (int x = 0; x < dims[2]; x++) {
+      if (vs_chunk_get(mychunk, 1, y, x) != 7.0f) { ret = 1; goto cleanup; }
+    }
+  }
+  if (vs__path_exists(blockpath)) { ret = 1; goto cleanup; }
+
+  cleanup:
+  remove(missingpath);
+  vs_chunk_free(mychunk);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testmultiscales() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  const char* zattrs =
+    "{\"multiscales\": [{\"version\": \"0.4\","
+    " \"axes\": [{\"name\": \"z\"}, {\"name\": \"y\"}, {\"name\": \"x\"}],"
+    " \"datasets\": ["
+    "   {\"path\": \"0\", \"coordinateTransformations\": [{\"type\": \"scale\", \"scale\": [7.91, 7.91, 7.91]}]},"
+    "   {\"path\": \"1\", \"coordinateTransformations\": [{\"type\": \"scale\", \"scale\": [15.82, 15.82, 15.82]}]},"
+    "   {\"path\": \"2\", \"coordinateTransformations\": [{\"type\": \"scale\", \"scale\": [31.64, 31.64, 31.64]}]},"
+    "   {\"path\": \"3\", \"coordinateTransformations\": [{\"type\": \"scale\", \"scale\": [63.28, 63.28, 63.28]}]}]}]}";
+
+  multiscale ms = {0};
+  if (vs_zarr_parse_multiscales(zattrs, &ms) != 0) { ret = 1; goto cleanup; }
+  if (ms.nlevels != 4 || strcmp(ms.paths[3], "3") != 0) { ret = 1; goto cleanup; }
+  if (vs_multiscale_factor(&ms, 2, 0) != 4 || vs_multiscale_factor(&ms, 3, 2) != 8) { ret = 1; goto cleanup; }
+
+  // the coarsest level that is still at least as fine as asked for
+  if (vs_multiscale_pick_level(&ms, 1.0f) != 0) { ret = 1; goto cleanup; }
+  if (vs_multiscale_pick_level(&ms, 3.0f) != 1) { ret = 1; goto cleanup; }
+  if (vs_multiscale_pick_level(&ms, 4.0f) != 2) { ret = 1; goto cleanup; }
+  if (vs_multiscale_pick_level(&ms, 64.0f) != 3) { ret = 1; goto cleanup; }
+
+  // zarr v3 groups keep the same metadata under attributes.ome, without transformations the levels halve
+  multiscale v3 = {0};
+  if (vs_zarr_parse_multiscales("{\"zarr_format\": 3, \"node_type\": \"group\", \"attributes\": {\"ome\": {\"multiscales\": "
+                                "[{\"datasets\": [{\"path\": \"s0\"}, {\"path\": \"s1\"}]}]}}}", &v3) != 0) { ret = 1; goto cleanup; }
+  if (v3.nlevels != 2 || strcmp(v3.paths[1], "s1") != 0 || vs_multiscale_factor(&v3, 1, 1) != 2) { ret = 1; goto cleanup; }
+
+  cleanup:
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testpyramid() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* block = NULL;
+  tchunk* level1 = NULL;
+  multiscale* ms = NULL;
+  char root[] = "/tmp/vesuvius-testpyramid-XXXXXX";
+  char path[256];
+  if (mkdtemp(root) == NULL) { return 1; }
+
+  // a 64 x 64 x 50 level 0 of 32^3 blocks, the last x block is partly outside the array
+  zarr_metadata metadata = {.shape = {64, 64, 50}, .chunks = {32, 32, 32}, .dtype = "|u1", .order = 'C', .zarr_format = 2,
+                            .compressor = {.cname = "zstd", .id = "blosc", .clevel = 3, .shuffle = 1}};
+  snprintf(path, sizeof(path), "%s/0", root);
+  if (vs__zarr_write_zarray(path, &metadata)) { ret = 1; goto cleanup; }
+  if ((block = vs_chunk_new(metadata.chunks)) == NULL) { ret = 1; goto cleanup; }
+  for (int b = 0; b < 8; b++) {
+    s32 origin[3] = {(b >> 2) * 32, (b >> 1 & 1) * 32, (b & 1) * 32};
+    for (int z = 0; z < 32; z++) {
+      for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+          vs_chunk_set(block, z, y, x, (f32)((origin[0] + z + origin[1] + y + origin[2] + x) & 255));
+        }
+      }
+    }
+    snprintf(path, sizeof(path), "%s/0/%d/%d/%d", root, b >> 2, b >> 1 & 1, b & 1);
+    if (vs_zarr_write_chunk(path, metadata, block)) { ret = 1; goto cleanup; }
+  }
+
+  if (vs_zarr_build_pyramid(root, 2, VS_DOWNSAMPLE_MAX, 4)) { ret = 1; goto cleanup; }
+  snprintf(path, sizeof(path), "%s/1/.zarray", root);
+  zarr_metadata level1_metadata = vs_zarr_parse_zarray(path);
+  if (level1_metadata.shape[0] != 32 || level1_metadata.shape[2] != 25 || level1_metadata.chunks[0] != 32) { ret = 1; goto cleanup; }
+  snprintf(path, sizeof(path), "%s/2/0/0/0", root);
+  if (!vs__path_exists(path)) { ret = 1; goto cleanup; }
+  snprintf(path, sizeof(path), "%s/.zattrs", root);
+  if (!vs__path_exists(path)) { ret = 1; goto cleanup; }
+
+  // every voxel of level 1 is the max of its 2x2x2 cube, which is the voxel at its far corner
+  snprintf(path, sizeof(path), "%s/1/0/0/0", root);
+  if ((level1 = vs_zarr_read_tchunk(path, level1_metadata)) == NULL) { ret = 1; goto cleanup; }
+  for (int z = 0; z < 32; z++) {
+    for (int y = 0; y < 32; y++) {
+      for (int x = 0; x < 25; x++) {
+        if (vs_tchunk_get(level1, z, y, x) != (f32)((2 * z + 1 + 2 * y + 1 + 2 * x + 1) & 255)) { ret = 1; goto cleanup; }
+      }
+    }
+  }
+
+  // the pyramid opens as a multiscale, here without a disk cache
+  if ((ms = vs_multiscale_new(NULL, root)) == NULL || ms->nlevels != 3) { ret = 1; goto cleanup; }
+  volume* level2 = vs_multiscale_level(ms, 2);
+  if (level2 == NULL || level2->cache_store != NULL || level2->metadata.shape[2] != 13) { ret = 1; goto cleanup; }
+
+  cleanup:
+  vs_chunk_free(block);
+  vs_tchunk_free(level1);
+  vs_multiscale_free(ms);
+  remove_tree(root);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testzerocopy() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  tchunk* column = NULL;
+  tchunk* again = NULL;
+  chunk* grafted = NULL;
+  volume* vol = vs_vol_new(TEST_CACHEDIR, TEST_ZARR_URL);
+  if (vol == NULL) { return 1; }
+
+  // a column of blocks is decompressed straight into the tchunk, and a copy of each block is cached
+  s32 start[3] = {30 * vol->metadata.chunks[0], 30 * vol->metadata.chunks[1], 30 * vol->metadata.chunks[2]};
+  s32 dims[3] = {2 * vol->metadata.chunks[0], vol->metadata.chunks[1], vol->metadata.chunks[2]};
+  int cached = cache_count(vol->cache);
+  if ((column = vs_vol_get_tchunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  if (cache_count(vol->cache) != cached + 2) { ret = 1; goto cleanup; }
+  s32* bs = vol->metadata.chunks;
+  LRUNode* node = get_cache(vol->cache, start[2] / bs[2], start[1] / bs[1], start[0] / bs[0] + 1);
+  if (node == NULL) { ret = 1; goto cleanup; }
+  tchunk* copy = (tchunk*)node->chunk.data;
+  s64 blockbytes = (s64)bs[0] * bs[1] * bs[2] * vs_dtype_size(column->dtype);
+  int same = memcmp(copy->data, column->data + blockbytes, blockbytes) == 0;
+  release_cache(vol->cache, node);
+  if (!same) { ret = 1; goto cleanup; }
+
+  // the second read comes from the volume cache without touching the disk cache
+  vs_stats before, after;
+  vs_stats_snapshot(&before);
+  if ((again = vs_vol_get_tchunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  vs_stats_snapshot(&after);
+  if (after.disk_cache_hits != before.disk_cache_hits) { ret = 1; goto cleanup; }
+  s64 nbytes = (s64)dims[0] * dims[1] * dims[2] * vs_dtype_size(column->dtype);
+  if (memcmp(column->data, again->data, nbytes) != 0) { ret = 1; goto cleanup; }
+
+  // and matches the voxels grafted through the cache
+  if ((grafted = vs_vol_get_chunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  for (int z = 0; z < dims[0]; z++) {
+    for (int y = 0; y < dims[1]; y++) {
+      for (int x = 0; x < dims[2]; x++) {
+        if (vs_tchunk_get(column, z, y, x) != vs_chunk_get(grafted, z, y, x)) { ret = 1; goto cleanup; }
+      }
+    }
+  }
+
+  cleanup:
+  vs_tchunk_free(column);
+  vs_tchunk_free(again);
+  vs_chunk_free(grafted);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+typedef struct {
+  void* compressed;
+  int len;
+  zarr_metadata metadata;
+  tchunk* expected;
+  int failed;
+} decompress_job;
+
+static void* decompress_worker(void* arg) {
+  decompress_job* job = arg;
+  for (int i = 0; i < 8; i++) {
+    tchunk* decoded = vs_zarr_decompress_tchunk(job->len, job->compressed, job->metadata);
+    s64 nbytes = (s64)job->expected->dims[0] * job->expected->dims[1] * job->expected->dims[2];
+    if (decoded == NULL || memcmp(decoded->data, job->expected->data, nbytes) != 0) job->failed = 1;
+    vs_tchunk_free(decoded);
+  }
+  return NULL;
+}
+
+int testdecompressthreads() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  s32 dims[3] = {64, 64, 64};
+  decompress_job jobs[4] = {0};
+  tchunk* block = vs_tchunk_new(dims, VS_U8);
+  void* compressed = NULL;
+  if (block == NULL) { return 1; }
+  for (int i = 0; i < 64 * 64 * 64; i++) ((u8*)block->data)[i] = (u8)(i * 7 / 64);
+
+  zarr_metadata metadata = {.chunks = {64, 64, 64}, .dtype = "|u1", .compressor = {.cname = "zstd", .clevel = 3, .shuffle = 1}};
+  int len = vs_zarr_compress_tchunk(block, metadata, &compressed);
+  if (len <= 0) { ret = 1; goto cleanup; }
+
+  // every thread decompresses with its own context, for one thread per block and for several
+  int counts[3] = {1, 4, 0};
+  for (int c = 0; c < 3; c++) {
+    set_decompress_threads(counts[c]);
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+      jobs[t] = (decompress_job){compressed, len, metadata, block, 0};
+      pthread_create(&threads[t], NULL, decompress_worker, &jobs[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+      pthread_join(threads[t], NULL);
+      if (jobs[t].failed) ret = 1;
+    }
+    if (ret) goto cleanup;
+  }
+
+  cleanup:
+  set_decompress_threads(DEFAULT_DECOMPRESS_THREADS);
+  free(compressed);
+  vs_tchunk_free(block);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testpool() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  chunk* chunks[4] = {NULL};
+  s32 dims[3] = {64, 64, 64};
+  vs_pool_trim();
+
+  // a freed chunk is handed out again for the next one of its size class
+  chunks[0] = vs_chunk_new(dims);
+  if (chunks[0] == NULL) { return 1; }
+  chunk* first = chunks[0];
+  vs_chunk_free(chunks[0]);
+  if (vs_pool_bytes() == 0) { ret = 1; goto cleanup; }
+  s32 larger[3] = {64, 64, 65};
+  if ((chunks[0] = vs_chunk_new(larger)) != first || vs_pool_bytes() != 0) { ret = 1; goto cleanup; }
+  vs_chunk_free(chunks[0]);
+  chunks[0] = NULL;
+
+  // small chunks are plain mallocs
+  s32 tiny[3] = {8, 8, 8};
+  vs_pool_trim();
+  vs_chunk_free(vs_chunk_new(tiny));
+  vs_slice_free(vs_slice_new((int[2]){16, 16}));
+  if (vs_pool_bytes() != 0) { ret = 1; goto cleanup; }
+
+  // without a budget nothing is kept, except inside a scope until it ends
+  vs_pool_set_max_bytes(0);
+  vs_chunk_free(vs_chunk_new(dims));
+  if (vs_pool_bytes() != 0) { ret = 1; goto cleanup; }
+  vs_pool_scope_begin();
+  for (int i = 0; i < 4; i++) {
+    if ((chunks[i] = vs_chunk_new(dims)) == NULL) { vs_pool_scope_end(); ret = 1; goto cleanup; }
+  }
+  for (int i = 0; i < 4; i++) {
+    vs_chunk_free(chunks[i]);
+    chunks[i] = NULL;
+  }
+  size_t kept = vs_pool_bytes();
+  vs_pool_scope_end();
+  if (kept < 4 * sizeof(f32) * 64 * 64 * 64 || vs_pool_bytes() != 0) { ret = 1; goto cleanup; }
+
+  // huge page backed buffers behave like any other
+  vs_pool_set_max_bytes(VS_POOL_DEFAULT_RETAIN);
+  vs_pool_set_huge_pages(true);
+  s32 big[3] = {128, 128, 128};
+  if ((chunks[0] = vs_chunk_new(big)) == NULL) { ret = 1; goto cleanup; }
+  vs_chunk_set(chunks[0], 127, 127, 127, 3.0f);
+  if (vs_chunk_get(chunks[0], 127, 127, 127) != 3.0f) { ret = 1; goto cleanup; }
+
+  cleanup:
+  for (int i = 0; i < 4; i++) vs_chunk_free(chunks[i]);
+  vs_pool_set_huge_pages(false);
+  vs_pool_set_max_bytes(VS_POOL_DEFAULT_RETAIN);
+  vs_pool_trim();
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int teststore() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  // a fresh directory, so leftovers of an earlier run can't add keys
+  char root[] = "/tmp/vesuvius-teststore-XXXXXX";
+  if (mkdtemp(root) == NULL) { return 1; }
+  vs_store* stores[2] = {vs_store_dir_new(root), vs_store_mem_new()};
+  void* data = NULL;
+  s64 size = 0;
+  char** keys = NULL;
+  int nkeys = 0;
+
+  for (int i = 0; i < 2; i++) {
+    vs_store* store = stores[i];
+    if (store == NULL) { ret = 1; goto cleanup; }
+    if (vs_store_put(store, ".zarray", "{}", 2)) { ret = 1; goto cleanup; }
+    if (vs_store_put(store, "0/0/1", "0123456789", 10)) { ret = 1; goto cleanup; }
+    if (vs_store_put(store, "0/0/0", "abc", 3)) { ret = 1; goto cleanup; }
+    if (vs_store_put(store, "1/0/0", "", 0)) { ret = 1; goto cleanup; }
+
+    if (vs_store_get(store, "0/0/1", &data, &size) || size != 10 || memcmp(data, "0123456789", 10)) { ret = 1; goto cleanup; }
+    free(data); data = NULL;
+    if (vs_store_get_range(store, "0/0/1", 2, 3, &data, &size) || size != 3 || memcmp(data, "234", 3)) { ret = 1; goto cleanup; }
+    free(data); data = NULL;
+    // a negative offset reads the end of the object, like the index at the end of a shard
+    if (vs_store_get_range(store, "0/0/1", -1, 4, &data, &size) || size != 4 || memcmp(data, "6789", 4)) { ret = 1; goto cleanup; }
+    free(data); data = NULL;
+    if (vs_store_get_range(store, "0/0/1", 8, 4, &data, &size) != -1) { ret = 1; goto cleanup; }
+    if (vs_store_get(store, "0/0/2", &data, &size) != 1) { ret = 1; goto cleanup; }
+    if (vs_store_get(store, "1/0/0", &data, &size) || size != 0) { ret = 1; goto cleanup; }
+    free(data); data = NULL;
+
+    if (vs_store_exists(store, "0/0/0") != 0 || vs_store_exists(store, "2/0/0") != 1) { ret = 1; goto cleanup; }
+
+    // keys come back sorted, whether the prefix ends at a directory or not
+    if (vs_store_list(store, "0/", &keys, &nkeys) || nkeys != 2) { ret = 1; goto cleanup; }
+    if (strcmp(keys[0], "0/0/0") != 0 || strcmp(keys[1], "0/0/1") != 0) { ret = 1; goto cleanup; }
+    for (int k = 0; k < nkeys; k++) free(keys[k]);
+    free(keys); keys = NULL;
+    if (vs_store_list(store, "", &keys, &nkeys) || nkeys != 4 || strcmp(keys[0], ".zarray") != 0) { ret = 1; goto cleanup; }
+    for (int k = 0; k < nkeys; k++) free(keys[k]);
+    free(keys); keys = NULL;
+
+    // a put replaces the object
+    if (vs_store_put(store, "0/0/0", "defg", 4)) { ret = 1; goto cleanup; }
+    if (vs_store_get(store, "0/0/0", &data, &size) || size != 4 || memcmp(data, "defg", 4)) { ret = 1; goto cleanup; }
+    free(data); data = NULL;
+  }
+
+  cleanup:
+  free(data);
+  if (keys) {
+    for (int k = 0; k < nkeys; k++) free(keys[k]);
+    free(keys);
+  }
+  vs_store_free(stores[0]);
+  vs_store_free(stores[1]);
+  remove_tree(root);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int testvolstore() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  volume* vol = NULL;
+  tchunk* block = NULL;
+  tchunk* region = NULL;
+  void* compressed = NULL;
+  vs_store* store = vs_store_mem_new();
+  vs_store* cache_store = vs_store_mem_new();
+  if (store == NULL || cache_store == NULL) { vs_store_free(store); vs_store_free(cache_store); return 1; }
+
+  // a 32 x 32 x 64 zarr of two 32^3 blocks held in memory, the second one doesn't exist
+  const char* zarray = "{\"shape\": [32, 32, 64], \"chunks\": [32, 32, 32], \"dtype\": \"|u1\", \"fill_value\": 5, \"order\": \"C\", "
+                       "\"zarr_format\": 2, \"compressor\": {\"id\": \"blosc\", \"cname\": \"zstd\", \"clevel\": 3, \"shuffle\": 1}}";
+  if (vs_store_put(store, ".zarray", zarray, strlen(zarray))) { vs_store_free(store); vs_store_free(cache_store); return 1; }
+  zarr_metadata metadata = {.chunks = {32, 32, 32}, .dtype = "|u1", .compressor = {.cname = "zstd", .clevel = 3, .shuffle = 1}};
+  if ((block = vs_tchunk_new(metadata.chunks, VS_U8)) == NULL) { vs_store_free(store); vs_store_free(cache_store); return 1; }
+  for (int i = 0; i < 32 * 32 * 32; i++) ((u8*)block->data)[i] = (u8)(i % 251);
+  int len = vs_zarr_compress_tchunk(block, metadata, &compressed);
+  if (len <= 0 || vs_store_put(store, "0/0/0", compressed, len)) { vs_store_free(store); vs_store_free(cache_store); ret = 1; goto cleanup; }
+
+  if ((vol = vs_vol_new_store(store, cache_store)) == NULL) { ret = 1; goto cleanup; }
+  if ((region = vs_vol_get_tchunk(vol, (s32[3]){0, 0, 16}, (s32[3]){32, 32, 32})) == NULL) { ret = 1; goto cleanup; }
+  for (int z = 0; z < 32; z++) {
+    for (int y = 0; y < 32; y++) {
+      for (int x = 0; x < 32; x++) {
+        f32 expected = x < 16 ? ((u8*)block->data)[(z * 32 + y) * 32 + x + 16] : 5;
+        if (vs_tchunk_get(region, z, y, x) != expected) { ret = 1; goto cleanup; }
+      }
+    }
+  }
+
+  // the block is kept in the cache store as it was stored, the missing one is recorded there
+  if (vs_store_exists(cache_store, "0/0/0") != 0 || vs_store_exists(cache_store, "0/0/1.missing") != 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  vs_tchunk_free(region);
+  vs_tchunk_free(block);
+  free(compressed);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+// puts a 32 x 32 x 64 uint8 zarr v3 in store, sharded into two 32^3 shards of eight 16^3 inner chunks
+//   - inner chunk i of the first shard holds (i * 16 + z + y + x) & 255, except inner chunk 5, which is empty
+//   - the second shard doesn't exist, so its blocks read as the fill value 7
+static int shardedstore_fill(vs_store* store, const char* index_location) {
+  char zarr_json[1024];
+  snprintf(zarr_json, sizeof(zarr_json),
+    "{\"zarr_format\": 3, \"node_type\": \"array\", \"shape\": [32, 32, 64], \"data_type\": \"uint8\","
+    " \"chunk_grid\": {\"name\": \"regular\", \"configuration\": {\"chunk_shape\": [32, 32, 32]}},"
+    " \"chunk_key_encoding\": {\"name\": \"default\", \"configuration\": {\"separator\": \"/\"}},"
+    " \"fill_value\": 7,"
+    " \"codecs\": [{\"name\": \"sharding_indexed\", \"configuration\": {"
+    "   \"chunk_shape\": [16, 16, 16],"
+    "   \"codecs\": [{\"name\": \"bytes\"}, {\"name\": \"blosc\", \"configuration\": {\"cname\": \"zstd\", \"clevel\": 3, \"shuffle\": \"shuffle\"}}],"
+    "   \"index_codecs\": [{\"name\": \"bytes\", \"configuration\": {\"endian\": \"little\"}}, {\"name\": \"crc32c\"}],"
+    "   \"index_location\": \"%s\"}}]}", index_location);
+  zarr_metadata metadata = {.chunks = {16, 16, 16}, .dtype = "|u1", .compressor = {.cname = "zstd", .clevel = 3, .shuffle = 1}};
+
+  // an offset and a length per inner chunk, then the crc32c of the index, which only has to be there
+  u8 index[8 * 16 + 4] = {0};
+  bool at_start = strcmp(index_location, "start") == 0;
+  u8* shard = malloc(sizeof(index) + 8 * (16 * 16 * 16 + BLOSC2_MAX_OVERHEAD));
+  tchunk* block = vs_tchunk_new(metadata.chunks, VS_U8);
+  int ret = shard == NULL || block == NULL;
+  s64 pos = at_start ? sizeof(index) : 0;
+  for (int i = 0; i < 8 && !ret; i++) {
+    u64 entry[2] = {UINT64_MAX, UINT64_MAX};
+    if (i != 5) {
+      for (int z = 0; z < 16; z++) {
+        for (int y = 0; y < 16; y++) {
+          for (int x = 0; x < 16; x++) {
+            vs_tchunk_set(block, z, y, x, (f32)((i * 16 + z + y + x) & 255));
+          }
+        }
+      }
+      void* compressed = NULL;
+      int len = vs_zarr_compress_tchunk(block, metadata, &compressed);
+      if (len <= 0) { ret = 1; break; }
+      memcpy(shard + pos, compressed, len);
+      free(compressed);
+      entry[0] = pos;
+      entry[1] = len;
+      pos += len;
+    }
+    for (int b = 0; b < 16; b++) {
+      index[i * 16 + b] = (u8)(entry[b / 8] >> (b % 8 * 8));
+    }
+  }
+  if (!ret) {
+    memcpy(at_start ? shard : shard + pos, index, sizeof(index));
+    s64 size = at_start ? pos : pos + sizeof(index);
+    ret = vs_store_put(store, "zarr.json", zarr_json, strlen(zarr_json)) || vs_store_put(store, "c/0/0/0", shard, size);
+  }
+  vs_tchunk_free(block);
+  free(shard);
+  return ret;
+}
+
+int testshardedstore() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  volume* vol = NULL;
+  tchunk* region = NULL;
+  const char* locations[2] = {"start", "end"};
+
+  // the index is read with a range at the start of the shard, or a suffix range at its end
+  for (int l = 0; l < 2; l++) {
+    vs_store* store = vs_store_mem_new();
+    vs_store* cache_store = vs_store_mem_new();
+    if (store == NULL || cache_store == NULL || shardedstore_fill(store, locations[l])) {
+      vs_store_free(store); vs_store_free(cache_store); ret = 1; goto cleanup;
+    }
+    if ((vol = vs_vol_new_store(store, cache_store)) == NULL) { ret = 1; goto cleanup; }
+    if (vol->metadata.shard_index_at_start != (l == 0) || !vol->metadata.shard_index_crc) { ret = 1; goto cleanup; }
+
+    if ((region = vs_vol_get_tchunk(vol, (s32[3]){0, 0, 0}, (s32[3]){32, 32, 64})) == NULL) { ret = 1; goto cleanup; }
+    for (int z = 0; z < 32; z++) {
+      for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 64; x++) {
+          int i = ((z / 16) * 2 + y / 16) * 2 + x / 16;
+          f32 expected = x >= 32 || i == 5 ? 7 : (f32)((i * 16 + z % 16 + y % 16 + x % 16) & 255);
+          if (vs_tchunk_get(region, z, y, x) != expected) { ret = 1; goto cleanup; }
+        }
+      }
+    }
+
+    // inner chunks are kept in the cache store on their own, the empty one and those of the missing shard as missing
+    if (vs_store_exists(cache_store, "0/0/0") != 0 || vs_store_exists(cache_store, "1/1/0") != 0 ||
+        vs_store_exists(cache_store, "1/0/1.missing") != 0 || vs_store_exists(cache_store, "0/0/2.missing") != 0) {
+      ret = 1; goto cleanup;
+    }
+    vs_tchunk_free(region);
+    region = NULL;
+    vs_vol_free(vol);
+    vol = NULL;
+  }
+
+  cleanup:
+  vs_tchunk_free(region);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
+int teststats() {
+  printf("%s\n", __FUNCTION__);
+  int ret = 0;
+  volume* vol = NULL;
+  tchunk* block = NULL;
+  tchunk* region = NULL;
+  void* compressed = NULL;
+  void* zarray_buf = NULL;
+  vs_store* http = NULL;
+  vs_stats stats;
+  vs_store* store = vs_store_mem_new();
+  vs_store* cache_store = vs_store_mem_new();
+  if (store == NULL || cache_store == NULL) { vs_store_free(store); vs_store_free(cache_store); return 1; }
+
+  // two 32^3 blocks in memory, the second one doesn't exist
+  const char* zarray = "{\"shape\": [32, 32, 64], \"chunks\": [32, 32, 32], \"dtype\": \"|u1\", \"fill_value\": 0, \"order\": \"C\", "
+                       "\"zarr_format\": 2, \"compressor\": {\"id\": \"blosc\", \"cname\": \"zstd\", \"clevel\": 3, \"shuffle\": 1}}";
+  zarr_metadata metadata = {.chunks = {32, 32, 32}, .dtype = "|u1", .compressor = {.cname = "zstd", .clevel = 3, .shuffle = 1}};
+  if ((block = vs_tchunk_new(metadata.chunks, VS_U8)) == NULL) { vs_store_free(store); vs_store_free(cache_store); return 1; }
+  int len = vs_zarr_compress_tchunk(block, metadata, &compressed);
+  if (len <= 0 || vs_store_put(store, ".zarray", zarray, strlen(zarray)) || vs_store_put(store, "0/0/0", compressed, len)) {
+    vs_store_free(store); vs_store_free(cache_store); ret = 1; goto cleanup;
+  }
+  if ((vol = vs_vol_new_store(store, cache_store)) == NULL) { ret = 1; goto cleanup; }
+  vs_vol_set_readahead(vol, 0);
+
+  vs_stats_reset();
+  vs_stats_snapshot(&stats);
+  if (stats.mem_cache_hits != 0 || stats.mem_cache_misses != 0 || stats.decode.count != 0) { ret = 1; goto cleanup; }
+
+  // the first read misses the memory cache and decodes the block, the second one finds it
+  s32 start[3] = {0, 0, 0}, dims[3] = {16, 16, 16};
+  if ((region = vs_vol_get_tchunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  vs_tchunk_free(region);
+  if ((region = vs_vol_get_tchunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  vs_stats_snapshot(&stats);
+  if (stats.mem_cache_misses != 1 || stats.mem_cache_hits != 1) { ret = 1; goto cleanup; }
+  if (stats.decode.count != 1 || stats.graft.count != 2 || stats.decode.buckets[VS_STATS_BUCKETS - 1] > 1) { ret = 1; goto cleanup; }
+  if (vs_latency_percentile(&stats.graft, 0.5) > stats.graft.max_ns) { ret = 1; goto cleanup; }
+
+  // dropping the memory cache evicts the block, the next read finds it in the cache store
+  vs_vol_set_cache_size(vol, 0);
+  vs_tchunk_free(region);
+  if ((region = vs_vol_get_tchunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  vs_stats_snapshot(&stats);
+  if (stats.evictions < 1 || stats.disk_cache_hits != 1) { ret = 1; goto cleanup; }
+
+  // a prefetched block is only counted by the read that finds it, as a hit
+  vs_vol_set_cache_size(vol, 1 << 24);
+  vs_stats_reset();
+  if (vs_vol_prefetch(vol, start, dims)) { ret = 1; goto cleanup; }
+  vs_vol_prefetch_wait(vol);
+  vs_tchunk_free(region);
+  if ((region = vs_vol_get_tchunk(vol, start, dims)) == NULL) { ret = 1; goto cleanup; }
+  vs_stats_snapshot(&stats);
+  if (stats.mem_cache_hits != 1 || stats.mem_cache_misses != 0) { ret = 1; goto cleanup; }
+
+  // the fill value of a missing block is grafted too, even when it is 0 and there is nothing to write
+  vs_stats_reset();
+  vs_tchunk_free(region);
+  if ((region = vs_vol_get_tchunk(vol, (s32[3]){0, 0, 40}, dims)) == NULL) { ret = 1; goto cleanup; }
+  vs_stats_snapshot(&stats);
+  if (stats.mem_cache_misses != 1 || stats.graft.count != 1) { ret = 1; goto cleanup; }
+
+  // transfers are counted against vesuvius_testserver when one is running, e.g. started with
+  // vesuvius_testserver --port 8080 and the tests run with VESUVIUS_TESTSERVER=http://localhost:8080
+  const char* server = getenv("VESUVIUS_TESTSERVER");
+  if (server != NULL) {
+    s64 size = 0;
+    vs_stats_reset();
+    if ((http = vs_store_http_new(server)) == NULL) { ret = 1; goto cleanup; }
+    if (vs_store_get(http, ".zarray", &zarray_buf, &size) || size <= 0) { ret = 1; goto cleanup; }
+    vs_stats_snapshot(&stats);
+    if (stats.http_requests != 1 || stats.http_bytes != (u64)size || stats.http.count != 1) { ret = 1; goto cleanup; }
+  }
+
+  vs_stats_reset();
+  vs_stats_snapshot(&stats);
+  if (stats.http_requests != 0 || stats.graft.count != 0 || stats.graft.max_ns != 0) { ret = 1; goto cleanup; }
+
+  cleanup:
+  vs_tchunk_free(region);
+  vs_tchunk_free(block);
+  free(compressed);
+  free(zarray_buf);
+  vs_store_free(http);
+  vs_vol_free(vol);
+  printf("%s done \n",__FUNCTION__);
+  return ret;
+}
+
 int main(int argc, char** argv) {
   if (testcurl())      printf("testcurl failed\n");
   if (testzarr())      printf("testzarr failed\n");
@@ -318,7 +1684,33 @@ int main(int argc, char** argv) {
   if (testvcps())      printf("testvcps failed\n");
   if (testchamfer())   printf("testchamfer failed\n");
   if (testvol())       printf("testvol failed\n");
+  if (testcache())     printf("testcache failed\n");
+  if (testcachethreads()) printf("testcachethreads failed\n");
+  if (testsingleflight()) printf("testsingleflight failed\n");
+  if (testparalleldownload()) printf("testparalleldownload failed\n");
+  if (testconnectionreuse()) printf("testconnectionreuse failed\n");
+  if (testprefetch())  printf("testprefetch failed\n");
+  if (testreadahead()) printf("testreadahead failed\n");
+  if (testdiskcache()) printf("testdiskcache failed\n");
+  if (testvolblockcache()) printf("testvolblockcache failed\n");
+  if (testtchunk())    printf("testtchunk failed\n");
+  if (testzarr16())    printf("testzarr16 failed\n");
+  if (testconvert())   printf("testconvert failed\n");
+  if (testzarrv3())    printf("testzarrv3 failed\n");
+  if (testunaligned()) printf("testunaligned failed\n");
+  if (testgraft())     printf("testgraft failed\n");
+  if (testmissingblock()) printf("testmissingblock failed\n");
+  if (testmultiscales()) printf("testmultiscales failed\n");
+  if (testpyramid())   printf("testpyramid failed\n");
+  if (testzerocopy())  printf("testzerocopy failed\n");
+  if (testdecompressthreads()) printf("testdecompressthreads failed\n");
+  if (testpool())      printf("testpool failed\n");
+  if (teststore())     printf("teststore failed\n");
+  if (testvolstore())  printf("testvolstore failed\n");
+  if (testshardedstore()) printf("testshardedstore failed\n");
+  if (teststats())     printf("teststats failed\n");
 
+  shutdown_readahead();
 
   return 0;
 }
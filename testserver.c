@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#define VESUVIUS_IMPL
+#include "vesuvius-c.h"
+#include <stdio.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// A stand-in for the data server, for measuring the fetch path without the network
+//     - serves a synthetic uint8 zarr v2 array over HTTP/1.1 with keep-alive, HEAD and single byte ranges
+//     - the array is at the root: /.zarray, /0/0/0, ... any leading path is ignored, so
+//       http://localhost:8080/scroll/0/ serves the same array as http://localhost:8080/
+//     - every request waits --latency-ms before the reply, and all replies share --bandwidth-mbps
+//     - --missing-rate leaves that fraction of the blocks out, so they are 404s like the fill-value blocks of a real zarr.
+//       which blocks are missing only depends on their index, so they stay missing across requests and restarts
+//
+// usage: vesuvius_testserver [--port 8080] [--shape 512] [--chunk 64] [--latency-ms 0] [--bandwidth-mbps 0] [--missing-rate 0]
+
+#define SEND_PIECE (64 * 1024)
+
+typedef struct {
+    int port;
+    s32 shape;
+    s32 chunk;
+    int latency_ms;
+    double bandwidth;  // bytes per second shared by all connections, 0 for no limit
+    double missing_rate;
+} server_options;
+
+typedef struct {
+    char zarray[512];
+    s32 nblocks;       // blocks along each axis
+    u8 **blocks;       // compressed blocks in z, y, x order, NULL for missing ones
+    long *sizes;
+} synthetic_zarr;
+
+static server_options options = {8080, 512, 64, 0, 0, 0};
+static synthetic_zarr zarr;
+static pthread_mutex_t throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+static double throttle_next;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_seconds(double seconds) {
+    if (seconds <= 0) {
+        return;
+    }
+    struct timespec ts = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+static u32 hash3(s32 z, s32 y, s32 x) {
+    u32 h = 0x9e3779b9u ^ (u32)z * 73856093u ^ (u32)y * 19349663u ^ (u32)x * 83492791u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ h >> 15;
+}
+
+// concentric sheets around the z axis with some noise, roughly as compressible as a scroll
+static u8 synthetic_voxel(s32 z, s32 y, s32 x) {
+    f32 dy = y - options.shape / 2.0f, dx = x - options.shape / 2.0f;
+    s32 r = (s32)sqrtf(dy * dy + dx * dx);
+    u8 base = r % 12 < 4 ? 160 : 40;
+    return base + (hash3(z, y, x) & 31);
+}
+
+static int build_zarr(void) {
+    s32 n = (options.shape + options.chunk - 1) / options.chunk;
+    zarr.nblocks = n;
+    zarr.blocks = calloc((size_t)n * n * n, sizeof(u8 *));
+    zarr.sizes = calloc((size_t)n * n * n, sizeof(long));
+    if (zarr.blocks == NULL || zarr.sizes == NULL) {
+        return 1;
+    }
+    snprintf(zarr.zarray, sizeof(zarr.zarray),
+             "{\"shape\": [%d, %d, %d], \"chunks\": [%d, %d, %d], \"dtype\": \"|u1\", \"fill_value\": 0, \"order\": \"C\", "
+             "\"zarr_format\": 2, \"filters\": null, \"dimension_separator\": \"/\", "
+             "\"compressor\": {\"id\": \"blosc\", \"cname\": \"zstd\", \"clevel\": 3, \"shuffle\": 1, \"blocksize\": 0}}",
+             options.shape, options.shape, options.shape, options.chunk, options.chunk, options.chunk);
+
+    zarr_metadata metadata = {.chunks = {options.chunk, options.chunk, options.chunk}, .dtype = "|u1",
+                              .compressor = {.id = "blosc", .cname = "zstd", .clevel = 3, .shuffle = 1}};
+    tchunk *block = vs_tchunk_new(metadata.chunks, VS_U8);
+    if (block == NULL) {
+        return 1;
+    }
+    int missing = 0;
+    for (s32 i = 0; i < n * n * n; i++) {
+        s32 bz = i / (n * n), by = i / n % n, bx = i % n;
+        if (hash3(bz, by, bx) % 1000000 < options.missing_rate * 1000000) {
+            missing++;
+            continue;
+        }
+        u8 *data = block->data;
+        for (s32 z = 0; z < options.chunk; z++) {
+            for (s32 y = 0; y < options.chunk; y++) {
+                for (s32 x = 0; x < options.chunk; x++) {
+                    *data++ = synthetic_voxel(bz * options.chunk + z, by * options.chunk + y, bx * options.chunk + x);
+                }
+            }
+        }
+        void *compressed = NULL;
+        int len = vs_zarr_compress_tchunk(block, metadata, &compressed);
+        if (len <= 0) {
+            vs_tchunk_free(block);
+            return 1;
+        }
+        zarr.blocks[i] = compressed;
+        zarr.sizes[i] = len;
+    }
+    vs_tchunk_free(block);
+    printf("serving a %d^3 zarr of %d^3 blocks at http://localhost:%d/, %d of %d blocks missing\n",
+           options.shape, options.chunk, options.port, missing, n * n * n);
+    return 0;
+}
+
+static int send_all(int fd, const char *data, size_t size, bool throttled) {
+    while (size > 0) {
+        size_t piece = MIN(size, (size_t)SEND_PIECE);
+        if (throttled && options.bandwidth > 0) {
+            // every piece books the next slot on the shared link
+            pthread_mutex_lock(&throttle_lock);
+            double start = MAX(now_seconds(), throttle_next);
+            throttle_next = start + piece / options.bandwidth;
+            double done = throttle_next;
+            pthread_mutex_unlock(&throttle_lock);
+            sleep_seconds(done - now_seconds());
+        }
+        ssize_t sent = send(fd, data, piece, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return 1;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+// the object at key, NULL if there is none
+static const char *find_object(const char *key, long *size) {
+    if (strcmp(key, ".zarray") == 0) {
+        *size = strlen(zarr.zarray);
+        return zarr.zarray;
+    }
+    s32 z, y, x;
+    char tail;
+    if (sscanf(key, "%d/%d/%d%c", &z, &y, &x, &tail) != 3 ||
+        z < 0 || y < 0 || x < 0 || z >= zarr.nblocks || y >= zarr.nblocks || x >= zarr.nblocks) {
+        return NULL;
+    }
+    s32 i = (z * zarr.nblocks + y) * zarr.nblocks + x;
+    *size = zarr.sizes[i];
+    return (const char *)zarr.blocks[i];
+}
+
+// the key is what follows the last path segments that look like a zarr key
+static const char *object_key(const char *path) {
+    const char *zarray = strstr(path, ".zarray");
+    if (zarray) {
+        return zarray;
+    }
+    // the last three segments
+    const char *key = path + strlen(path);
+    for (int slashes = 0; key > path; key--) {
+        if (key[-1] == '/' && ++slashes == 3) {
+            break;
+        }
+    }
+    return key;
+}
+
+static void *serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char request[8192] = {0};
+    size_t have = 0;
+
+    for (;;) {
+        char *end = NULL;
+        while ((end = strstr(request, "\r\n\r\n")) == NULL) {
+            if (have == sizeof(request) - 1) {
+                goto done;
+            }
+            ssize_t got = recv(fd, request + have, sizeof(request) - 1 - have, 0);
+            if (got <= 0) {
+                goto done;
+            }
+            have += got;
+            request[have] = '\0';
+        }
+
+        // the next request may already be behind this one
+        size_t used = end + 4 - request;
+        end[2] = '\0';
+
+        char method[16] = {0}, path[2048] = {0};
+        if (sscanf(request, "%15s %2047s", method, path) != 2) {
+            goto done;
+        }
+        char *query = strchr(path, '?');
+        if (query) *query = '\0';
+        bool head = strcmp(method, "HEAD") == 0;
+        bool close_after = strcasestr(request, "\r\nConnection: close") != NULL;
+        s64 range_start = -1, range_end = -1, suffix = -1;
+        const char *range = strcasestr(request, "\r\nRange: bytes=");
+        if (range) {
+            range += strlen("\r\nRange: bytes=");
+            if (*range == '-') {
+                suffix = atoll(range + 1);
+            } else {
+                range_start = atoll(range);
+                const char *dash = strchr(range, '-');
+                range_end = dash && dash[1] >= '0' && dash[1] <= '9' ? atoll(dash + 1) : -1;
+            }
+        }
+
+        memmove(request, request + used, have - used + 1);
+        have -= used;
+
+        sleep_seconds(options.latency_ms / 1000.0);
+
+        long size = 0;
+        const char *object = find_object(object_key(path), &size);
+        char header[512];
+        if (object == NULL) {
+            int len = snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            if (send_all(fd, header, len, false)) goto done;
+            if (close_after) goto done;
+            continue;
+        }
+
+        s64 start = 0, count = size;
+        if (suffix >= 0) {
+            count = MIN(suffix, size);
+            start = size - count;
+        } else if (range_start >= 0) {
+            start = range_start;
+            count = (range_end < 0 || range_end >= size ? size - 1 : range_end) - start + 1;
+        }
+        if (start < 0 || start > size || count < 0 || (range && count == 0)) {
+            int len = snprintf(header, sizeof(header), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%ld\r\nContent-Length: 0\r\n\r\n", size);
+            if (send_all(fd, header, len, false)) goto done;
+            continue;
+        }
+
+        int len = range ? snprintf(header, sizeof(header),
+                                   "HTTP/1.1 206 Partial Content\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%lld/%ld\r\n\r\n",
+                                   (long long)count, (long long)start, (long long)(start + count - 1), size)
+                        : snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n\r\n", (long long)count);
+        if (send_all(fd, header, len, false)) goto done;
+        if (!head && send_all(fd, object + start, count, true)) goto done;
+        if (close_after) goto done;
+    }
+
+    done:
+    close(fd);
+    return NULL;
+}
+
+static int parse_options(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL) {
+            return 1;
+        }
+        if (strcmp(argv[i], "--port") == 0) options.port = atoi(value);
+        else if (strcmp(argv[i], "--shape") == 0) options.shape = atoi(value);
+        else if (strcmp(argv[i], "--chunk") == 0) options.chunk = atoi(value);
+        else if (strcmp(argv[i], "--latency-ms") == 0) options.latency_ms = atoi(value);
+        else if (strcmp(argv[i], "--bandwidth-mbps") == 0) options.bandwidth = atof(value) * 1e6 / 8;
+        else if (strcmp(argv[i], "--missing-rate") == 0) options.missing_rate = atof(value);
+        else return 1;
+        i++;
+    }
+    return options.port <= 0 || options.shape <= 0 || options.chunk <= 0 || options.latency_ms < 0 ||
+           options.bandwidth < 0 || options.missing_rate < 0 || options.missing_rate > 1;
+}
+
+int main(int argc, char **argv) {
+    if (parse_options(argc, argv)) {
+        fprintf(stderr, "usage: %s [--port 8080] [--shape 512] [--chunk 64] [--latency-ms 0] [--bandwidth-mbps 0] [--missing-rate 0]\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (build_zarr()) {
+        fprintf(stderr, "failed to build the synthetic zarr\n");
+        return 1;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(options.port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(listener, 128)) {
+        perror("could not listen");
+        return 1;
+    }
+    fflush(stdout);
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)fd)) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
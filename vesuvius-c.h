@@ -24,6 +24,7 @@
 #include <ctype.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,13 +35,31 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <float.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 // Buffer size for metadata JSON and URL
 #define BUFFER_SIZE 4096
 #define URL_SIZE 256
 
-#define CACHE_CAPACITY 100  // Define the LRU cache capacity
+#define CACHE_DEFAULT_MAX_BYTES (1024UL * 1024 * 1024)  // Default byte budget of the in-memory LRU cache (1 GiB)
+#define CACHE_INITIAL_BUCKETS 16  // Initial hash bucket count per shard, grown as the shard fills
+#define CACHE_SHARDS 16  // Number of independently locked cache shards
+
+// Results of claim_cache
+#define CACHE_HIT 0      // The chunk was cached, the node is returned pinned
+#define CACHE_CLAIMED 1  // The caller must load the chunk and pass it to complete_cache
+#define CACHE_PENDING 2  // Another thread is loading the chunk, only returned when not waiting
+#define CACHE_FAILED 3   // Another thread tried to load the chunk and failed
 #define CACHE_DIR ".vesuvius-cache"
+#define DEFAULT_MAX_PARALLEL_DOWNLOADS 16  // Default number of blocks downloaded at once by ROI reads
+#define MAX_IDLE_CURL_HANDLES 64  // Easy handles kept for reuse once their transfer is done
+#define MAX_IDLE_MULTI_HANDLES 8  // Multi handles kept for reuse once their parallel downloads are done
+#define DEFAULT_READAHEAD_DEPTH 1  // Default number of chunk layers fetched ahead of a sweep
+#define DEFAULT_DECOMPRESS_THREADS 1  // Default number of threads blosc uses to decompress one block
+#define SWEEP_MIN_STEPS 2  // Consecutive reads moving the same way before they count as a sweep
+#define VS_STATS_BUCKETS 32  // Latency histogram buckets, powers of two of nanoseconds up to about 2 s
 
 // Struct for scroll volume regions
 typedef struct {
@@ -55,6 +74,7 @@ typedef struct {
 typedef struct {
     unsigned char *data;
     size_t size;
+    struct LRUNode *node;  // Cache entry pinned by fetch_zarr_chunk, NULL if data is owned by the caller
 } MemoryChunk;
 
 typedef struct LRUNode {
@@ -62,17 +82,98 @@ typedef struct LRUNode {
     int chunk_y;
     int chunk_z;
     MemoryChunk chunk;
+    int refcount;               // One reference held by the cache while linked, plus one per pin
+    uint64_t last_used;         // Tick of the last link or lookup, orders nodes of different shards
     struct LRUNode *prev;
     struct LRUNode *next;
+    struct LRUNode *hash_next;  // Next node in the same hash bucket
 } LRUNode;
 
+// A chunk that one thread is loading while others wait for it, see claim_cache
+typedef struct PendingFetch {
+    int chunk_x;
+    int chunk_y;
+    int chunk_z;
+    int waiters;          // Threads blocked in claim_cache on this fetch
+    int done;
+    LRUNode *result;      // Loaded node, pinned once for every waiter. NULL if the load failed
+    int retry;            // The load was abandoned without caching the chunk, waiters claim it again
+    pthread_cond_t cond;
+    struct PendingFetch *next;
+} PendingFetch;
+
+// Every shard is an independent LRU list and chained hash table behind its own lock,
+// chunks are assigned to a shard by their hash_key(). The byte budget is the whole cache's
 typedef struct {
+    struct LRUCache *cache;  // Owner, its byte total includes this shard's
+    pthread_mutex_t lock;
+    PendingFetch *pending;  // Chunks currently being loaded, at most a handful per shard
     LRUNode *head;
     LRUNode *tail;
-    LRUNode *cache[CACHE_CAPACITY];
+    LRUNode **buckets;    // bucket_count is always a power of two
+    size_t bucket_count;
     int count;
+    size_t bytes;         // Total size of all chunks linked into this shard
+} LRUShard;
+
+// Thread safe chunk cache. Nodes returned by get_cache and put_cache are pinned, so their data
+// stays valid even if the node is evicted, until the caller hands it back with release_cache
+typedef struct LRUCache {
+    LRUShard shards[CACHE_SHARDS];
+    size_t max_bytes;             // Byte budget, least recently used chunks of any shard are evicted beyond it
+    size_t bytes;                 // Total size of all linked chunks, updated atomically under the shard locks
+    pthread_mutex_t evict_lock;   // One thread evicts at a time, taken without any shard lock held
 } LRUCache;
 
+// Curl state shared by every transfer the library makes. Easy handles are recycled rather than
+// cleaned up so their connections stay open, and all of them share one DNS cache and TLS session
+// cache through a CURLSH. Connections are not shared, curl doesn't support a shared connection
+// cache used from several threads, so each handle keeps its own. Transfers run by a multi handle
+// leave their connections with it, so multi handles are recycled the same way
+typedef struct {
+    CURLSH *share;
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+    pthread_mutex_t lock;
+    CURL *idle[MAX_IDLE_CURL_HANDLES];
+    int idle_count;
+    CURLM *idle_multi[MAX_IDLE_MULTI_HANDLES];
+    int idle_multi_count;
+} ConnectionPool;
+
+// Follows successive reads of a volume to detect sweeps, reads of the same footprint that step
+// monotonically along one axis, see track_sweep. All coordinates are in Z Y X order
+typedef struct {
+    int start[3];
+    int dims[3];
+    int axis;       // Axis the reads are moving along
+    int direction;  // +1 or -1
+    int steps;      // Consecutive reads that moved along axis in direction, 0 if there is no sweep
+    int fetched;    // Last chunk layer along axis already requested ahead of the sweep
+} SweepTracker;
+
+// Latency histogram of one stage, see vs_stats. Bucket i counts durations of [2^i, 2^(i+1)) nanoseconds,
+// bucket 0 also counts 0 and the last bucket everything longer
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[VS_STATS_BUCKETS];
+} vs_latency;
+
+// What the library has done since it started or since vs_stats_reset, for both the legacy and the vs_ API.
+// Read it with vs_stats_snapshot, any thread can record while it is read
+typedef struct {
+    uint64_t mem_cache_hits;    // Chunk reads served from an in-memory cache, including ones that waited for another thread's load
+    uint64_t mem_cache_misses;  // Chunk reads that had to load the chunk themselves, or found another thread's load failed
+    uint64_t disk_cache_hits;   // Chunks read from a disk cache rather than downloaded
+    uint64_t evictions;         // Chunks evicted from an in-memory cache to stay within its byte budget
+    uint64_t http_requests;     // Transfers made, successful or not
+    uint64_t http_bytes;        // Bytes of response bodies received
+    vs_latency http;            // Time of every transfer, from start to the last byte
+    vs_latency decode;          // Time blosc took to decompress each block
+    vs_latency graft;           // Time to copy each block's part of a region into it
+} vs_stats;
+
 typedef struct {
     float x, y, z;
 } Vertex;
@@ -95,17 +196,50 @@ static int parse_metadata(const char *buffer);
 int load_shape_and_chunksize(void);
 
 void init_vesuvius(const char *scroll_id, int energy, double resolution);
+void init_vesuvius_level(const char *scroll_id, int energy, double resolution, int level);
 
 LRUCache *init_cache();
+void free_cache(LRUCache *cache);
+void set_cache_max_bytes(LRUCache *cache, size_t max_bytes);
+void set_vesuvius_cache_size(size_t max_bytes);
+size_t cache_bytes(LRUCache *cache);
+int cache_count(LRUCache *cache);
 LRUNode *get_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z);
-void put_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, MemoryChunk chunk);
-void move_to_head(LRUCache *cache, LRUNode *node);
-void evict_from_cache(LRUCache *cache);
-int hash_key(int chunk_x, int chunk_y, int chunk_z);
+LRUNode *put_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, MemoryChunk chunk);
+void release_cache(LRUCache *cache, LRUNode *node);
+int claim_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, int wait, LRUNode **node);
+LRUNode *complete_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk);
+void abandon_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z);
+void move_to_head(LRUShard *shard, LRUNode *node);
+void evict_from_cache(LRUShard *shard);
+unsigned int hash_key(int chunk_x, int chunk_y, int chunk_z);
 
 size_t write_data(void *ptr, size_t size, size_t nmemb, MemoryChunk *chunk);
 
+CURL *acquire_curl_handle(const char *url);
+void release_curl_handle(CURL *curl);
+void close_idle_connections(void);
+
+// Called by download_parallel as each transfer finishes. The callback owns body->data, which is NULL if
+// the transfer failed. http_code is 0 if no response was received
+typedef void (*download_callback)(int index, MemoryChunk *body, long http_code, void *userdata);
+int download_parallel(char **urls, int count, int max_parallel, download_callback on_done, void *userdata);
+int download_parallel_ranges(char **urls, const int64_t *ranges, int count, int max_parallel, download_callback on_done, void *userdata);
+void set_max_parallel_downloads(int max_parallel);
+
 int fetch_zarr_chunk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk);
+void release_zarr_chunk(MemoryChunk *chunk);
+
+int track_sweep(SweepTracker *tracker, const int start[3], const int dims[3], const int chunk_dims[3], int depth,
+                int ahead_start[3], int ahead_dims[3]);
+void set_readahead_depth(int depth);
+void shutdown_readahead(void);
+void set_decompress_threads(int nthreads);
+int decompress_blosc(const void *src, int32_t srcsize, void *dest, int32_t destsize);
+
+void vs_stats_snapshot(vs_stats *out);
+void vs_stats_reset(void);
+double vs_latency_percentile(const vs_latency *latency, double fraction);
 
 int get_volume_voxel(int x, int y, int z, unsigned char *value);
 int get_volume_roi(RegionOfInterest region, unsigned char *volume);
@@ -115,6 +249,7 @@ int write_bmp(const char *filename, unsigned char *image, int width, int height)
 int create_directories(const char *path);
 int write_chunk_to_disk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk);
 int read_chunk_from_disk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk);
+int write_metadata_to_disk(const char *zarray);
 char *get_cache_path(int chunk_x, int chunk_y, int chunk_z);
 
 char *get_obj_cache_path(const char *id);
@@ -131,13 +266,251 @@ void reset_mesh_origin_to_roi(TriangleMesh *mesh, const RegionOfInterest *roi);
 // Global cache
 LRUCache *cache;
 
+// Byte budget applied to the global cache when it is created by init_vesuvius
+size_t CACHE_MAX_BYTES = CACHE_DEFAULT_MAX_BYTES;
+
+// Number of transfers get_volume_roi and vs_vol_get_chunk keep in flight at once
+int MAX_PARALLEL_DOWNLOADS = DEFAULT_MAX_PARALLEL_DOWNLOADS;
+
+// Number of chunk layers get_volume_slice fetches ahead of a sweep, 0 disables read-ahead
+int READAHEAD_DEPTH = DEFAULT_READAHEAD_DEPTH;
+
+// Number of threads blosc splits the decompression of one block over
+int DECOMPRESS_THREADS = DEFAULT_DECOMPRESS_THREADS;
+
 // Global variable to store the dynamically constructed Zarr URL
 char ZARR_URL[URL_SIZE] = {0};  // Initially empty
 
+// Library wide counters behind vs_stats_snapshot. Every field is updated with relaxed atomics, so
+// recording doesn't serialize the threads reading chunks
+static vs_stats STATS;
+
 // Variables to hold Zarr's chunk sizes and shape, initially set to -1 to indicate uninitialized
 int CHUNK_SIZE_X = -1, CHUNK_SIZE_Y = -1, CHUNK_SIZE_Z = -1;
 int SHAPE_X = -1, SHAPE_Y = -1, SHAPE_Z = -1;
 
+static uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// Count a chunk read by what claim_cache returned for it. Only reads are counted, not prefetches,
+// shard index lookups or the retries of an abandoned load, so hits and misses give the hit rate
+static void stats_chunk_read(int claim) {
+    stats_add(claim == CACHE_HIT ? &STATS.mem_cache_hits : &STATS.mem_cache_misses, 1);
+}
+
+// Add one duration, in nanoseconds, to a latency histogram
+static void stats_record(vs_latency *latency, uint64_t ns) {
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    stats_add(&latency->buckets[bucket < VS_STATS_BUCKETS ? bucket : VS_STATS_BUCKETS - 1], 1);
+    stats_add(&latency->count, 1);
+    stats_add(&latency->total_ns, ns);
+    uint64_t max = __atomic_load_n(&latency->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&latency->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Copy the statistics. Fields are read one at a time, so a snapshot taken while other threads record
+// can be off by the operations in flight, e.g. a histogram whose count is one ahead of its buckets
+void vs_stats_snapshot(vs_stats *out) {
+    const uint64_t *src = (const uint64_t *)&STATS;
+    uint64_t *dest = (uint64_t *)out;
+    for (size_t i = 0; i < sizeof(vs_stats) / sizeof(uint64_t); i++) {
+        dest[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+// Set every counter and histogram back to 0
+void vs_stats_reset(void) {
+    uint64_t *dest = (uint64_t *)&STATS;
+    for (size_t i = 0; i < sizeof(vs_stats) / sizeof(uint64_t); i++) {
+        __atomic_store_n(&dest[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+// Estimate the duration, in nanoseconds, below which the given fraction of the recorded durations fall,
+// e.g. 0.99 for the 99th percentile. Returns the upper end of the bucket it lands in, never more than
+// max_ns, and 0 for an empty histogram
+double vs_latency_percentile(const vs_latency *latency, double fraction) {
+    if (latency->count == 0) {
+        return 0;
+    }
+    double rank = fraction * latency->count;
+    uint64_t seen = 0;
+    for (int i = 0; i < VS_STATS_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if (seen > 0 && seen >= rank) {
+            double upper = i == VS_STATS_BUCKETS - 1 ? (double)latency->max_ns : (double)(2ULL << i);
+            return upper < latency->max_ns ? upper : (double)latency->max_ns;
+        }
+    }
+    return (double)latency->max_ns;
+}
+
+// Reusable curl handles and the caches they share, set up by curl_global_init_once
+ConnectionPool connection_pool;
+
+static void lock_connection_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    (void)userptr;
+    pthread_mutex_lock(&connection_pool.share_locks[data]);
+}
+
+static void unlock_connection_share(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    (void)userptr;
+    pthread_mutex_unlock(&connection_pool.share_locks[data]);
+}
+
+// curl_global_init is not thread safe, so it runs exactly once before the first handle is created
+static pthread_once_t curl_init_once = PTHREAD_ONCE_INIT;
+
+static void curl_global_init_once(void) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    pthread_mutex_init(&connection_pool.lock, NULL);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&connection_pool.share_locks[i], NULL);
+    }
+    connection_pool.idle_count = 0;
+    connection_pool.idle_multi_count = 0;
+    connection_pool.share = curl_share_init();
+    if (connection_pool.share == NULL) {
+        fprintf(stderr, "Failed to initialize curl share, connections will not be shared\n");
+        return;
+    }
+    curl_share_setopt(connection_pool.share, CURLSHOPT_LOCKFUNC, lock_connection_share);
+    curl_share_setopt(connection_pool.share, CURLSHOPT_UNLOCKFUNC, unlock_connection_share);
+    curl_share_setopt(connection_pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(connection_pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+// Get an easy handle for a GET of url, reusing an idle one if there is any. The handle is attached
+// to the shared caches and asks for HTTP/2 over TLS, so transfers to the same host multiplex over
+// one connection when the server supports it. Hand it back with release_curl_handle when done
+CURL *acquire_curl_handle(const char *url) {
+    pthread_once(&curl_init_once, curl_global_init_once);
+
+    CURL *curl = NULL;
+    pthread_mutex_lock(&connection_pool.lock);
+    if (connection_pool.idle_count > 0) {
+        curl = connection_pool.idle[--connection_pool.idle_count];
+    }
+    pthread_mutex_unlock(&connection_pool.lock);
+
+    if (curl) {
+        curl_easy_reset(curl);  // Keeps the handle's live connections and caches
+    } else {
+        curl = curl_easy_init();
+        if (!curl) {
+            fprintf(stderr, "Failed to initialize curl\n");
+            return NULL;
+        }
+    }
+
+    if (connection_pool.share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, connection_pool.share);
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+    return curl;
+}
+
+// Return a handle from acquire_curl_handle to the pool. Handles come back here once their transfer is
+// done, so this is where transfers are counted in vs_stats
+void release_curl_handle(CURL *curl) {
+    if (curl == NULL) return;
+
+    curl_off_t total_us = 0, downloaded = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_us);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    stats_add(&STATS.http_requests, 1);
+    stats_add(&STATS.http_bytes, (uint64_t)downloaded);
+    stats_record(&STATS.http, (uint64_t)total_us * 1000);
+
+    pthread_mutex_lock(&connection_pool.lock);
+    if (connection_pool.idle_count < MAX_IDLE_CURL_HANDLES) {
+        connection_pool.idle[connection_pool.idle_count++] = curl;
+        curl = NULL;
+    }
+    pthread_mutex_unlock(&connection_pool.lock);
+
+    if (curl) {
+        curl_easy_cleanup(curl);
+    }
+}
+
+// Get a multi handle for a batch of parallel downloads, reusing an idle one so the connections its
+// earlier transfers opened are used again. Hand it back with release_multi_handle when done
+static CURLM *acquire_multi_handle(void) {
+    pthread_once(&curl_init_once, curl_global_init_once);
+
+    CURLM *multi = NULL;
+    pthread_mutex_lock(&connection_pool.lock);
+    if (connection_pool.idle_multi_count > 0) {
+        multi = connection_pool.idle_multi[--connection_pool.idle_multi_count];
+    }
+    pthread_mutex_unlock(&connection_pool.lock);
+
+    if (multi == NULL) {
+        multi = curl_multi_init();
+        if (multi) {
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        }
+    }
+    return multi;
+}
+
+// Return a multi handle from acquire_multi_handle to the pool. It must have no transfers left in it,
+// and one that failed is cleaned up rather than reused
+static void release_multi_handle(CURLM *multi, int failed) {
+    if (multi == NULL) return;
+
+    pthread_mutex_lock(&connection_pool.lock);
+    if (!failed && connection_pool.idle_multi_count < MAX_IDLE_MULTI_HANDLES) {
+        connection_pool.idle_multi[connection_pool.idle_multi_count++] = multi;
+        multi = NULL;
+    }
+    pthread_mutex_unlock(&connection_pool.lock);
+
+    if (multi) {
+        curl_multi_cleanup(multi);
+    }
+}
+
+// Clean up every idle easy and multi handle, closing their connections. Handles in use are unaffected
+void close_idle_connections(void) {
+    pthread_once(&curl_init_once, curl_global_init_once);
+
+    pthread_mutex_lock(&connection_pool.lock);
+    int count = connection_pool.idle_count;
+    CURL *idle[MAX_IDLE_CURL_HANDLES];
+    memcpy(idle, connection_pool.idle, count * sizeof(CURL *));
+    connection_pool.idle_count = 0;
+    int multi_count = connection_pool.idle_multi_count;
+    CURLM *idle_multi[MAX_IDLE_MULTI_HANDLES];
+    memcpy(idle_multi, connection_pool.idle_multi, multi_count * sizeof(CURLM *));
+    connection_pool.idle_multi_count = 0;
+    pthread_mutex_unlock(&connection_pool.lock);
+
+    for (int i = 0; i < count; i++) {
+        curl_easy_cleanup(idle[i]);
+    }
+    for (int i = 0; i < multi_count; i++) {
+        curl_multi_cleanup(idle_multi[i]);
+    }
+}
+
 // Internal function to write data fetched by cURL
 static size_t write_callback(void *ptr, size_t size, size_t nmemb, void *stream) {
     strncat((char *)stream, (char *)ptr, size * nmemb);
@@ -153,13 +526,12 @@ static int fetch_metadata(const char *url, char *buffer) {
     char metadata_url[URL_SIZE];
     snprintf(metadata_url, URL_SIZE, "%s.zarray", url);
 
-    curl = curl_easy_init();
+    curl = acquire_curl_handle(metadata_url);
     if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, metadata_url);
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, buffer);
         res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
+        release_curl_handle(curl);
 
         if (res != CURLE_OK) {
             fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
@@ -217,6 +589,8 @@ int load_shape_and_chunksize() {
         return -1;
     }
 
+    // Makes the disk cache a zarr store of its own, failing to write it is harmless
+    write_metadata_to_disk(buffer);
     return 0;
 }
 
@@ -233,12 +607,187 @@ size_t write_data(void *ptr, size_t size, size_t nmemb, MemoryChunk *chunk) {
     return realsize;
 }
 
-// Initialize the vesuvius library with dynamic URL construction
+// Set how many blocks ROI reads download at once
+void set_max_parallel_downloads(int max_parallel) {
+    MAX_PARALLEL_DOWNLOADS = max_parallel > 0 ? max_parallel : 1;
+}
+
+// Download a set of URLs over one curl multi handle with at most max_parallel transfers in flight.
+// on_done runs in the calling thread as soon as each transfer finishes, in completion order, so the
+// caller can process a block while the rest are still downloading. It is called exactly once for
+// every URL, also for those that could not be downloaded.
+// Returns 0 if every transfer ran to completion (whatever its HTTP status), -1 otherwise
+int download_parallel(char **urls, int count, int max_parallel, download_callback on_done, void *userdata) {
+    return download_parallel_ranges(urls, NULL, count, max_parallel, on_done, userdata);
+}
+
+// Format an HTTP byte range for CURLOPT_RANGE, see download_parallel_ranges
+static void format_range(char *out, size_t size, int64_t offset, int64_t length) {
+    if (offset < 0) {
+        snprintf(out, size, "-%lld", (long long)length);
+    } else {
+        snprintf(out, size, "%lld-%lld", (long long)offset, (long long)(offset + length - 1));
+    }
+}
+
+// Servers that don't support range requests answer them with the whole object, cut the range out of it.
+// A body too short to hold the range is dropped
+static void cut_range(MemoryChunk *body, int64_t offset, int64_t length) {
+    if (body->data == NULL || (int64_t)body->size == length) {
+        return;
+    }
+    int64_t start = offset < 0 ? (int64_t)body->size - length : offset;
+    if (start < 0 || start + length > (int64_t)body->size) {
+        free(body->data);
+        body->data = NULL;
+        body->size = 0;
+        return;
+    }
+    memmove(body->data, body->data + start, length);
+    body->size = length;
+}
+
+// Like download_parallel, but only downloads part of each object. ranges holds an offset and a length
+// for every URL, a negative offset asks for the last length bytes and a length <= 0 for the whole object.
+// ranges may be NULL to download every object whole
+int download_parallel_ranges(char **urls, const int64_t *ranges, int count, int max_parallel, download_callback on_done, void *userdata) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (max_parallel <= 0) {
+        max_parallel = 1;
+    }
+
+    CURLM *multi = acquire_multi_handle();
+    MemoryChunk *bodies = (MemoryChunk *)calloc(count, sizeof(MemoryChunk));
+    CURL **handles = (CURL **)calloc(count, sizeof(CURL *));
+    if (multi == NULL || bodies == NULL || handles == NULL) {
+        fprintf(stderr, "Failed to initialize curl multi handle\n");
+        release_multi_handle(multi, 0);
+        free(bodies);
+        free(handles);
+        for (int i = 0; i < count; i++) {
+            MemoryChunk empty = {0};
+            on_done(i, &empty, 0, userdata);
+        }
+        return -1;
+    }
+
+    int ret = 0;
+    int multi_failed = 0;
+    int next = 0;
+    int active = 0;
+    while (next < count || active > 0) {
+        // Top up the transfers in flight
+        while (active < max_parallel && next < count) {
+            CURL *curl = acquire_curl_handle(urls[next]);
+            if (curl == NULL) {
+                on_done(next, &bodies[next], 0, userdata);
+                next++;
+                ret = -1;
+                continue;
+            }
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&bodies[next]);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);  // Prefer multiplexing over opening more connections
+            curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)&bodies[next]);
+            if (ranges != NULL && ranges[next * 2 + 1] > 0) {
+                char range[64];
+                format_range(range, sizeof(range), ranges[next * 2], ranges[next * 2 + 1]);
+                curl_easy_setopt(curl, CURLOPT_RANGE, range);
+            }
+            curl_multi_add_handle(multi, curl);
+            handles[next] = curl;
+            active++;
+            next++;
+        }
+
+        int running = 0;
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            ret = -1;
+            multi_failed = 1;
+            break;
+        }
+
+        // Hand every finished transfer to the caller
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL *curl = msg->easy_handle;
+            MemoryChunk *body = NULL;
+            long http_code = 0;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&body);
+            int index = (int)(body - bodies);
+
+            if (msg->data.result == CURLE_OK) {
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+                if (ranges != NULL && ranges[index * 2 + 1] > 0 && http_code == 200) {
+                    cut_range(&bodies[index], ranges[index * 2], ranges[index * 2 + 1]);
+                }
+            } else {
+                fprintf(stderr, "download of %s failed: %s\n", urls[index], curl_easy_strerror(msg->data.result));
+                free(bodies[index].data);
+                bodies[index].data = NULL;
+                bodies[index].size = 0;
+                ret = -1;
+            }
+            curl_multi_remove_handle(multi, curl);
+            release_curl_handle(curl);
+            handles[index] = NULL;
+            active--;
+
+            on_done(index, &bodies[index], http_code, userdata);
+        }
+
+        if (active > 0 && curl_multi_poll(multi, NULL, 0, 1000, NULL) != CURLM_OK) {
+            ret = -1;
+            multi_failed = 1;
+            break;
+        }
+    }
+
+    // Only reached with transfers left over if the multi handle itself failed
+    for (int i = 0; i < next; i++) {
+        if (handles[i] != NULL) {
+            curl_multi_remove_handle(multi, handles[i]);
+            release_curl_handle(handles[i]);
+            free(bodies[i].data);
+            bodies[i].data = NULL;
+            bodies[i].size = 0;
+            on_done(i, &bodies[i], 0, userdata);
+        }
+    }
+    // Transfers that were never started are reported as failed too
+    for (; next < count; next++) {
+        on_done(next, &bodies[next], 0, userdata);
+    }
+
+    release_multi_handle(multi, multi_failed);
+    free(handles);
+    free(bodies);
+    return ret;
+}
+
+static void stop_readahead(void);
+
+// Initialize the vesuvius library with dynamic URL construction, reading the full resolution level
 void init_vesuvius(const char *scroll_id, int energy, double resolution) {
+    init_vesuvius_level(scroll_id, energy, resolution, 0);
+}
+
+// Initialize the vesuvius library on one level of the volume's multiscale pyramid. Level n is downsampled
+// 2^n times along every axis, so coordinates passed to get_volume_roi etc. are in that level's voxels
+void init_vesuvius_level(const char *scroll_id, int energy, double resolution, int level) {
+    // Don't let a read-ahead of the previous volume run into the new one
+    stop_readahead();
+
     // Construct the ZARR_URL based on the provided parameters, stopping at the directory
     snprintf(ZARR_URL, URL_SIZE,
-             "https://dl.ash2txt.org/other/dev/scrolls/%s/volumes/%dkeV_%.2fum.zarr/0/",
-             scroll_id, energy, resolution);
+             "https://dl.ash2txt.org/other/dev/scrolls/%s/volumes/%dkeV_%.2fum.zarr/%d/",
+             scroll_id, energy, resolution, level);
 
     // Load shape and chunk size from the dynamically constructed ZARR_URL
     if (load_shape_and_chunksize() != 0) {
@@ -251,38 +800,235 @@ void init_vesuvius(const char *scroll_id, int energy, double resolution) {
     printf("Shape: X=%d, Y=%d, Z=%d\n", SHAPE_X, SHAPE_Y, SHAPE_Z);
     printf("Chunk Size: X=%d, Y=%d, Z=%d\n", CHUNK_SIZE_X, CHUNK_SIZE_Y, CHUNK_SIZE_Z);
 
-    // Initialize cache (assuming init_cache() initializes the cache system)
+    // Initialize cache, dropping chunks from a previously initialized volume
+    free_cache(cache);
     cache = init_cache();
 }
 
 // Initialize the LRU cache
 LRUCache *init_cache() {
     LRUCache *cache = (LRUCache *)malloc(sizeof(LRUCache));
-    cache->head = NULL;
-    cache->tail = NULL;
-    cache->count = 0;
-
-    // Initialize all cache entries to NULL
-    for (int i = 0; i < CACHE_CAPACITY; i++) {
-        cache->cache[i] = NULL;
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->max_bytes = CACHE_MAX_BYTES;
+    cache->bytes = 0;
+    pthread_mutex_init(&cache->evict_lock, NULL);
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        LRUShard *shard = &cache->shards[i];
+        shard->cache = cache;
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->pending = NULL;
+        shard->head = NULL;
+        shard->tail = NULL;
+        shard->count = 0;
+        shard->bytes = 0;
+
+        // Initialize all buckets to NULL
+        shard->bucket_count = CACHE_INITIAL_BUCKETS;
+        shard->buckets = (LRUNode **)calloc(shard->bucket_count, sizeof(LRUNode *));
+        if (shard->buckets == NULL) {
+            for (int j = 0; j < i; j++) {
+                free(cache->shards[j].buckets);
+                pthread_mutex_destroy(&cache->shards[j].lock);
+            }
+            pthread_mutex_destroy(&shard->lock);
+            pthread_mutex_destroy(&cache->evict_lock);
+            free(cache);
+            return NULL;
+        }
     }
 
     return cache;
 }
 
+// Free the cache and every chunk it holds. No node may still be pinned
+void free_cache(LRUCache *cache) {
+    if (cache == NULL) return;
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        LRUShard *shard = &cache->shards[i];
+        while (shard->tail != NULL) {
+            evict_from_cache(shard);
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    pthread_mutex_destroy(&cache->evict_lock);
+    free(cache);
+}
+
+static void enforce_cache_budget(LRUCache *cache, LRUNode *keep);
+
+// Change the byte budget of a cache, evicting least recently used chunks until it fits
+void set_cache_max_bytes(LRUCache *cache, size_t max_bytes) {
+    __atomic_store_n(&cache->max_bytes, max_bytes, __ATOMIC_RELAXED);
+    enforce_cache_budget(cache, NULL);
+}
+
+// Set the byte budget of the global cache, either before or after init_vesuvius
+void set_vesuvius_cache_size(size_t max_bytes) {
+    CACHE_MAX_BYTES = max_bytes;
+    if (cache != NULL) {
+        set_cache_max_bytes(cache, max_bytes);
+    }
+}
+
+// Total size of the chunks currently held by the cache
+size_t cache_bytes(LRUCache *cache) {
+    return __atomic_load_n(&cache->bytes, __ATOMIC_RELAXED);
+}
+
+// Number of chunks currently held by the cache
+int cache_count(LRUCache *cache) {
+    int count = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        count += cache->shards[i].count;
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+    return count;
+}
+
 // Hash function to generate a key for the cache
-int hash_key(int chunk_x, int chunk_y, int chunk_z) {
-    // Ensure the hash key is non-negative and within the bounds of CACHE_CAPACITY
-    return abs((chunk_x * 73856093) ^ (chunk_y * 19349663) ^ (chunk_z * 83492791)) % CACHE_CAPACITY;
+unsigned int hash_key(int chunk_x, int chunk_y, int chunk_z) {
+    unsigned int h = ((unsigned int)chunk_x * 73856093u) ^ ((unsigned int)chunk_y * 19349663u) ^ ((unsigned int)chunk_z * 83492791u);
+    // Mix the high bits down since buckets are selected with a power of two mask
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    return h;
+}
+
+// The shard owning a chunk. Uses the high bits of the hash, the low bits select the bucket
+static LRUShard *get_cache_shard(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z) {
+    return &cache->shards[(hash_key(chunk_x, chunk_y, chunk_z) >> 24) % CACHE_SHARDS];
+}
+
+// Find the bucket slot that points at the node with the given coordinates, or at the NULL end of its chain
+static LRUNode **find_cache_slot(LRUShard *shard, int chunk_x, int chunk_y, int chunk_z) {
+    LRUNode **slot = &shard->buckets[hash_key(chunk_x, chunk_y, chunk_z) & (shard->bucket_count - 1)];
+    while (*slot && ((*slot)->chunk_x != chunk_x || (*slot)->chunk_y != chunk_y || (*slot)->chunk_z != chunk_z)) {
+        slot = &(*slot)->hash_next;
+    }
+    return slot;
+}
+
+// Double the bucket count and rehash every node
+static void grow_cache_buckets(LRUShard *shard) {
+    size_t new_count = shard->bucket_count * 2;
+    LRUNode **new_buckets = (LRUNode **)calloc(new_count, sizeof(LRUNode *));
+    if (new_buckets == NULL) {
+        return;  // Keep the current table, chains just get longer
+    }
+
+    for (size_t i = 0; i < shard->bucket_count; i++) {
+        LRUNode *node = shard->buckets[i];
+        while (node) {
+            LRUNode *next = node->hash_next;
+            size_t index = hash_key(node->chunk_x, node->chunk_y, node->chunk_z) & (new_count - 1);
+            node->hash_next = new_buckets[index];
+            new_buckets[index] = node;
+            node = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = new_buckets;
+    shard->bucket_count = new_count;
+}
+
+// Unlink a node from its shard's LRU list and hash bucket and drop the cache's reference.
+// Returns non zero if that was the last reference and the node should be freed
+static int unlink_cache_node(LRUShard *shard, LRUNode *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        shard->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        shard->tail = node->prev;
+    }
+
+    LRUNode **slot = find_cache_slot(shard, node->chunk_x, node->chunk_y, node->chunk_z);
+    *slot = node->hash_next;
+
+    shard->count--;
+    shard->bytes -= node->chunk.size;
+    __atomic_fetch_sub(&shard->cache->bytes, node->chunk.size, __ATOMIC_RELAXED);
+    return --node->refcount == 0;
+}
+
+static void free_cache_node(LRUNode *node) {
+    free(node->chunk.data);
+    free(node);
 }
 
 // Get path for disk cache based on chunk coordinates
+// Directory of the disk cache for the current volume, mirroring the path of ZARR_URL on the server
+static void get_cache_zarr_dir(char *dir, size_t size) {
+    const char *path = strstr(ZARR_URL, "://");
+    path = path ? strchr(path + 3, '/') : NULL;
+    snprintf(dir, size, "%s%s", CACHE_DIR, path ? path : "/");
+
+    size_t len = strlen(dir);
+    while (len > 0 && dir[len - 1] == '/') {
+        dir[--len] = '\0';
+    }
+}
+
 char *get_cache_path(int chunk_x, int chunk_y, int chunk_z) {
+    char dir[URL_SIZE + 64];
+    get_cache_zarr_dir(dir, sizeof(dir));
     char *path = (char *)malloc(512 * sizeof(char));
-    snprintf(path, 512, "%s/other/dev/scrolls/1/volumes/54keV_7.91um.zarr/0/%d/%d/%d", CACHE_DIR, chunk_z, chunk_y, chunk_x);
+    snprintf(path, 512, "%s/%d/%d/%d", dir, chunk_z, chunk_y, chunk_x);
     return path;
 }
 
+// Write a file through a temporary file next to it, so concurrent readers never see it half written
+static int write_file_atomic(const char *path, const unsigned char *data, size_t size) {
+    // Ensure the directory structure is created recursively
+    char *dir = strdup(path);
+    char *last_slash = strrchr(dir, '/');
+    if (last_slash) {
+        *last_slash = '\0';  // Remove the file name, keeping only the directory path
+        if (create_directories(dir) != 0) {
+            fprintf(stderr, "Failed to create directory: %s\n", dir);
+            free(dir);
+            return -1;
+        }
+    }
+    free(dir);
+
+    char tmp_path[600];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.%lx.tmp", path, (long)getpid(), (unsigned long)pthread_self());
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open file: %s\n", tmp_path);
+        return -1;
+    }
+
+    size_t written = fwrite(data, sizeof(unsigned char), size, file);
+    if (fclose(file) != 0 || written != size || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write file: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Store the volume's .zarray next to the cached chunks
+int write_metadata_to_disk(const char *zarray) {
+    char dir[URL_SIZE + 64];
+    char path[URL_SIZE + 80];
+    get_cache_zarr_dir(dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/.zarray", dir);
+    return write_file_atomic(path, (const unsigned char *)zarray, strlen(zarray));
+}
+
 // Helper function to create directories recursively
 int create_directories(const char *path) {
     char temp_path[512];
@@ -306,40 +1052,17 @@ int create_directories(const char *path) {
     return 0;  // Success
 }
 
+// Write a chunk to the disk cache. The chunk holds the compressed payload as downloaded, so the
+// cache directory is laid out like the zarr store on the server
 int write_chunk_to_disk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
     char *path = get_cache_path(chunk_x, chunk_y, chunk_z);
-
-    // Ensure the directory structure is created recursively
-    char *dir = strdup(path);
-    char *last_slash = strrchr(dir, '/');
-    if (last_slash) {
-        *last_slash = '\0';  // Remove the file name, keeping only the directory path
-        if (create_directories(dir) != 0) {
-            fprintf(stderr, "Failed to create directory: %s\n", dir);
-            free(dir);
-            free(path);
-            return -1;
-        }
-    }
-    free(dir);
-
-    // Write chunk data to disk
-    FILE *file = fopen(path, "wb");
-    if (!file) {
-        fprintf(stderr, "Failed to open file: %s\n", path);
-        free(path);
-        return -1;
-    }
-
-    fwrite(chunk->data, sizeof(unsigned char), chunk->size, file);
-    fclose(file);
+    int ret = write_file_atomic(path, chunk->data, chunk->size);
     free(path);
-
-    return 0;
+    return ret;
 }
 
 
-// Read a chunk from disk cache
+// Read a chunk from disk cache, as stored by write_chunk_to_disk
 int read_chunk_from_disk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
     char *path = get_cache_path(chunk_x, chunk_y, chunk_z);
 
@@ -365,56 +1088,324 @@ int read_chunk_from_disk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chu
 
     fclose(file);
     free(path);
+    stats_add(&STATS.disk_cache_hits, 1);
     return 0;
 }
 
-// Get chunk from the cache
+// Get chunk from the cache. The returned node is pinned and must be handed back with release_cache
 LRUNode *get_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z) {
-    int key = hash_key(chunk_x, chunk_y, chunk_z);
-    LRUNode *node = cache->cache[key];
+    LRUShard *shard = get_cache_shard(cache, chunk_x, chunk_y, chunk_z);
+    pthread_mutex_lock(&shard->lock);
+    LRUNode *node = *find_cache_slot(shard, chunk_x, chunk_y, chunk_z);
 
-    // Check if the node matches the requested chunk coordinates
-    if (node && node->chunk_x == chunk_x && node->chunk_y == chunk_y && node->chunk_z == chunk_z) {
-        move_to_head(cache, node);  // Move the node to the head (most recently used)
-        return node;
+    if (node) {
+        move_to_head(shard, node);  // Move the node to the head (most recently used)
+        node->refcount++;
     }
-    return NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return node;
 }
 
-// Put a chunk into the cache
-void put_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, MemoryChunk chunk) {
-    int key = hash_key(chunk_x, chunk_y, chunk_z);
+// Allocate a node for a chunk, pinned once for the caller and once for the cache it will be linked into
+static LRUNode *new_cache_node(int chunk_x, int chunk_y, int chunk_z, MemoryChunk chunk) {
     LRUNode *node = (LRUNode *)malloc(sizeof(LRUNode));
+    if (node == NULL) {
+        free(chunk.data);
+        return NULL;
+    }
 
     node->chunk_x = chunk_x;
     node->chunk_y = chunk_y;
     node->chunk_z = chunk_z;
     node->chunk = chunk;
+    node->chunk.node = node;
+    node->refcount = 2;
     node->prev = NULL;
-    node->next = cache->head;
+    node->next = NULL;
+    node->hash_next = NULL;
+    return node;
+}
+
+// Source of LRUNode.last_used. Only the order of the ticks matters, so all caches share it
+static uint64_t cache_clock;
+
+static uint64_t cache_tick(void) {
+    return __atomic_add_fetch(&cache_clock, 1, __ATOMIC_RELAXED);
+}
 
-    if (cache->head != NULL) {
-        cache->head->prev = node;
+// Link a node at the head of a shard, replacing any previous entry for the same chunk. The previous
+// entry is chained on *evicted if that dropped its last reference, so the caller can free it outside
+// the lock. The shard lock must be held, and the caller brings the cache back within its budget
+// with enforce_cache_budget once the lock is released
+static void link_cache_node(LRUShard *shard, LRUNode *node, LRUNode **evicted) {
+    // A previous entry for the same chunk is replaced. It is only freed once nobody has it pinned
+    LRUNode *old = *find_cache_slot(shard, node->chunk_x, node->chunk_y, node->chunk_z);
+    if (old && unlink_cache_node(shard, old)) {
+        old->next = *evicted;
+        *evicted = old;
     }
-    cache->head = node;
 
-    if (cache->tail == NULL) {
-        cache->tail = node;
+    LRUNode **slot = find_cache_slot(shard, node->chunk_x, node->chunk_y, node->chunk_z);
+    *slot = node;
+    node->next = shard->head;
+    if (shard->head != NULL) {
+        shard->head->prev = node;
+    }
+    shard->head = node;
+    if (shard->tail == NULL) {
+        shard->tail = node;
     }
 
-    // If the cache is full, evict the least recently used node
-    if (cache->count == CACHE_CAPACITY) {
-        evict_from_cache(cache);
-    } else {
-        cache->count++;
+    shard->count++;
+    shard->bytes += node->chunk.size;
+    __atomic_fetch_add(&shard->cache->bytes, node->chunk.size, __ATOMIC_RELAXED);
+    node->last_used = cache_tick();
+
+    // Keep the load factor at or below one
+    if ((size_t)shard->count > shard->bucket_count) {
+        grow_cache_buckets(shard);
+    }
+}
+
+// The node a shard would evict next, skipping keep. The shard lock must be held
+static LRUNode *cache_eviction_candidate(LRUShard *shard, LRUNode *keep) {
+    LRUNode *node = shard->tail;
+    return node != NULL && node == keep ? node->prev : node;
+}
+
+// Evict the least recently used chunks, whichever shard they are in, until the cache is within its
+// byte budget. keep, the node just inserted, is never evicted, so a chunk larger than the whole budget
+// still stays cached until the next insert. Pinned nodes leave the cache right away but their memory
+// is released by the last release_cache. No shard lock may be held
+static void enforce_cache_budget(LRUCache *cache, LRUNode *keep) {
+    if (__atomic_load_n(&cache->bytes, __ATOMIC_RELAXED) <= __atomic_load_n(&cache->max_bytes, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->evict_lock);
+    while (__atomic_load_n(&cache->bytes, __ATOMIC_RELAXED) > __atomic_load_n(&cache->max_bytes, __ATOMIC_RELAXED)) {
+        // The shard holding the oldest candidate, shards are only locked one at a time
+        LRUShard *oldest = NULL;
+        uint64_t oldest_tick = UINT64_MAX;
+        for (int i = 0; i < CACHE_SHARDS; i++) {
+            LRUShard *shard = &cache->shards[i];
+            pthread_mutex_lock(&shard->lock);
+            LRUNode *candidate = cache_eviction_candidate(shard, keep);
+            if (candidate != NULL && candidate->last_used < oldest_tick) {
+                oldest = shard;
+                oldest_tick = candidate->last_used;
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+        if (oldest == NULL) {
+            break;  // Only keep is left
+        }
+
+        // The shard may have changed since, then its current candidate goes
+        pthread_mutex_lock(&oldest->lock);
+        LRUNode *victim = cache_eviction_candidate(oldest, keep);
+        int last = 0;
+        if (victim != NULL) {
+            last = unlink_cache_node(oldest, victim);
+            stats_add(&STATS.evictions, 1);
+        }
+        pthread_mutex_unlock(&oldest->lock);
+        if (last) {
+            free_cache_node(victim);
+        }
+    }
+    pthread_mutex_unlock(&cache->evict_lock);
+}
+
+static void free_evicted_nodes(LRUNode *evicted) {
+    while (evicted) {
+        LRUNode *next = evicted->next;
+        free_cache_node(evicted);
+        evicted = next;
+    }
+}
+
+// Put a chunk into the cache, the cache takes ownership of chunk.data.
+// Returns the new node pinned, release it with release_cache. NULL if the node could not be allocated
+LRUNode *put_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, MemoryChunk chunk) {
+    LRUNode *node = new_cache_node(chunk_x, chunk_y, chunk_z, chunk);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    LRUShard *shard = get_cache_shard(cache, chunk_x, chunk_y, chunk_z);
+    LRUNode *evicted = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+    link_cache_node(shard, node, &evicted);
+    pthread_mutex_unlock(&shard->lock);
+
+    free_evicted_nodes(evicted);
+    enforce_cache_budget(cache, node);
+    return node;
+}
+
+// Unpin a node returned by get_cache or put_cache
+void release_cache(LRUCache *cache, LRUNode *node) {
+    if (node == NULL) return;
+
+    LRUShard *shard = get_cache_shard(cache, node->chunk_x, node->chunk_y, node->chunk_z);
+    pthread_mutex_lock(&shard->lock);
+    int last = --node->refcount == 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (last) {
+        free_cache_node(node);
+    }
+}
+
+// Look a chunk up and, if it is missing, claim the right to load it so concurrent callers
+// missing on the same chunk don't all fetch it:
+//   - CACHE_HIT: *node is the cached chunk, pinned
+//   - CACHE_CLAIMED: the caller must load the chunk and then call complete_cache, even on failure
+//   - CACHE_PENDING: another thread is loading it and wait is 0
+//   - CACHE_FAILED: another thread was loading it and failed
+// With wait set, a caller that finds the chunk being loaded blocks until it is done and then gets
+// the loaded chunk as a CACHE_HIT, or claims the chunk itself if the load was abandoned
+int claim_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, int wait, LRUNode **node) {
+    LRUShard *shard = get_cache_shard(cache, chunk_x, chunk_y, chunk_z);
+    pthread_mutex_lock(&shard->lock);
+
+    LRUNode *cached = *find_cache_slot(shard, chunk_x, chunk_y, chunk_z);
+    if (cached) {
+        move_to_head(shard, cached);
+        cached->refcount++;
+        pthread_mutex_unlock(&shard->lock);
+        *node = cached;
+        return CACHE_HIT;
+    }
+
+    PendingFetch *pending = shard->pending;
+    while (pending && (pending->chunk_x != chunk_x || pending->chunk_y != chunk_y || pending->chunk_z != chunk_z)) {
+        pending = pending->next;
+    }
+
+    if (pending == NULL) {
+        pending = (PendingFetch *)malloc(sizeof(PendingFetch));
+        if (pending != NULL) {
+            pending->chunk_x = chunk_x;
+            pending->chunk_y = chunk_y;
+            pending->chunk_z = chunk_z;
+            pending->waiters = 0;
+            pending->done = 0;
+            pending->result = NULL;
+            pending->retry = 0;
+            pthread_cond_init(&pending->cond, NULL);
+            pending->next = shard->pending;
+            shard->pending = pending;
+        }
+        // Without a pending entry the load simply isn't shared, complete_cache copes with that
+        pthread_mutex_unlock(&shard->lock);
+        *node = NULL;
+        return CACHE_CLAIMED;
+    }
+
+    if (!wait) {
+        pthread_mutex_unlock(&shard->lock);
+        *node = NULL;
+        return CACHE_PENDING;
+    }
+
+    pending->waiters++;
+    while (!pending->done) {
+        pthread_cond_wait(&pending->cond, &shard->lock);
+    }
+    LRUNode *result = pending->result;  // Already pinned for us by complete_cache
+    int retry = pending->retry;
+    int last = --pending->waiters == 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    // The pending entry was unlinked by complete_cache, the last waiter out frees it
+    if (last) {
+        pthread_cond_destroy(&pending->cond);
+        free(pending);
+    }
+
+    if (retry) {
+        return claim_cache(cache, chunk_x, chunk_y, chunk_z, wait, node);
+    }
+    *node = result;
+    return result ? CACHE_HIT : CACHE_FAILED;
+}
+
+// Finish a load claimed with claim_cache. Pass the loaded chunk, or NULL if loading failed, in which
+// case every waiter gets CACHE_FAILED. The cache takes ownership of chunk->data.
+// Returns the cached node pinned for the caller, or NULL on failure
+LRUNode *complete_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
+    LRUNode *node = NULL;
+    if (chunk != NULL) {
+        node = new_cache_node(chunk_x, chunk_y, chunk_z, *chunk);
+    }
+
+    LRUShard *shard = get_cache_shard(cache, chunk_x, chunk_y, chunk_z);
+    LRUNode *evicted = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+    if (node != NULL) {
+        link_cache_node(shard, node, &evicted);
+    }
+
+    PendingFetch **link = &shard->pending;
+    while (*link && ((*link)->chunk_x != chunk_x || (*link)->chunk_y != chunk_y || (*link)->chunk_z != chunk_z)) {
+        link = &(*link)->next;
+    }
+    PendingFetch *pending = *link;
+    if (pending != NULL) {
+        *link = pending->next;
+        pending->done = 1;
+        pending->result = node;
+        if (node != NULL) {
+            node->refcount += pending->waiters;
+        }
+        if (pending->waiters > 0) {
+            pthread_cond_broadcast(&pending->cond);
+        } else {
+            pthread_cond_destroy(&pending->cond);
+            free(pending);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    free_evicted_nodes(evicted);
+    if (node != NULL) {
+        enforce_cache_budget(cache, node);
     }
+    return node;
+}
 
-    cache->cache[key] = node;
+// Finish a load claimed with claim_cache without caching the chunk, for a caller that loaded it
+// straight into its own buffer. Waiters don't fail, they claim the chunk again and load it themselves
+void abandon_cache(LRUCache *cache, int chunk_x, int chunk_y, int chunk_z) {
+    LRUShard *shard = get_cache_shard(cache, chunk_x, chunk_y, chunk_z);
+    pthread_mutex_lock(&shard->lock);
+    PendingFetch **link = &shard->pending;
+    while (*link && ((*link)->chunk_x != chunk_x || (*link)->chunk_y != chunk_y || (*link)->chunk_z != chunk_z)) {
+        link = &(*link)->next;
+    }
+    PendingFetch *pending = *link;
+    if (pending != NULL) {
+        *link = pending->next;
+        pending->done = 1;
+        pending->retry = 1;
+        if (pending->waiters > 0) {
+            pthread_cond_broadcast(&pending->cond);
+        } else {
+            pthread_cond_destroy(&pending->cond);
+            free(pending);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
 }
 
-// Move a node to the head of the LRU cache (most recently used)
-void move_to_head(LRUCache *cache, LRUNode *node) {
-    if (node == cache->head) return;
+// Move a node to the head of the LRU list (most recently used). The shard lock must be held
+void move_to_head(LRUShard *shard, LRUNode *node) {
+    node->last_used = cache_tick();
+    if (node == shard->head) return;
 
     if (node->prev) {
         node->prev->next = node->next;
@@ -423,48 +1414,181 @@ void move_to_head(LRUCache *cache, LRUNode *node) {
         node->next->prev = node->prev;
     }
 
-    if (node == cache->tail) {
-        cache->tail = node->prev;
+    if (node == shard->tail) {
+        shard->tail = node->prev;
     }
 
     node->prev = NULL;
-    node->next = cache->head;
+    node->next = shard->head;
 
-    if (cache->head != NULL) {
-        cache->head->prev = node;
+    if (shard->head != NULL) {
+        shard->head->prev = node;
     }
-    cache->head = node;
+    shard->head = node;
+}
+
+// Evict the least recently used node from a shard. The shard lock must be held
+void evict_from_cache(LRUShard *shard) {
+    if (shard->tail == NULL) return;
+
+    LRUNode *node = shard->tail;
+    if (unlink_cache_node(shard, node)) {
+        free_cache_node(node);
+    }
+}
+
+// Every thread that decompresses blocks has its own blosc2 context, so threads decompressing at the
+// same time don't contend for the global one. It is freed when the thread exits
+typedef struct {
+    blosc2_context *ctx;
+    int nthreads;  // DECOMPRESS_THREADS when the context was created
+} DecompressContext;
+
+static pthread_key_t decompress_context_key;
+static pthread_once_t decompress_context_once = PTHREAD_ONCE_INIT;
+
+static void free_decompress_context(void *arg) {
+    DecompressContext *dc = (DecompressContext *)arg;
+    blosc2_free_ctx(dc->ctx);
+    free(dc);
 }
 
-// Evict the least recently used node from the cache
-void evict_from_cache(LRUCache *cache) {
-    if (cache->tail == NULL) return;
+static void create_decompress_context_key(void) {
+    pthread_key_create(&decompress_context_key, free_decompress_context);
+}
 
-    LRUNode *node = cache->tail;
+// Set how many threads blosc uses to decompress a single block, 0 uses every core.
+// Threads pick the new count up with their next block
+void set_decompress_threads(int nthreads) {
+    if (nthreads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cores > 0 ? (int)cores : 1;
+    }
+    DECOMPRESS_THREADS = nthreads < INT16_MAX ? nthreads : INT16_MAX;
+}
 
-    if (cache->tail->prev) {
-        cache->tail->prev->next = NULL;
+// The calling thread's decompression context, created on first use and again when the thread count
+// has changed since. Returns NULL if it can't be created
+static blosc2_context *get_decompress_context(void) {
+    pthread_once(&decompress_context_once, create_decompress_context_key);
+    int nthreads = DECOMPRESS_THREADS;
+    DecompressContext *dc = (DecompressContext *)pthread_getspecific(decompress_context_key);
+    if (dc != NULL && dc->nthreads == nthreads) {
+        return dc->ctx;
     }
-    cache->tail = cache->tail->prev;
 
-    int key = hash_key(node->chunk_x, node->chunk_y, node->chunk_z);
-    cache->cache[key] = NULL;
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = (int16_t)nthreads;
+    blosc2_context *ctx = blosc2_create_dctx(dparams);
+    if (ctx == NULL) {
+        return NULL;
+    }
+    if (dc == NULL) {
+        dc = (DecompressContext *)malloc(sizeof(DecompressContext));
+        if (dc == NULL || pthread_setspecific(decompress_context_key, dc) != 0) {
+            free(dc);
+            blosc2_free_ctx(ctx);
+            return NULL;
+        }
+    } else {
+        blosc2_free_ctx(dc->ctx);
+    }
+    dc->ctx = ctx;
+    dc->nthreads = nthreads;
+    return ctx;
+}
 
-    free(node->chunk.data);
-    free(node);
+// blosc2_decompress with the calling thread's context, falling back to the global one without it
+int decompress_blosc(const void *src, int32_t srcsize, void *dest, int32_t destsize) {
+    uint64_t start = stats_now_ns();
+    blosc2_context *ctx = get_decompress_context();
+    int ret = ctx ? blosc2_decompress_ctx(ctx, src, srcsize, dest, destsize)
+                  : blosc2_decompress(src, srcsize, dest, destsize);
+    stats_record(&STATS.decode, stats_now_ns() - start);
+    return ret;
 }
 
-// Get chunk from the cache, disk, or fetch it
-int fetch_zarr_chunk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
-    LRUNode *cached_node = get_cache(cache, chunk_x, chunk_y, chunk_z);
-    if (cached_node) {
-        *chunk = cached_node->chunk;
+// Decompress the downloaded data of a chunk into dest, which has room for all its voxels.
+// Returns the decompressed size or -1 on failure
+static int decompress_zarr_chunk_into(const MemoryChunk *chunk, unsigned char *dest) {
+    int decompressed_size = decompress_blosc(chunk->data, chunk->size, dest, CHUNK_SIZE_Z * CHUNK_SIZE_Y * CHUNK_SIZE_X);
+    if (decompressed_size < 0) {
+        fprintf(stderr, "Blosc2 decompression failed: %d\n", decompressed_size);
+        return -1;
+    }
+    return decompressed_size;
+}
+
+// Replace the downloaded, compressed data of a chunk with the decompressed voxels.
+// On failure the compressed data is freed and chunk->data is NULL
+static int decompress_zarr_chunk(MemoryChunk *chunk) {
+    unsigned char *decompressed_data = (unsigned char *)malloc(CHUNK_SIZE_Z * CHUNK_SIZE_Y * CHUNK_SIZE_X);
+    if (decompressed_data == NULL) {
+        fprintf(stderr, "Not enough memory to decompress chunk\n");
+        free(chunk->data);
+        chunk->data = NULL;
+        return -1;
+    }
+    int decompressed_size = decompress_zarr_chunk_into(chunk, decompressed_data);
+    if (decompressed_size < 0) {
+        free(chunk->data);
+        chunk->data = NULL;
+        free(decompressed_data);
+        return -1;
+    }
+
+    // Free the compressed data and update the chunk with the decompressed data
+    free(chunk->data);
+    chunk->data = decompressed_data;
+    chunk->size = decompressed_size;
+    return 0;
+}
+
+// Caches written before chunks were stored compressed hold the raw voxels
+static int is_raw_chunk(const MemoryChunk *chunk) {
+    size_t raw_size = (size_t)CHUNK_SIZE_Z * CHUNK_SIZE_Y * CHUNK_SIZE_X;
+    int32_t nbytes = 0, cbytes = 0;
+    return chunk->size == raw_size &&
+           (chunk->size < BLOSC2_MAX_OVERHEAD ||
+            blosc2_cbuffer_sizes(chunk->data, &nbytes, &cbytes, NULL) < 0 || (size_t)cbytes != chunk->size);
+}
+
+// Read a chunk from the disk cache and decompress it. Raw chunks are used as they are
+static int load_chunk_from_disk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
+    if (read_chunk_from_disk(chunk_x, chunk_y, chunk_z, chunk) != 0) {
+        return -1;
+    }
+    chunk->node = NULL;
+
+    if (is_raw_chunk(chunk)) {
         return 0;
     }
+    return decompress_zarr_chunk(chunk);
+}
+
+// Read a chunk from the disk cache and decompress it straight into dest, which has room for all its voxels
+static int load_chunk_from_disk_into(int chunk_x, int chunk_y, int chunk_z, unsigned char *dest) {
+    MemoryChunk chunk = {0};
+    if (read_chunk_from_disk(chunk_x, chunk_y, chunk_z, &chunk) != 0) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (is_raw_chunk(&chunk)) {
+        memcpy(dest, chunk.data, chunk.size);
+    } else if (decompress_zarr_chunk_into(&chunk, dest) < 0) {
+        ret = -1;
+    }
+    free(chunk.data);
+    return ret;
+}
 
+// Load a chunk that is not in the memory cache, from the disk cache or else from the server.
+// Downloaded chunks are written to the disk cache still compressed.
+// Returns 0 if it was read from disk, 1 if it was downloaded and -1 on failure
+static int load_zarr_chunk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
     // Try reading from disk cache
-    if (read_chunk_from_disk(chunk_x, chunk_y, chunk_z, chunk) == 0) {
-        put_cache(cache, chunk_x, chunk_y, chunk_z, *chunk);  // Store in memory cache
+    if (load_chunk_from_disk(chunk_x, chunk_y, chunk_z, chunk) == 0) {
         return 0;
     }
 
@@ -476,43 +1600,85 @@ int fetch_zarr_chunk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk)
     snprintf(url, sizeof(url), "%s%d/%d/%d", ZARR_URL, chunk_z, chunk_y, chunk_x);
     chunk->data = (unsigned char *)malloc(1);
     chunk->size = 0;
+    chunk->node = NULL;
 
-    curl = curl_easy_init();
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
-
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-            curl_easy_cleanup(curl);
-            return -1;
-        }
-        curl_easy_cleanup(curl);
+    curl = acquire_curl_handle(url);
+    if (!curl) {
+        free(chunk->data);
+        chunk->data = NULL;
+        return -1;
+    }
 
-        // Decompress the chunk using Blosc
-        unsigned char *decompressed_data = (unsigned char *)malloc(CHUNK_SIZE_Z * CHUNK_SIZE_Y * CHUNK_SIZE_X);
-        int decompressed_size = blosc2_decompress(chunk->data, chunk->size, decompressed_data, CHUNK_SIZE_Z * CHUNK_SIZE_Y * CHUNK_SIZE_X);
-        if (decompressed_size < 0) {
-            fprintf(stderr, "Blosc2 decompression failed: %d\n", decompressed_size);
-            free(chunk->data);
-            free(decompressed_data);
-            return -1;
-        }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
 
-        // Free the compressed data and update the chunk with the decompressed data
+    res = curl_easy_perform(curl);
+    if (res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        free(chunk->data);
+        chunk->data = NULL;
+        release_curl_handle(curl);
+        return -1;
+    }
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    release_curl_handle(curl);
+    if (http_code >= 400) {
+        fprintf(stderr, "Server returned %ld for Zarr chunk (%d, %d, %d)\n", http_code, chunk_x, chunk_y, chunk_z);
         free(chunk->data);
-        chunk->data = decompressed_data;
-        chunk->size = decompressed_size;
+        chunk->data = NULL;
+        return -1;
+    }
+
+    write_chunk_to_disk(chunk_x, chunk_y, chunk_z, chunk);
+    if (decompress_zarr_chunk(chunk) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+// Get chunk from the cache, disk, or fetch it. Concurrent callers missing on the same chunk
+// share a single load instead of each fetching it.
+// On success chunk points into a pinned cache entry, hand it back with release_zarr_chunk when done
+int fetch_zarr_chunk(int chunk_x, int chunk_y, int chunk_z, MemoryChunk *chunk) {
+    LRUNode *cached_node = NULL;
+    int status = claim_cache(cache, chunk_x, chunk_y, chunk_z, 1, &cached_node);
+    stats_chunk_read(status);
+    if (status == CACHE_HIT) {
+        *chunk = cached_node->chunk;
+        return 0;
+    } else if (status == CACHE_FAILED) {
+        return -1;
+    }
 
-        // Store in memory and disk cache
-        put_cache(cache, chunk_x, chunk_y, chunk_z, *chunk);
-        write_chunk_to_disk(chunk_x, chunk_y, chunk_z, chunk);
+    int source = load_zarr_chunk(chunk_x, chunk_y, chunk_z, chunk);
+    if (source < 0) {
+        complete_cache(cache, chunk_x, chunk_y, chunk_z, NULL);  // Wake any waiters
+        return -1;
+    }
+
+    // Store in memory cache, handing the chunk to everybody waiting on it
+    cached_node = complete_cache(cache, chunk_x, chunk_y, chunk_z, chunk);
+    if (cached_node == NULL) {
+        chunk->data = NULL;
+        return -1;
     }
+    *chunk = cached_node->chunk;
     return 0;
 }
 
+// Hand a chunk returned by fetch_zarr_chunk back to the cache
+void release_zarr_chunk(MemoryChunk *chunk) {
+    if (chunk->node) {
+        release_cache(cache, chunk->node);
+    } else {
+        free(chunk->data);
+    }
+    chunk->data = NULL;
+    chunk->size = 0;
+    chunk->node = NULL;
+}
+
 // Function to retrieve the value at a specific (x, y, z) index
 int get_volume_voxel(int x, int y, int z, unsigned char *value) {
     // Calculate the corresponding chunk indices
@@ -534,20 +1700,127 @@ int get_volume_voxel(int x, int y, int z, unsigned char *value) {
 
     // Retrieve the value from the chunk data
     *value = chunk.data[local_z * CHUNK_SIZE_X * CHUNK_SIZE_Y + local_y * CHUNK_SIZE_X + local_x];
+    release_zarr_chunk(&chunk);
 
     return 0;
 }
 
-// Function to fill a 3D volume from the Zarr data
-int get_volume_roi(RegionOfInterest region, unsigned char *volume) {
-    // Validate boundaries
-    if (region.x_start < 0 || region.x_start + region.x_width > SHAPE_X ||
-        region.y_start < 0 || region.y_start + region.y_height > SHAPE_Y ||
-        region.z_start < 0 || region.z_start + region.z_depth > SHAPE_Z) {
-        fprintf(stderr, "Invalid boundaries for the volume\n");
-        return -1;
+// Copy the part of a chunk that overlaps the region into the volume
+static void copy_chunk_to_roi(RegionOfInterest region, unsigned char *volume, int chunk_x, int chunk_y, int chunk_z, const MemoryChunk *chunk) {
+    // Calculate local boundaries within the chunk
+    int local_start_x = region.x_start > chunk_x * CHUNK_SIZE_X ? region.x_start - chunk_x * CHUNK_SIZE_X : 0;
+    int local_end_x = region.x_start + region.x_width < (chunk_x + 1) * CHUNK_SIZE_X ? region.x_start + region.x_width - 1 - chunk_x * CHUNK_SIZE_X : CHUNK_SIZE_X - 1;
+    int local_start_y = region.y_start > chunk_y * CHUNK_SIZE_Y ? region.y_start - chunk_y * CHUNK_SIZE_Y : 0;
+    int local_end_y = region.y_start + region.y_height < (chunk_y + 1) * CHUNK_SIZE_Y ? region.y_start + region.y_height - 1 - chunk_y * CHUNK_SIZE_Y : CHUNK_SIZE_Y - 1;
+    int local_start_z = region.z_start > chunk_z * CHUNK_SIZE_Z ? region.z_start - chunk_z * CHUNK_SIZE_Z : 0;
+    int local_end_z = region.z_start + region.z_depth < (chunk_z + 1) * CHUNK_SIZE_Z ? region.z_start + region.z_depth - 1 - chunk_z * CHUNK_SIZE_Z : CHUNK_SIZE_Z - 1;
+
+    // Copy the relevant data from the chunk to the volume
+    uint64_t start = stats_now_ns();
+    for (int z = local_start_z; z <= local_end_z; ++z) {
+        for (int y = local_start_y; y <= local_end_y; ++y) {
+            memcpy(&volume[((chunk_z * CHUNK_SIZE_Z + z - region.z_start) * region.y_height +
+                            (chunk_y * CHUNK_SIZE_Y + y - region.y_start)) * region.x_width +
+                           (chunk_x * CHUNK_SIZE_X + local_start_x - region.x_start)],
+                   &chunk->data[z * CHUNK_SIZE_X * CHUNK_SIZE_Y + y * CHUNK_SIZE_X + local_start_x],
+                   local_end_x - local_start_x + 1);
+        }
+    }
+    stats_record(&STATS.graft, stats_now_ns() - start);
+}
+
+// Where a chunk can be decompressed straight into the volume instead of being copied row by row, or NULL.
+// That takes a region exactly one chunk wide and high that covers the whole depth of the chunk, so the
+// chunk is one contiguous run of the volume
+static unsigned char *roi_chunk_dest(RegionOfInterest region, unsigned char *volume, int chunk_x, int chunk_y, int chunk_z) {
+    if (volume == NULL ||
+        region.x_start != chunk_x * CHUNK_SIZE_X || region.x_width != CHUNK_SIZE_X ||
+        region.y_start != chunk_y * CHUNK_SIZE_Y || region.y_height != CHUNK_SIZE_Y ||
+        chunk_z * CHUNK_SIZE_Z < region.z_start || (chunk_z + 1) * CHUNK_SIZE_Z > region.z_start + region.z_depth) {
+        return NULL;
+    }
+    return &volume[(size_t)(chunk_z * CHUNK_SIZE_Z - region.z_start) * CHUNK_SIZE_Y * CHUNK_SIZE_X];
+}
+
+// Finish a claimed load by caching a copy of a chunk that was decompressed straight into the volume,
+// see roi_chunk_dest. Without memory for the copy the claim is abandoned and waiters load the chunk themselves
+static void cache_chunk_copy(int chunk_x, int chunk_y, int chunk_z, const unsigned char *voxels) {
+    MemoryChunk chunk = {0};
+    chunk.size = (size_t)CHUNK_SIZE_Z * CHUNK_SIZE_Y * CHUNK_SIZE_X;
+    chunk.data = (unsigned char *)malloc(chunk.size);
+    if (chunk.data == NULL) {
+        abandon_cache(cache, chunk_x, chunk_y, chunk_z);
+        return;
+    }
+    memcpy(chunk.data, voxels, chunk.size);
+    LRUNode *node = complete_cache(cache, chunk_x, chunk_y, chunk_z, &chunk);
+    if (node != NULL) {
+        release_cache(cache, node);
+    }
+}
+
+// State shared by get_volume_roi with the callback of its parallel downloads
+typedef struct {
+    RegionOfInterest region;
+    unsigned char *volume;
+    int *chunks;  // x, y, z of every downloaded chunk
+    int failed;
+} RoiDownload;
+
+// Decompress, cache and copy a chunk as soon as its download finishes
+static void roi_download_done(int index, MemoryChunk *body, long http_code, void *userdata) {
+    RoiDownload *roi = (RoiDownload *)userdata;
+    int chunk_x = roi->chunks[index * 3];
+    int chunk_y = roi->chunks[index * 3 + 1];
+    int chunk_z = roi->chunks[index * 3 + 2];
+
+    if (body->data != NULL && http_code >= 400) {
+        fprintf(stderr, "Server returned %ld for Zarr chunk (%d, %d, %d)\n", http_code, chunk_x, chunk_y, chunk_z);
+        free(body->data);
+        body->data = NULL;
+    }
+    if (body->data != NULL) {
+        write_chunk_to_disk(chunk_x, chunk_y, chunk_z, body);
+    }
+
+    // A chunk that lands in the volume whole is decompressed straight into it and a copy is cached
+    unsigned char *dest = roi_chunk_dest(roi->region, roi->volume, chunk_x, chunk_y, chunk_z);
+    if (body->data != NULL && dest != NULL) {
+        int decompressed_size = decompress_zarr_chunk_into(body, dest);
+        free(body->data);
+        body->data = NULL;
+        if (decompressed_size < 0) {
+            complete_cache(cache, chunk_x, chunk_y, chunk_z, NULL);
+            roi->failed = 1;
+        } else {
+            cache_chunk_copy(chunk_x, chunk_y, chunk_z, dest);
+        }
+        return;
+    }
+
+    if (body->data == NULL || decompress_zarr_chunk(body) != 0) {
+        complete_cache(cache, chunk_x, chunk_y, chunk_z, NULL);  // Wake any waiters
+        roi->failed = 1;
+        return;
     }
 
+    LRUNode *node = complete_cache(cache, chunk_x, chunk_y, chunk_z, body);
+    if (node == NULL) {
+        roi->failed = 1;
+        return;
+    }
+    if (roi->volume) {
+        copy_chunk_to_roi(roi->region, roi->volume, chunk_x, chunk_y, chunk_z, &node->chunk);
+    }
+    release_cache(cache, node);
+}
+
+// Load every chunk of an in-bounds region into the cache and copy it into volume.
+// Chunks missing from both caches are downloaded MAX_PARALLEL_DOWNLOADS at a time and copied into
+// the volume as each one arrives. With volume NULL the chunks are only cached, and chunks another
+// thread is already loading are skipped. Chunks that fill a contiguous run of the volume are
+// decompressed straight into it and a copy is cached, see roi_chunk_dest
+static int load_roi_chunks(RegionOfInterest region, unsigned char *volume) {
     // Determine the range of chunks needed for the volume
     int chunk_start_x = region.x_start / CHUNK_SIZE_X;
     int chunk_end_x = (region.x_start + region.x_width - 1) / CHUNK_SIZE_X;
@@ -555,44 +1828,111 @@ int get_volume_roi(RegionOfInterest region, unsigned char *volume) {
     int chunk_end_y = (region.y_start + region.y_height - 1) / CHUNK_SIZE_Y;
     int chunk_start_z = region.z_start / CHUNK_SIZE_Z;
     int chunk_end_z = (region.z_start + region.z_depth - 1) / CHUNK_SIZE_Z;
+    int chunk_count = (chunk_end_x - chunk_start_x + 1) * (chunk_end_y - chunk_start_y + 1) * (chunk_end_z - chunk_start_z + 1);
+
+    RoiDownload roi = {region, volume, NULL, 0};
+    roi.chunks = (int *)malloc(chunk_count * 3 * sizeof(int));
+    int *deferred = (int *)malloc(chunk_count * 3 * sizeof(int));
+    char **urls = (char **)malloc(chunk_count * sizeof(char *));
+    if (roi.chunks == NULL || deferred == NULL || urls == NULL) {
+        fprintf(stderr, "Not enough memory to read the volume\n");
+        free(roi.chunks);
+        free(deferred);
+        free(urls);
+        return -1;
+    }
+    int download_count = 0;
+    int deferred_count = 0;
 
-    // Loop over all chunks that cover the volume
+    // Copy every cached chunk right away and claim the missing ones for download
     for (int chunk_z = chunk_start_z; chunk_z <= chunk_end_z; ++chunk_z) {
         for (int chunk_y = chunk_start_y; chunk_y <= chunk_end_y; ++chunk_y) {
             for (int chunk_x = chunk_start_x; chunk_x <= chunk_end_x; ++chunk_x) {
-                // Fetch the chunk data
-                MemoryChunk chunk = {0};
-                if (fetch_zarr_chunk(chunk_x, chunk_y, chunk_z, &chunk) != 0) {
-                    fprintf(stderr, "Failed to fetch Zarr chunk (%d, %d, %d)\n", chunk_x, chunk_y, chunk_z);
-                    return -1;
+                LRUNode *node = NULL;
+                int status = claim_cache(cache, chunk_x, chunk_y, chunk_z, 0, &node);
+                // Pending chunks are counted when fetch_zarr_chunk picks them up below
+                if (volume && status != CACHE_PENDING) {
+                    stats_chunk_read(status);
+                }
+                if (status == CACHE_CLAIMED) {
+                    MemoryChunk chunk = {0};
+                    unsigned char *dest = roi_chunk_dest(region, volume, chunk_x, chunk_y, chunk_z);
+                    if (dest != NULL && load_chunk_from_disk_into(chunk_x, chunk_y, chunk_z, dest) == 0) {
+                        cache_chunk_copy(chunk_x, chunk_y, chunk_z, dest);
+                        continue;
+                    } else if (dest == NULL && load_chunk_from_disk(chunk_x, chunk_y, chunk_z, &chunk) == 0) {
+                        node = complete_cache(cache, chunk_x, chunk_y, chunk_z, &chunk);
+                        if (node == NULL) {
+                            roi.failed = 1;
+                            continue;
+                        }
+                        status = CACHE_HIT;
+                    } else {
+                        char *url = (char *)malloc(URL_SIZE + 64);
+                        if (url == NULL) {
+                            complete_cache(cache, chunk_x, chunk_y, chunk_z, NULL);
+                            roi.failed = 1;
+                            continue;
+                        }
+                        snprintf(url, URL_SIZE + 64, "%s%d/%d/%d", ZARR_URL, chunk_z, chunk_y, chunk_x);
+                        urls[download_count] = url;
+                        roi.chunks[download_count * 3] = chunk_x;
+                        roi.chunks[download_count * 3 + 1] = chunk_y;
+                        roi.chunks[download_count * 3 + 2] = chunk_z;
+                        download_count++;
+                    }
                 }
 
-                // Calculate local boundaries within the chunk
-                int local_start_x = (chunk_x == chunk_start_x) ? region.x_start % CHUNK_SIZE_X : 0;
-                int local_end_x = (chunk_x == chunk_end_x) ? (region.x_start + region.x_width - 1) % CHUNK_SIZE_X : CHUNK_SIZE_X - 1;
-                int local_start_y = (chunk_y == chunk_start_y) ? region.y_start % CHUNK_SIZE_Y : 0;
-                int local_end_y = (chunk_y == chunk_end_y) ? (region.y_start + region.y_height - 1) % CHUNK_SIZE_Y : CHUNK_SIZE_Y - 1;
-                int local_start_z = (chunk_z == chunk_start_z) ? region.z_start % CHUNK_SIZE_Z : 0;
-                int local_end_z = (chunk_z == chunk_end_z) ? (region.z_start + region.z_depth - 1) % CHUNK_SIZE_Z : CHUNK_SIZE_Z - 1;
-
-                // Copy the relevant data from the chunk to the volume
-                for (int z = local_start_z; z <= local_end_z; ++z) {
-                    for (int y = local_start_y; y <= local_end_y; ++y) {
-                        memcpy(&volume[((chunk_z * CHUNK_SIZE_Z + z - region.z_start) * region.y_height +
-                                        (chunk_y * CHUNK_SIZE_Y + y - region.y_start)) * region.x_width +
-                                       (chunk_x * CHUNK_SIZE_X + local_start_x - region.x_start)],
-                               &chunk.data[z * CHUNK_SIZE_X * CHUNK_SIZE_Y + y * CHUNK_SIZE_X + local_start_x],
-                               local_end_x - local_start_x + 1);
+                if (status == CACHE_HIT) {
+                    if (volume) {
+                        copy_chunk_to_roi(region, volume, chunk_x, chunk_y, chunk_z, &node->chunk);
                     }
+                    release_cache(cache, node);
+                } else if (status == CACHE_PENDING && volume) {
+                    // Another thread is loading it, pick it up once our own downloads are done
+                    deferred[deferred_count * 3] = chunk_x;
+                    deferred[deferred_count * 3 + 1] = chunk_y;
+                    deferred[deferred_count * 3 + 2] = chunk_z;
+                    deferred_count++;
+                } else if (status == CACHE_FAILED) {
+                    roi.failed = 1;
                 }
             }
         }
     }
 
+    // Every claimed chunk is completed in here, so waiting on other threads afterwards can't deadlock
+    download_parallel(urls, download_count, MAX_PARALLEL_DOWNLOADS, roi_download_done, &roi);
+    for (int i = 0; i < download_count; i++) {
+        free(urls[i]);
+    }
+
+    for (int i = 0; i < deferred_count; i++) {
+        int chunk_x = deferred[i * 3];
+        int chunk_y = deferred[i * 3 + 1];
+        int chunk_z = deferred[i * 3 + 2];
+        MemoryChunk chunk = {0};
+        if (fetch_zarr_chunk(chunk_x, chunk_y, chunk_z, &chunk) != 0) {
+            roi.failed = 1;
+            continue;
+        }
+        copy_chunk_to_roi(region, volume, chunk_x, chunk_y, chunk_z, &chunk);
+        release_zarr_chunk(&chunk);
+    }
+
+    free(roi.chunks);
+    free(deferred);
+    free(urls);
+
+    if (roi.failed) {
+        fprintf(stderr, "Failed to fetch all Zarr chunks of the volume\n");
+        return -1;
+    }
     return 0;
 }
 
-int get_volume_slice(RegionOfInterest region, unsigned char *slice) {
+// Function to fill a 3D volume from the Zarr data
+int get_volume_roi(RegionOfInterest region, unsigned char *volume) {
     // Validate boundaries
     if (region.x_start < 0 || region.x_start + region.x_width > SHAPE_X ||
         region.y_start < 0 || region.y_start + region.y_height > SHAPE_Y ||
@@ -601,32 +1941,232 @@ int get_volume_slice(RegionOfInterest region, unsigned char *slice) {
         return -1;
     }
 
-    // Validate depth 1
-    if (region.z_depth != 1) {
-        fprintf(stderr, "Slice must have z_depth of 1\n");
-        return -1;
+    return load_roi_chunks(region, volume);
+}
+
+// Background thread that loads the chunks get_volume_slice expects to need next. It starts with the
+// first sweep and runs until shutdown_readahead
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    SweepTracker sweep;
+    RegionOfInterest next;  // Region to load, only the latest request is kept
+    int has_next;
+    int busy;
+    int started;
+    int shutdown;
+    pthread_t thread;
+} ReadAhead;
+
+static ReadAhead readahead = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+// Set how many chunk layers get_volume_slice fetches ahead of a sweep, 0 disables read-ahead
+void set_readahead_depth(int depth) {
+    READAHEAD_DEPTH = depth > 0 ? depth : 0;
+}
+
+// Feed a read to the tracker. Returns 1 if the reads form a sweep and the next depth chunk layers
+// along it haven't been requested yet, setting ahead_start and ahead_dims to the region to fetch.
+// That region may reach past the edges of the volume
+int track_sweep(SweepTracker *tracker, const int start[3], const int dims[3], const int chunk_dims[3], int depth,
+                int ahead_start[3], int ahead_dims[3]) {
+    int moved = 0;
+    int axis = -1;
+    for (int i = 0; i < 3; i++) {
+        if (start[i] != tracker->start[i]) {
+            moved++;
+            axis = i;
+        }
     }
+    int same_shape = memcmp(dims, tracker->dims, sizeof(tracker->dims)) == 0;
+    int direction = axis >= 0 && start[axis] > tracker->start[axis] ? 1 : -1;
+    memcpy(tracker->start, start, sizeof(tracker->start));
+    memcpy(tracker->dims, dims, sizeof(tracker->dims));
 
-    // Fetch the volume data for the slice
-    unsigned char *volume = (unsigned char *)malloc(region.x_width * region.y_height);
-    if (get_volume_roi(region, volume) != 0) {
-        fprintf(stderr, "Failed to fetch volume data for slice\n");
-        return -1;
+    if (moved == 0 && same_shape) {
+        return 0;  // Rereading the same region neither extends nor breaks a sweep
+    }
+    if (moved != 1 || !same_shape) {
+        tracker->steps = 0;
+        return 0;
     }
 
-    // Copy the slice data from the volume
-    for (int y = 0; y < region.y_height; y++) {
-        for (int x = 0; x < region.x_width; x++) {
-            slice[y * region.x_width + x] = volume[y * region.x_width + x];
-        }
+    int lead = direction > 0 ? (start[axis] + dims[axis] - 1) / chunk_dims[axis] : start[axis] / chunk_dims[axis];
+    if (tracker->steps > 0 && axis == tracker->axis && direction == tracker->direction) {
+        tracker->steps++;
+    } else {
+        tracker->axis = axis;
+        tracker->direction = direction;
+        tracker->steps = 1;
+        tracker->fetched = lead;
+    }
+    if (tracker->steps < SWEEP_MIN_STEPS || depth <= 0) {
+        return 0;
     }
 
-    free(volume);
-    return 0;
+    // Request only the layers between what was already requested and depth layers past the lead
+    int far = lead + direction * depth;
+    if ((far - tracker->fetched) * direction <= 0) {
+        return 0;
+    }
+    int from = tracker->fetched + direction;
+    if ((from - lead) * direction < 1) {
+        from = lead + direction;
+    }
+    tracker->fetched = far;
+
+    int lo = from < far ? from : far;
+    int hi = from < far ? far : from;
+    memcpy(ahead_start, start, 3 * sizeof(int));
+    memcpy(ahead_dims, dims, 3 * sizeof(int));
+    ahead_start[axis] = lo * chunk_dims[axis];
+    ahead_dims[axis] = (hi - lo + 1) * chunk_dims[axis];
+    return 1;
 }
 
-// BMP Header Structures
-#pragma pack(push, 1) // Ensure no padding
+static void *readahead_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&readahead.lock);
+    for (;;) {
+        while (!readahead.has_next && !readahead.shutdown) {
+            pthread_cond_wait(&readahead.cond, &readahead.lock);
+        }
+        if (readahead.shutdown) {
+            break;
+        }
+        RegionOfInterest region = readahead.next;
+        readahead.has_next = 0;
+        readahead.busy = 1;
+        pthread_mutex_unlock(&readahead.lock);
+
+        load_roi_chunks(region, NULL);
+
+        pthread_mutex_lock(&readahead.lock);
+        readahead.busy = 0;
+        pthread_cond_broadcast(&readahead.cond);
+    }
+    pthread_mutex_unlock(&readahead.lock);
+    return NULL;
+}
+
+// Record a slice read and, once the reads form a sweep, have the read-ahead thread load the chunks
+// the sweep will reach next
+static void readahead_after(RegionOfInterest region) {
+    int start[3] = {region.z_start, region.y_start, region.x_start};
+    int dims[3] = {region.z_depth, region.y_height, region.x_width};
+    int chunk_dims[3] = {CHUNK_SIZE_Z, CHUNK_SIZE_Y, CHUNK_SIZE_X};
+    int shape[3] = {SHAPE_Z, SHAPE_Y, SHAPE_X};
+    int ahead_start[3], ahead_dims[3];
+
+    pthread_mutex_lock(&readahead.lock);
+    if (!track_sweep(&readahead.sweep, start, dims, chunk_dims, READAHEAD_DEPTH, ahead_start, ahead_dims)) {
+        pthread_mutex_unlock(&readahead.lock);
+        return;
+    }
+
+    // Clip to the volume
+    for (int i = 0; i < 3; i++) {
+        int end = ahead_start[i] + ahead_dims[i];
+        ahead_start[i] = ahead_start[i] > 0 ? ahead_start[i] : 0;
+        ahead_dims[i] = (end < shape[i] ? end : shape[i]) - ahead_start[i];
+        if (ahead_dims[i] <= 0) {
+            pthread_mutex_unlock(&readahead.lock);
+            return;
+        }
+    }
+
+    if (readahead.shutdown) {
+        pthread_mutex_unlock(&readahead.lock);
+        return;
+    }
+    if (!readahead.started) {
+        if (pthread_create(&readahead.thread, NULL, readahead_worker, NULL) != 0) {
+            fprintf(stderr, "Failed to start read-ahead thread\n");
+            pthread_mutex_unlock(&readahead.lock);
+            return;
+        }
+        readahead.started = 1;
+    }
+    readahead.next = (RegionOfInterest){ahead_start[2], ahead_dims[2], ahead_start[1], ahead_dims[1], ahead_start[0], ahead_dims[0]};
+    readahead.has_next = 1;
+    pthread_cond_broadcast(&readahead.cond);
+    pthread_mutex_unlock(&readahead.lock);
+}
+
+// Drop any queued read-ahead and wait for the one in progress to finish
+static void stop_readahead(void) {
+    pthread_mutex_lock(&readahead.lock);
+    readahead.has_next = 0;
+    readahead.sweep.steps = 0;
+    while (readahead.busy) {
+        pthread_cond_wait(&readahead.cond, &readahead.lock);
+    }
+    pthread_mutex_unlock(&readahead.lock);
+}
+
+// Stop the read-ahead thread and wait for it to exit, letting the load in progress finish first.
+// Call it before tearing down curl or the cache, e.g. with curl_global_cleanup at the end of a program.
+// A later sweep starts the thread again
+void shutdown_readahead(void) {
+    pthread_mutex_lock(&readahead.lock);
+    if (!readahead.started || readahead.shutdown) {
+        pthread_mutex_unlock(&readahead.lock);
+        return;
+    }
+    readahead.shutdown = 1;
+    readahead.has_next = 0;
+    pthread_cond_broadcast(&readahead.cond);
+    pthread_mutex_unlock(&readahead.lock);
+
+    pthread_join(readahead.thread, NULL);
+
+    pthread_mutex_lock(&readahead.lock);
+    readahead.started = 0;
+    readahead.shutdown = 0;
+    readahead.has_next = 0;
+    readahead.sweep.steps = 0;
+    pthread_mutex_unlock(&readahead.lock);
+}
+
+int get_volume_slice(RegionOfInterest region, unsigned char *slice) {
+    // Validate boundaries
+    if (region.x_start < 0 || region.x_start + region.x_width > SHAPE_X ||
+        region.y_start < 0 || region.y_start + region.y_height > SHAPE_Y ||
+        region.z_start < 0 || region.z_start + region.z_depth > SHAPE_Z) {
+        fprintf(stderr, "Invalid boundaries for the volume\n");
+        return -1;
+    }
+
+    // Validate depth 1
+    if (region.z_depth != 1) {
+        fprintf(stderr, "Slice must have z_depth of 1\n");
+        return -1;
+    }
+
+    // Fetch the volume data for the slice
+    unsigned char *volume = (unsigned char *)malloc(region.x_width * region.y_height);
+    if (get_volume_roi(region, volume) != 0) {
+        fprintf(stderr, "Failed to fetch volume data for slice\n");
+        free(volume);
+        return -1;
+    }
+
+    // Start loading the chunks a sweep through the volume will need next
+    readahead_after(region);
+
+    // Copy the slice data from the volume
+    for (int y = 0; y < region.y_height; y++) {
+        for (int x = 0; x < region.x_width; x++) {
+            slice[y * region.x_width + x] = volume[y * region.x_width + x];
+        }
+    }
+
+    free(volume);
+    return 0;
+}
+
+// BMP Header Structures
+#pragma pack(push, 1) // Ensure no padding
 typedef struct {
     uint16_t bfType;
     uint32_t bfSize;
@@ -738,9 +2278,8 @@ int download_obj_file(const char *id, const char *cache_path) {
         return -1;
     }
 
-    curl = curl_easy_init();
+    curl = acquire_curl_handle(url);
     if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, url);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fwrite);
 
@@ -748,10 +2287,10 @@ int download_obj_file(const char *id, const char *cache_path) {
         if (res != CURLE_OK) {
             fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
             fclose(file);
-            curl_easy_cleanup(curl);
+            release_curl_handle(curl);
             return -1;
         }
-        curl_easy_cleanup(curl);
+        release_curl_handle(curl);
     }
     fclose(file);
     return 0;
@@ -964,12 +2503,20 @@ void reset_mesh_origin_to_roi(TriangleMesh *mesh, const RegionOfInterest *roi) {
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <dirent.h>
 
 #include <curl/curl.h>
 #include <blosc2.h>
 
 #if defined(__linux__) || defined(__GLIBC__)
 #include <execinfo.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
 #endif
 
 #ifdef NDEBUG
@@ -1027,11 +2574,41 @@ typedef struct chunk {
     float data[];
 } chunk __attribute__((aligned(16)));
 
+#define VS_GRAFT_MAX_THREADS 64  // most threads vs_chunk_graft_mt splits a region between
+#define VS_GRAFT_THREAD_VOXELS (1 << 20)  // fewest voxels worth handing to another vs_chunk_graft_mt thread
+
+#define VS_POOL_MIN_BYTES ((size_t)64 << 10)  // chunks up to this size are plain mallocs, larger ones come from the pool
+#define VS_POOL_MAX_BYTES ((size_t)1 << 30)  // largest pooled buffer
+#define VS_POOL_CLASSES (4 * 14)  // four size classes for every power of two between the two
+#define VS_POOL_DEFAULT_RETAIN ((size_t)256 << 20)  // bytes of freed buffers the pool keeps for reuse by default
+#define VS_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
 typedef struct slice {
     int dims[2];
     float data[];
 } slice __attribute__((aligned(16)));
 
+typedef enum vs_dtype {
+    VS_U8,
+    VS_U16,
+    VS_F32
+} vs_dtype;
+
+// how vs_zarr_build_pyramid reduces each 2x2x2 cube of voxels to one
+typedef enum vs_downsample {
+    VS_DOWNSAMPLE_MEAN,
+    VS_DOWNSAMPLE_MAX
+} vs_downsample;
+
+// a chunk that keeps its voxels in their stored dtype instead of widening them to float
+//   - a |u1 zarr block takes 1 byte per voxel instead of 4
+//   - data holds dims[0] * dims[1] * dims[2] voxels of vs_dtype_size(dtype) bytes
+typedef struct tchunk {
+    int dims[3];
+    vs_dtype dtype;
+    u8 data[];
+} tchunk __attribute__((aligned(16)));
+
 // meshes are triangle only. every 3 entries in vertices corresponds to a new vertex
 // normals are 3 component
 typedef struct {
@@ -1152,27 +2729,111 @@ typedef struct zarr_metadata {
     int32_t fill_value;
     char order; // Single character 'C' or 'F'
     int32_t zarr_format;
+    char separator; // between the indices in a chunk key, '/' if not set
+    bool key_prefix; // v3 default chunk keys start with "c", e.g. c/0/1/2
+    // v3 sharding_indexed: each object is a shard of shard_shape voxels holding many chunks, which is then the inner
+    // chunk shape. shard_shape is 0 for arrays that aren't sharded
+    int32_t shard_shape[3];
+    bool shard_index_at_start;
+    bool shard_index_crc; // the shard index is followed by a crc32c checksum
 } zarr_metadata;
 
+// store
+// A store holds the objects of a zarr by key, relative to the zarr's root: ".zarray", "0/1/2", "c/0/1/2", ...
+//     - vs_store_http_new reads from a url, vs_store_dir_new from a local directory such as a mirror on an NVMe
+//       drive, and vs_store_mem_new keeps the objects in memory
+//     - vs_store_open picks one of the first two from the form of the location
+//     - a volume reads its blocks from one store and keeps those it fetched in another, see vs_vol_new_store
+//     - every operation returns 0 on success, 1 if the key doesn't exist and -1 on any other failure
+//     - other backends plug in by filling in a vs_store_ops. stores must be safe to use from many threads at once
+typedef struct vs_store vs_store;
+
+typedef struct vs_store_ops {
+    // length bytes at offset, or the last length bytes if offset is negative. length <= 0 reads the whole object
+    int (*get)(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size);
+    int (*put)(vs_store *store, const char *key, const void *data, s64 size);
+    int (*exists)(vs_store *store, const char *key);
+    // every key starting with prefix, sorted. the caller frees the keys and the array
+    int (*list)(vs_store *store, const char *prefix, char ***keys, int *nkeys);
+    void (*free)(vs_store *store);
+} vs_store_ops;
+
+struct vs_store {
+    const vs_store_ops *ops;
+    char root[1024];  // url or directory of the store, empty for stores without one
+    void *impl;       // state of the backend
+};
+
 // vol
 // A volume is an entire scroll at a given pixel density
 //     - for Scroll 1 it is all 14376 x 7888 x 8096 voxels
 //         - for the 2x scaled down Scroll 1 you would need a separate volume
-//     - the dtype is uint8
+//     - the dtype is uint8 or uint16, little or big endian
 //     - wraps a zarr array
 //     - a volume takes a url and a local directory
 //         - the url and path should both contain the .zarray
 //             - "/path/to/my/zarr" would contain "/path/to/my/zarr/.zarray"
 //             - "https://example.com/path/to/my/zarr" would contain "https://example.com/path/to/my/zarr/.zarray"
+//         - zarr v3 arrays are opened from zarr.json instead
 //         - blocks are read from the cache if they exist, otherwise downloaded and written to disk
-
+//             - blocks the server doesn't have (404) are remembered in both caches and read as the fill_value without asking again
+//             - in a sharded zarr v3 array the blocks are the inner chunks. each shard's index is downloaded once,
+//               then only the byte ranges of the inner chunks that are read
+//         - vs_vol_new_store reads the zarr from any vs_store and caches blocks in another, or nowhere
+//     - decompressed blocks are kept as tchunks of the volume's dtype in an in-memory LRUCache shared by every thread reading the volume
+//         - vs_vol_get_tchunk returns regions in that dtype, vs_vol_get_chunk widens them to float
+//         - regions can start anywhere in the volume and have any size, the parts past its edges are 0
+//         - all vs_vol_* functions may be called concurrently on the same volume
+//     - vs_vol_prefetch queues blocks on a pool of background threads which fill both caches
+//         - reads that sweep along an axis are followed by a prefetch of the next block layers, see vs_vol_set_readahead
+
+#define VS_PREFETCH_THREADS 4
+
+// background block loader behind vs_vol_prefetch, the threads are started by the first prefetch
+typedef struct vs__prefetcher {
+    pthread_mutex_t lock;
+    pthread_cond_t work;  // signalled when blocks are queued or the threads should stop
+    pthread_cond_t idle;  // signalled when the queue is drained and no thread is loading blocks
+    s32 *queue;           // z, y, x of every queued block, entries head..count-1 are pending
+    int head;
+    int count;
+    int capacity;
+    int busy;
+    int nthreads;
+    bool stop;
+    pthread_t threads[VS_PREFETCH_THREADS];
+    SweepTracker sweep;   // follows vs_vol_get_chunk and vs_slice_fill reads for read-ahead
+    int readahead;        // block layers prefetched ahead of a sweep, 0 disables read-ahead
+} vs__prefetcher;
 
 typedef struct volume {
     char cache_dir [1024];
     char url [1024];
+    vs_store *store;        // the zarr, owned by the volume
+    vs_store *cache_store;  // where blocks read from store are kept, owned by the volume. NULL to keep none
     zarr_metadata metadata;
+    LRUCache *cache;
+    LRUCache *shard_index; // the downloaded index of every shard touched so far, NULL if the zarr isn't sharded
+    vs__prefetcher prefetch;
 } volume;
 
+#define VS_MAX_LEVELS 16
+
+// an OME-Zarr multiscale image, a group holding the same volume as one zarr array per resolution level
+//     - levels are listed from the finest, level 0, to the coarsest, as in the group's multiscales metadata
+//     - each level is opened as a volume the first time it is used and is owned by the multiscale
+//     - coordinates and voxel sizes passed to vs_multiscale_* functions are in level 0 voxels
+typedef struct multiscale {
+    bool disk_cache;                // false if the levels are opened without a disk cache
+    char cache_dir [1024];
+    char url [1024];
+    int nlevels;
+    char paths[VS_MAX_LEVELS][64];  // path of each level's array within the group
+    f32 scales[VS_MAX_LEVELS][3];   // voxel size of each level in z y x order, in the units of the metadata
+    volume *levels[VS_MAX_LEVELS];  // NULL until opened
+    pthread_mutex_t lock;           // guards opening levels
+} multiscale;
+
 
 typedef enum {
     LOG_INFO,
@@ -1195,16 +2856,24 @@ f32 vs_chamfer_distance(const f32* set1, s32 size1, const f32* set2, s32 size2);
 
 // curl
 long vs_download(const char* url, void** out_buffer);
+long vs_download_range(const char* url, s64 offset, s64 length, void** out_buffer);
 
 // histogram
 histogram *vs_histogram_new(s32 num_bins, f32 min_value, f32 max_value);
 void vs_histogram_free(histogram *hist);
 histogram* vs_slice_histogram(const f32* data, s32 dimy, s32 dimx, s32 num_bins);
 histogram* vs_chunk_histogram(const f32* data, s32 dimz, s32 dimy, s32 dimx, s32 num_bins);
+histogram* vs_tchunk_histogram(const tchunk *chunk, s32 num_bins);
 s32 vs_write_histogram_to_csv(const histogram *hist, const char *filename);
 hist_stats vs_calculate_histogram_stats(const histogram *hist);
 
 // math
+void vs_pool_set_max_bytes(size_t max_bytes);
+void vs_pool_set_huge_pages(bool enabled);
+void vs_pool_scope_begin(void);
+void vs_pool_scope_end(void);
+void vs_pool_trim(void);
+size_t vs_pool_bytes(void);
 chunk *vs_chunk_new(int dims[static 3]);
 void vs_chunk_free(chunk *chunk);
 slice *vs_slice_new(int dims[static 2]);
@@ -1213,9 +2882,21 @@ f32 vs_slice_get(slice *slice, s32 y, s32 x);
 void vs_slice_set(slice *slice, s32 y, s32 x, f32 data);
 f32 vs_chunk_get(chunk *chunk, s32 z, s32 y, s32 x);
 void vs_chunk_set(chunk *chunk, s32 z, s32 y, s32 x, f32 data);
+int vs_chunk_graft(chunk* dest, chunk* src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3]);
+int vs_chunk_graft_mt(chunk* dest, chunk* src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3], int nthreads);
 chunk* vs_maxpool(chunk* inchunk, s32 kernel, s32 stride);
 chunk *vs_avgpool(chunk *inchunk, s32 kernel, s32 stride);
 chunk *vs_sumpool(chunk *inchunk, s32 kernel, s32 stride);
+s32 vs_dtype_size(vs_dtype dtype);
+tchunk *vs_tchunk_new(int dims[static 3], vs_dtype dtype);
+void vs_tchunk_free(tchunk *chunk);
+f32 vs_tchunk_get(tchunk *chunk, s32 z, s32 y, s32 x);
+void vs_tchunk_set(tchunk *chunk, s32 z, s32 y, s32 x, f32 data);
+chunk *vs_tchunk_to_chunk(tchunk *chunk);
+tchunk *vs_chunk_to_tchunk(chunk *chunk, vs_dtype dtype);
+int vs_tchunk_graft(tchunk *dest, tchunk *src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3]);
+tchunk *vs_tchunk_maxpool(tchunk *inchunk, s32 kernel, s32 stride);
+tchunk *vs_tchunk_avgpool(tchunk *inchunk, s32 kernel, s32 stride);
 chunk* vs_unsharp_mask_3d(chunk* input, float amount, s32 kernel_size);
 chunk* vs_normalize_chunk(chunk* input);
 chunk* vs_transpose(chunk* input, const char* current_layout);
@@ -1296,24 +2977,56 @@ int vs_vcps_write(const char* filename,
                size_t width, size_t height, size_t dim,
                const void* data, const char* src_type, const char* dst_type);
 
+// store
+vs_store *vs_store_http_new(const char *url);
+vs_store *vs_store_dir_new(const char *path);
+vs_store *vs_store_mem_new(void);
+vs_store *vs_store_open(const char *location);
+void vs_store_free(vs_store *store);
+int vs_store_get(vs_store *store, const char *key, void **data, s64 *size);
+int vs_store_get_range(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size);
+int vs_store_put(vs_store *store, const char *key, const void *data, s64 size);
+int vs_store_exists(vs_store *store, const char *key);
+int vs_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys);
+
 // volume
 volume* vs_vol_new(char* cache_dir, char* url);
+volume* vs_vol_new_store(vs_store* store, vs_store* cache_store);
 void vs_vol_free(volume* vol);
+void vs_vol_set_cache_size(volume* vol, size_t max_bytes);
 chunk* vs_vol_get_chunk(volume* vol, s32 chunk_pos[static 3], s32 chunk_dims[static 3]);
+tchunk* vs_vol_get_tchunk(volume* vol, s32 chunk_pos[static 3], s32 chunk_dims[static 3]);
+int vs_vol_prefetch(volume* vol, s32 start[static 3], s32 dims[static 3]);
+void vs_vol_prefetch_wait(volume* vol);
+void vs_vol_set_readahead(volume* vol, int depth);
+
+// multiscale
+multiscale* vs_multiscale_new(char* cache_dir, char* url);
+void vs_multiscale_free(multiscale* ms);
+volume* vs_multiscale_level(multiscale* ms, int level);
+s32 vs_multiscale_factor(multiscale* ms, int level, int axis);
+int vs_multiscale_pick_level(multiscale* ms, f32 voxel_size);
+chunk* vs_multiscale_get_chunk(multiscale* ms, s32 start[static 3], s32 dims[static 3], f32 voxel_size, int* level);
 
 // zarr
 zarr_metadata vs_zarr_parse_zarray(char *path);
 chunk* vs_zarr_read_chunk(char* path, zarr_metadata metadata);
+tchunk* vs_zarr_read_tchunk(char* path, zarr_metadata metadata);
 int vs_zarr_compress_chunk(chunk* c, zarr_metadata metadata, void** compressed_data);
+int vs_zarr_compress_tchunk(tchunk* c, zarr_metadata metadata, void** compressed_data);
 chunk* vs_zarr_decompress_chunk(long size, void* compressed_data, zarr_metadata metadata);
+tchunk* vs_zarr_decompress_tchunk(long size, void* compressed_data, zarr_metadata metadata);
 int vs_zarr_parse_metadata(const char *json_string, zarr_metadata *metadata);
+int vs_zarr_parse_multiscales(const char *json_string, multiscale *ms);
 chunk* vs_zarr_fetch_block(char* url, zarr_metadata metadata);
 int vs_zarr_write_chunk(char *path, zarr_metadata metadata, chunk* c);
+int vs_zarr_write_block(char *path, void* compressed_data, long size);
+int vs_zarr_build_pyramid(const char *path, int nlevels, vs_downsample mode, int nthreads);
 
 // vesuvius specific
 chunk *vs_tiff_to_chunk(const char *tiffpath);
 slice *vs_tiff_to_slice(const char *tiffpath, int index);
-int vs_slice_fill(slice *slice, volume *vol, int start[static 2], int axis);
+int vs_slice_fill(slice *slice, volume *vol, int start[static 3], int axis);
 int vs_chunk_fill(chunk *chunk, volume *vol, int start[static 3]);
 
 #ifdef VESUVIUS_IMPL
@@ -1327,6 +3040,7 @@ static void vs__skip_line(FILE *fp);
 static bool vs__str_starts_with(const char* str, const char* prefix);
 static int vs__mkdir_p(const char* path);
 static bool vs__path_exists(const char *path);
+static int vs__write_file_atomic(const char *path, const void *data, size_t len);
 static void vs__print_backtrace(void);
 static void vs__print_assert_details(const char* expr, const char* file, int line, const char* func);
 static void vs__assert_fail_with_backtrace(const char* expr, const char* file, int line, const char* func);
@@ -1340,6 +3054,7 @@ static f32 vs__min_distance_to_set(const f32* point, const f32* point_set, s32 s
 
 //curl
 static size_t vs__write_callback(void *contents, size_t size, size_t nmemb, void *userp);
+static long vs__download(const char* url, s64 offset, s64 length, void** out_buffer, long *http_code);
 
 //histogram
 static s32 vs__get_bin_index(const histogram* hist, f32 value);
@@ -1352,6 +3067,14 @@ static float vs__minfloat(float a, float b);
 static float vs__avgfloat(float *data, int len);
 static chunk *vs__create_box_kernel(s32 size);
 static chunk* vs__convolve3d(chunk* input, chunk* kernel);
+static void vs__convert(void *dst, vs_dtype dst_dtype, const void *src, vs_dtype src_dtype, s64 count);
+static void vs__pick_convert_kernels(void);
+static void vs__bswap16(u16 *data, s64 count);
+static void *vs__graft_rows(void *arg);
+static int vs__pool_class(size_t size, size_t *class_size);
+static void *vs__pool_alloc(size_t size);
+static void vs__pool_free(void *buf, size_t size);
+static void vs__pool_shrink(size_t max_bytes);
 
 // mesh
 static void vs__interpolate_vertex(f32 isovalue,
@@ -1397,8 +3120,60 @@ static uint32_t vs__tiff_write_ifd_entry(FILE* fp, uint16_t tag, uint16_t type,
 static int vs__vcps_read_binary_data(FILE* fp, void* out_data, const char* src_type, const char* dst_type, size_t count);
 static int vs__vcps_write_binary_data(FILE* fp, const void* data, const char* src_type, const char* dst_type, size_t count);
 
+//store
+static int vs__store_get_text(vs_store *store, const char *key, char **text);
+static int vs__store_add_key(char ***keys, int *nkeys, int *capacity, const char *key);
+static int vs__store_compare_keys(const void *a, const void *b);
+static int vs__http_store_get(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size);
+static int vs__http_store_put(vs_store *store, const char *key, const void *data, s64 size);
+static int vs__http_store_exists(vs_store *store, const char *key);
+static int vs__http_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys);
+static int vs__dir_store_get(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size);
+static int vs__dir_store_put(vs_store *store, const char *key, const void *data, s64 size);
+static int vs__dir_store_exists(vs_store *store, const char *key);
+static int vs__dir_store_walk(const char *root, const char *dir, const char *prefix, char ***keys, int *nkeys, int *capacity);
+static int vs__dir_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys);
+static int vs__mem_store_get(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size);
+static int vs__mem_store_put(vs_store *store, const char *key, const void *data, s64 size);
+static int vs__mem_store_exists(vs_store *store, const char *key);
+static int vs__mem_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys);
+static void vs__mem_store_free(vs_store *store);
+
+//vol
+static int vs__vol_read_block(volume *vol, s32 z, s32 y, s32 x, tchunk **out);
+static int vs__vol_read_block_into(volume *vol, s32 z, s32 y, s32 x, void *dest);
+static int vs__vol_write_block(volume *vol, s32 z, s32 y, s32 x, void *compressed_data, long size);
+static tchunk *vs__vol_missing_block(void);
+static int vs__vol_write_missing(volume *vol, s32 z, s32 y, s32 x);
+static LRUNode *vs__vol_cache_block(volume *vol, s32 z, s32 y, s32 x, tchunk *c);
+static void vs__vol_cache_block_copy(volume *vol, s32 z, s32 y, s32 x, const void *voxels);
+static int vs__vol_get_block(volume *vol, s32 z, s32 y, s32 x, LRUNode **out);
+static void vs__vol_graft_block(volume *vol, void *dest, vs_dtype dest_dtype, s32 vol_start[static 3], s32 chunk_dims[static 3], s32 z, s32 y, s32 x, tchunk *block);
+static void *vs__vol_block_dest(volume *vol, void *dest, vs_dtype dest_dtype, s32 vol_start[static 3], s32 chunk_dims[static 3], s32 z, s32 y, s32 x);
+static void vs__vol_block_downloaded(int index, MemoryChunk *body, long http_code, void *userdata);
+static int vs__vol_fetch_blocks(volume *vol, s32 *blocks, int nblocks, void *dest, vs_dtype dest_dtype, s32 vol_start[static 3], s32 chunk_dims[static 3]);
+static int vs__vol_read_region(volume *vol, s32 vol_start[static 3], s32 chunk_dims[static 3], void *dest, vs_dtype dest_dtype);
+static void vs__vol_object_key(volume *vol, s32 z, s32 y, s32 x, char *key, size_t size);
+static void vs__vol_fetch_objects(volume *vol, char **keys, s64 *ranges, int count, download_callback on_done, void *userdata);
+static LRUNode *vs__vol_get_shard_index(volume *vol, s32 z, s32 y, s32 x);
+static int vs__vol_shard_range(volume *vol, s32 z, s32 y, s32 x, s64 *offset, s64 *length);
+static void *vs__vol_prefetch_worker(void *arg);
+static s32 *vs__vol_blocks_in(volume *vol, s32 start[static 3], s32 dims[static 3], int *nblocks);
+static void vs__vol_readahead(volume *vol, s32 start[static 3], s32 dims[static 3]);
+
 //zarr
 static void vs__json_parse_int32_array(json_object *array_obj, int32_t output[3]);
+static int vs__zarr_dtype(const zarr_metadata *metadata, vs_dtype *dtype, bool *swap);
+static u8 *vs__zarr_read_file(const char *path, long *size);
+static int vs__zarr_decompress_into(long size, void *compressed_data, const zarr_metadata *metadata, void *dest);
+static int vs__zarr_parse_v3(json_object *root, zarr_metadata *metadata);
+static int vs__zarr_parse_v3_codecs(json_object *codecs, zarr_metadata *metadata, bool *big_endian);
+static bool vs__zarr_parse_scale(json_object *transforms, f32 scale[3]);
+static void vs__zarr_block_path(const char *array_dir, const zarr_metadata *metadata, s32 z, s32 y, s32 x, char *path, size_t size);
+static int vs__zarr_write_zarray(const char *array_dir, const zarr_metadata *metadata);
+static void vs__pad_edge_block(tchunk *c, s32 valid[static 3]);
+static void vs__downsample_block(tchunk *out, s32 offset[static 3], tchunk *in, vs_downsample mode);
+static void *vs__pyramid_worker(void *arg);
 static void vs__log_msg(vs__log_level_e level, const char* file, const char* func, int line, const char* fmt, ...) {
 
     static const char* level_strings[] = {
@@ -1410,7 +3185,8 @@ static void vs__log_msg(vs__log_level_e level, const char* file, const char* fun
 
     time_t now;
     time(&now);
-    char* date = ctime(&now);
+    char date[32];
+    ctime_r(&now, date);
     date[strlen(date) - 1] = '\0'; // Remove newline
 
     fprintf(stderr, "%s [%s] %s:%s:%d: ", date, level_strings[level], file, func, line);
@@ -1501,6 +3277,28 @@ static bool vs__path_exists(const char *path) {
     return access(path, F_OK) == 0 ? true : false;
 }
 
+// writes to a temporary file next to path and renames it into place, so that concurrent readers
+// never observe a partially written file
+static int vs__write_file_atomic(const char *path, const void *data, size_t len) {
+    char tmppath[1100];
+    snprintf(tmppath, sizeof(tmppath), "%s.%ld.%lx.tmp", path, (long)getpid(), (unsigned long)pthread_self());
+
+    FILE *fp = fopen(tmppath, "wb");
+    if (fp == NULL) {
+        return 1;
+    }
+    if (fwrite(data, 1, len, fp) != len) {
+        fclose(fp);
+        remove(tmppath);
+        return 1;
+    }
+    if (fclose(fp) != 0 || rename(tmppath, path) != 0) {
+        remove(tmppath);
+        return 1;
+    }
+    return 0;
+}
+
 static char* vs__basename(const char* path) {
     if (path == NULL) {
         return NULL;
@@ -1682,9 +3480,20 @@ static size_t vs__write_callback(void *contents, size_t size, size_t nmemb, void
 }
 
 long vs_download(const char* url, void** out_buffer) {
+    return vs_download_range(url, 0, 0, out_buffer);
+}
+
+// downloads length bytes at offset, or the last length bytes if offset is negative. length <= 0 downloads everything
+long vs_download_range(const char* url, s64 offset, s64 length, void** out_buffer) {
+    long http_code = 0;
+    return vs__download(url, offset, length, out_buffer, &http_code);
+}
+
+// http_code is 0 if no response was received
+static long vs__download(const char* url, s64 offset, s64 length, void** out_buffer, long *http_code) {
     CURL* curl;
     CURLcode res;
-    long http_code = 0;
+    *http_code = 0;
 
     DownloadBuffer chunk = {
         .buffer = malloc(1),
@@ -1696,17 +3505,20 @@ long vs_download(const char* url, void** out_buffer) {
     }
     chunk.buffer[0] = 0;  // Ensure null terminated
 
-    curl = curl_easy_init();
+    // pooled handles keep their connection to the server alive between downloads
+    curl = acquire_curl_handle(url);
     if (!curl) {
         free(chunk.buffer);
         return -1;
     }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, vs__write_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+    if (length > 0) {
+        char range[64];
+        format_range(range, sizeof(range), offset, length);
+        curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    }
 
     //TODO: with bearssl on windows I have to disable these
     // does that matter?
@@ -1718,20 +3530,28 @@ long vs_download(const char* url, void** out_buffer) {
     if (res != CURLE_OK) {
         LOG_ERROR("curl_easy_perform() failed: %s", curl_easy_strerror(res));
         free(chunk.buffer);
-        curl_easy_cleanup(curl);
+        release_curl_handle(curl);
         return -1;
     }
 
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    curl_easy_cleanup(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+    release_curl_handle(curl);
 
-    if (http_code != 200) {
+    if (*http_code != 200 && !(*http_code == 206 && length > 0)) {
         free(chunk.buffer);
         return -1;
     }
+    MemoryChunk body = {.data = (unsigned char *)chunk.buffer, .size = chunk.size};
+    if (*http_code == 200 && length > 0) {
+        cut_range(&body, offset, length);
+        if (body.data == NULL) {
+            LOG_ERROR("%s is too short for the requested range", url);
+            return -1;
+        }
+    }
 
-    *out_buffer = chunk.buffer;
-    return chunk.size;
+    *out_buffer = body.data;
+    return body.size;
 }
 
 
@@ -1833,6 +3653,49 @@ histogram* vs_chunk_histogram(const f32* data,
     return hist;
 }
 
+// integer voxels are counted per value first, so the binning below runs once per distinct value, not per voxel
+histogram* vs_tchunk_histogram(const tchunk *chunk, s32 num_bins) {
+    if (!chunk || num_bins <= 0) {
+        return NULL;
+    }
+    if (chunk->dtype == VS_F32) {
+        return vs_chunk_histogram((const f32 *)chunk->data, chunk->dims[0], chunk->dims[1], chunk->dims[2], num_bins);
+    }
+
+    s64 total_voxels = (s64)chunk->dims[0] * chunk->dims[1] * chunk->dims[2];
+    s32 num_values = chunk->dtype == VS_U8 ? 256 : 65536;
+    u32 *counts = calloc(num_values, sizeof(u32));
+    if (!counts) {
+        return NULL;
+    }
+    if (chunk->dtype == VS_U8) {
+        const u8 *data = chunk->data;
+        for (s64 i = 0; i < total_voxels; i++) counts[data[i]]++;
+    } else {
+        const u16 *data = (const u16 *)chunk->data;
+        for (s64 i = 0; i < total_voxels; i++) counts[data[i]]++;
+    }
+
+    s32 min_val = 0;
+    s32 max_val = num_values - 1;
+    while (min_val < max_val && counts[min_val] == 0) min_val++;
+    while (max_val > min_val && counts[max_val] == 0) max_val--;
+
+    histogram* hist = vs_histogram_new(num_bins, (f32)min_val, (f32)max_val);
+    if (!hist) {
+        free(counts);
+        return NULL;
+    }
+
+    for (s32 v = min_val; v <= max_val; v++) {
+        if (counts[v]) {
+            hist->bins[vs__get_bin_index(hist, (f32)v)] += counts[v];
+        }
+    }
+    free(counts);
+    return hist;
+}
+
 static f32 vs__get_slice_value(const f32* data, s32 y, s32 x, s32 dimx) {
     return data[y * dimx + x];
 }
@@ -1923,8 +3786,162 @@ static float vs__avgfloat(float *data, int len) {
   return sum / len;
 }
 
+// chunks, slices and tchunks are allocated from a pool of size classed buffers
+//   - freed buffers are kept for the next allocation of the same class instead of going back to the OS, up to
+//     vs_pool_set_max_bytes of them. between vs_pool_scope_begin and vs_pool_scope_end all of them are kept
+//   - the buffers are plain mallocs, so a chunk handed to free() instead of vs_chunk_free is simply not reused
+typedef struct {
+  pthread_mutex_t lock;
+  void *free[VS_POOL_CLASSES];  // free buffers of every class, each one starts with a pointer to the next
+  size_t bytes;  // total size of the free buffers
+  size_t max_bytes;
+  int scopes;  // vs_pool_scope_begin calls not ended yet
+  bool huge_pages;
+} vs__buffer_pool;
+
+static vs__buffer_pool vs__pool = {PTHREAD_MUTEX_INITIALIZER, {NULL}, 0, VS_POOL_DEFAULT_RETAIN, 0, false};
+
+// the class of a buffer of size bytes and the size of the buffers in that class, -1 if it isn't pooled
+//   - classes are a quarter of a power of two apart, so a buffer is at most 25% larger than asked for
+static int vs__pool_class(size_t size, size_t *class_size) {
+  if (size <= VS_POOL_MIN_BYTES || size > VS_POOL_MAX_BYTES) {
+    return -1;
+  }
+  int bits = 63 - __builtin_clzll((unsigned long long)(size - 1));  // 2^bits < size <= 2^(bits + 1)
+  size_t base = (size_t)1 << bits;
+  size_t step = base / 4;
+  size_t quarters = (size - base + step - 1) / step;
+  *class_size = base + quarters * step;
+  return (bits - 16) * 4 + (int)quarters - 1;
+}
+
+static void *vs__pool_alloc(size_t size) {
+  size_t class_size;
+  int c = vs__pool_class(size, &class_size);
+  if (c < 0) {
+    return malloc(size);
+  }
+
+  pthread_mutex_lock(&vs__pool.lock);
+  void *ret = vs__pool.free[c];
+  if (ret != NULL) {
+    vs__pool.free[c] = *(void **)ret;
+    vs__pool.bytes -= class_size;
+  }
+  bool huge_pages = vs__pool.huge_pages;
+  pthread_mutex_unlock(&vs__pool.lock);
+  if (ret != NULL) {
+    return ret;
+  }
+
+#ifdef MADV_HUGEPAGE
+  // huge page aligned, so the kernel can back the whole buffer with 2 MiB pages
+  if (huge_pages && class_size >= VS_HUGE_PAGE_SIZE && posix_memalign(&ret, VS_HUGE_PAGE_SIZE, class_size) == 0) {
+    madvise(ret, class_size, MADV_HUGEPAGE);
+    return ret;
+  }
+#else
+  (void)huge_pages;
+#endif
+  return malloc(class_size);
+}
+
+// size has to be the size buf was allocated with
+static void vs__pool_free(void *buf, size_t size) {
+  size_t class_size;
+  int c = buf ? vs__pool_class(size, &class_size) : -1;
+  if (c < 0) {
+    free(buf);
+    return;
+  }
+
+  pthread_mutex_lock(&vs__pool.lock);
+  if (vs__pool.scopes > 0 || vs__pool.bytes + class_size <= vs__pool.max_bytes) {
+    *(void **)buf = vs__pool.free[c];
+    vs__pool.free[c] = buf;
+    vs__pool.bytes += class_size;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&vs__pool.lock);
+  free(buf);
+}
+
+// frees pooled buffers, the largest first, until at most max_bytes are left
+static void vs__pool_shrink(size_t max_bytes) {
+  void *released = NULL;
+  pthread_mutex_lock(&vs__pool.lock);
+  for (int c = VS_POOL_CLASSES - 1; c >= 0 && vs__pool.bytes > max_bytes; c--) {
+    size_t base = (size_t)1 << (c / 4 + 16);
+    size_t class_size = base + (size_t)(c % 4 + 1) * (base / 4);
+    while (vs__pool.free[c] != NULL && vs__pool.bytes > max_bytes) {
+      void *buf = vs__pool.free[c];
+      vs__pool.free[c] = *(void **)buf;
+      vs__pool.bytes -= class_size;
+      *(void **)buf = released;
+      released = buf;
+    }
+  }
+  pthread_mutex_unlock(&vs__pool.lock);
+
+  while (released != NULL) {
+    void *next = *(void **)released;
+    free(released);
+    released = next;
+  }
+}
+
+// sets how many bytes of freed buffers the pool keeps outside of a scope. 0 turns pooling off
+void vs_pool_set_max_bytes(size_t max_bytes) {
+  pthread_mutex_lock(&vs__pool.lock);
+  vs__pool.max_bytes = max_bytes;
+  int scopes = vs__pool.scopes;
+  pthread_mutex_unlock(&vs__pool.lock);
+  if (scopes == 0) {
+    vs__pool_shrink(max_bytes);
+  }
+}
+
+// backs new buffers of 2 MiB and more with transparent huge pages where the OS has them
+void vs_pool_set_huge_pages(bool enabled) {
+  pthread_mutex_lock(&vs__pool.lock);
+  vs__pool.huge_pages = enabled;
+  pthread_mutex_unlock(&vs__pool.lock);
+}
+
+// from here to the matching vs_pool_scope_end every freed buffer is kept, whatever vs_pool_set_max_bytes says,
+// so a pipeline step that keeps allocating and freeing transient chunks only asks the OS for memory once
+//   - scopes nest and may be opened by several threads. the last one to end shrinks the pool back
+void vs_pool_scope_begin(void) {
+  pthread_mutex_lock(&vs__pool.lock);
+  vs__pool.scopes++;
+  pthread_mutex_unlock(&vs__pool.lock);
+}
+
+void vs_pool_scope_end(void) {
+  pthread_mutex_lock(&vs__pool.lock);
+  int last = vs__pool.scopes > 0 && --vs__pool.scopes == 0;
+  size_t max_bytes = vs__pool.max_bytes;
+  pthread_mutex_unlock(&vs__pool.lock);
+  if (last) {
+    vs__pool_shrink(max_bytes);
+  }
+}
+
+// gives every buffer the pool holds back to the OS
+void vs_pool_trim(void) {
+  vs__pool_shrink(0);
+}
+
+// bytes held in freed buffers waiting to be reused
+size_t vs_pool_bytes(void) {
+  pthread_mutex_lock(&vs__pool.lock);
+  size_t ret = vs__pool.bytes;
+  pthread_mutex_unlock(&vs__pool.lock);
+  return ret;
+}
+
 chunk *vs_chunk_new(int dims[static 3]) {
-  chunk *ret = malloc(sizeof(chunk) + dims[0] * dims[1] * dims[2] * sizeof(float));
+  chunk *ret = vs__pool_alloc(sizeof(chunk) + (size_t)dims[0] * dims[1] * dims[2] * sizeof(float));
 
   if (ret == NULL) {
     return NULL;
@@ -1937,11 +3954,13 @@ chunk *vs_chunk_new(int dims[static 3]) {
 }
 
 void vs_chunk_free(chunk *chunk) {
-  free(chunk);
+  if (chunk) {
+    vs__pool_free(chunk, sizeof(struct chunk) + (size_t)chunk->dims[0] * chunk->dims[1] * chunk->dims[2] * sizeof(float));
+  }
 }
 
 slice *vs_slice_new(int dims[static 2]) {
-  slice *ret = malloc(sizeof(slice) + dims[0] * dims[1] * sizeof(float));
+  slice *ret = vs__pool_alloc(sizeof(slice) + (size_t)dims[0] * dims[1] * sizeof(float));
 
   if (ret == NULL) {
     return NULL;
@@ -1954,7 +3973,9 @@ slice *vs_slice_new(int dims[static 2]) {
 }
 
 void vs_slice_free(slice *slice) {
-  free(slice);
+  if (slice) {
+    vs__pool_free(slice, sizeof(struct slice) + (size_t)slice->dims[0] * slice->dims[1] * sizeof(float));
+  }
 }
 
 f32 vs_slice_get(slice *slice, s32 y, s32 x) {
@@ -1973,105 +3994,615 @@ void vs_chunk_set(chunk *chunk, s32 z, s32 y, s32 x, f32 data) {
   chunk->data[z * chunk->dims[1] * chunk->dims[2] + y * chunk->dims[2] + x] = data;
 }
 
-int vs_chunk_graft(chunk* dest, chunk* src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3]) {
-  if (!dest || !src || !src_start || !dest_start || !dims) {
-      LOG_ERROR("a param is NULL");
-    return -1;
+s32 vs_dtype_size(vs_dtype dtype) {
+  switch (dtype) {
+    case VS_U8: return sizeof(u8);
+    case VS_U16: return sizeof(u16);
+    case VS_F32: return sizeof(f32);
   }
+  return 0;
+}
 
-  for (int i = 0; i < 3; i++) {
-    if (dims[i] <= 0) {
-        LOG_ERROR("a dimension is <= 0");
-      return -1;
-    }
-  }
+tchunk *vs_tchunk_new(int dims[static 3], vs_dtype dtype) {
+  tchunk *ret = vs__pool_alloc(sizeof(tchunk) + (size_t)dims[0] * dims[1] * dims[2] * vs_dtype_size(dtype));
 
-  for (int i = 0; i < 3; i++) {
-    if (src_start[i] < 0 ||
-        src_start[i] + dims[i] > src->dims[i]) {
-        LOG_ERROR("out of bounds src dimension");
-      return -1;
-        }
+  if (ret == NULL) {
+    return NULL;
   }
 
   for (int i = 0; i < 3; i++) {
-    if (dest_start[i] < 0 ||
-        dest_start[i] + dims[i] > dest->dims[i]) {
-        LOG_ERROR("out of bounds dest dimension");
-      return -1;
-        }
+    ret->dims[i] = dims[i];
   }
+  ret->dtype = dtype;
+  return ret;
+}
 
-  for (int z = 0; z < dims[0]; z++) {
-    for (int y = 0; y < dims[1]; y++) {
-      for (int x = 0; x < dims[2]; x++) {
-        f32 value = vs_chunk_get(src, src_start[0] + z, src_start[1] + y, src_start[2] + x);
-        vs_chunk_set(dest, dest_start[0] + z, dest_start[1] + y, dest_start[2] + x, value);
-      }
-    }
+void vs_tchunk_free(tchunk *chunk) {
+  if (chunk) {
+    vs__pool_free(chunk, sizeof(tchunk) + (size_t)chunk->dims[0] * chunk->dims[1] * chunk->dims[2] * vs_dtype_size(chunk->dtype));
   }
-  return 0;
 }
 
+f32 vs_tchunk_get(tchunk *chunk, s32 z, s32 y, s32 x) {
+  s64 i = ((s64)z * chunk->dims[1] + y) * chunk->dims[2] + x;
+  f32 ret;
+  vs__convert(&ret, VS_F32, chunk->data + i * vs_dtype_size(chunk->dtype), chunk->dtype, 1);
+  return ret;
+}
 
-chunk* vs_maxpool(chunk* inchunk, s32 kernel, s32 stride) {
-  s32 dims[3] = {
-    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
-    (inchunk->dims[2] + stride - 1) / stride
-  };
-  chunk *ret = vs_chunk_new(dims);
-  for (s32 z = 0; z < ret->dims[0]; z++)
-    for (s32 y = 0; y < ret->dims[1]; y++)
-      for (s32 x = 0; x < ret->dims[2]; x++) {
-        f32 max32 = -INFINITY;
-        f32 val32;
-        for (s32 zi = 0; zi < kernel; zi++)
-          for (s32 yi = 0; yi < kernel; yi++)
-            for (s32 xi = 0; xi < kernel; xi++) {
-              if (z + zi > inchunk->dims[0] || y + yi > inchunk->dims[1] || x + xi > inchunk->dims[2]) { continue; }
+void vs_tchunk_set(tchunk *chunk, s32 z, s32 y, s32 x, f32 data) {
+  s64 i = ((s64)z * chunk->dims[1] + y) * chunk->dims[2] + x;
+  vs__convert(chunk->data + i * vs_dtype_size(chunk->dtype), chunk->dtype, &data, VS_F32, 1);
+}
 
-              if ((val32 = vs_chunk_get(inchunk, z * stride + zi, y * stride + yi,
-                                                                       x * stride + xi)) > max32) { max32 = val32; }
-            }
-        vs_chunk_set(ret, z, y, x, max32);
-      }
+chunk *vs_tchunk_to_chunk(tchunk *chunk) {
+  struct chunk *ret = vs_chunk_new(chunk->dims);
+  if (ret == NULL) {
+    return NULL;
+  }
+  vs__convert(ret->data, VS_F32, chunk->data, chunk->dtype, (s64)chunk->dims[0] * chunk->dims[1] * chunk->dims[2]);
   return ret;
 }
 
-chunk *vs_avgpool(chunk *inchunk, s32 kernel, s32 stride) {
-  s32 dims[3] = {
-    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
-    (inchunk->dims[2] + stride - 1) / stride
-  };
-  chunk *ret = vs_chunk_new(dims);
-  s32 len = kernel * kernel * kernel;
-  s32 i = 0;
-  f32 *data = malloc(len * sizeof(f32));
-  for (s32 z = 0; z < ret->dims[0]; z++)
-    for (s32 y = 0; y < ret->dims[1]; y++)
-      for (s32 x = 0; x < ret->dims[2]; x++) {
-        len = kernel * kernel * kernel;
-        i = 0;
-        for (s32 zi = 0; zi < kernel; zi++)
-          for (s32 yi = 0; yi < kernel; yi++)
-            for (s32 xi = 0; xi < kernel; xi++) {
-              if (z + zi > inchunk->dims[0] || y + yi > inchunk->dims[1] || x + xi > inchunk->dims[2]) {
-                len--;
-                continue;
-              }
-              data[i++] = vs_chunk_get(inchunk, z * stride + zi, y * stride + yi, x * stride + xi);
-            }
-        vs_chunk_set(ret, z, y, x, vs__avgfloat(data, len));
-      }
+// floats are clamped to the range of an integer dtype and truncated
+tchunk *vs_chunk_to_tchunk(chunk *chunk, vs_dtype dtype) {
+  tchunk *ret = vs_tchunk_new(chunk->dims, dtype);
+  if (ret == NULL) {
+    return NULL;
+  }
+  vs__convert(ret->data, dtype, chunk->data, VS_F32, (s64)chunk->dims[0] * chunk->dims[1] * chunk->dims[2]);
   return ret;
 }
 
-chunk *vs_sumpool(chunk *inchunk, s32 kernel, s32 stride) {
-  s32 dims[3] = {
-    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
-    (inchunk->dims[2] + stride - 1) / stride
-  };
-  chunk *ret = vs_chunk_new(dims);
+// the u8/u16 <-> f32 conversion kernels used by vs__convert, see vs__pick_convert_kernels
+//   - also the u8 2x downsampling kernels of vs_zarr_build_pyramid. they turn the 2 * count voxels of 4 rows,
+//     the 2x2 rows of a 2x2x2 cube, into count voxels
+typedef struct vs__convert_kernel_set {
+  const char *name;
+  void (*u8_to_f32)(f32 *out, const u8 *in, s64 count);
+  void (*f32_to_u8)(u8 *out, const f32 *in, s64 count);
+  void (*u16_to_f32)(f32 *out, const u16 *in, s64 count);
+  void (*f32_to_u16)(u16 *out, const f32 *in, s64 count);
+  void (*u8_pool2_mean)(u8 *out, const u8 *const rows[4], s64 count);
+  void (*u8_pool2_max)(u8 *out, const u8 *const rows[4], s64 count);
+} vs__convert_kernel_set;
+
+static vs__convert_kernel_set vs__convert_kernels;
+static pthread_once_t vs__convert_kernels_once = PTHREAD_ONCE_INIT;
+
+// converts count contiguous voxels, floats are clamped to the range of integer dtypes and truncated like a cast
+static void vs__convert(void *dst, vs_dtype dst_dtype, const void *src, vs_dtype src_dtype, s64 count) {
+  if (dst_dtype == src_dtype) {
+    memcpy(dst, src, count * vs_dtype_size(dst_dtype));
+    return;
+  }
+  pthread_once(&vs__convert_kernels_once, vs__pick_convert_kernels);
+  switch (dst_dtype) {
+    case VS_F32: {
+      if (src_dtype == VS_U8) {
+        vs__convert_kernels.u8_to_f32(dst, src, count);
+      } else {
+        vs__convert_kernels.u16_to_f32(dst, src, count);
+      }
+      break;
+    }
+    case VS_U8: {
+      u8 *out = dst;
+      if (src_dtype == VS_U16) {
+        const u16 *in = src;
+        for (s64 i = 0; i < count; i++) out[i] = in[i] > 255 ? 255 : in[i];
+      } else {
+        vs__convert_kernels.f32_to_u8(out, src, count);
+      }
+      break;
+    }
+    case VS_U16: {
+      u16 *out = dst;
+      if (src_dtype == VS_U8) {
+        const u8 *in = src;
+        for (s64 i = 0; i < count; i++) out[i] = in[i];
+      } else {
+        vs__convert_kernels.f32_to_u16(out, src, count);
+      }
+      break;
+    }
+  }
+}
+
+// float conversions are clamped to the integer range and truncated, NaN becomes 0
+static void vs__u8_to_f32_scalar(f32 *out, const u8 *in, s64 count) {
+  for (s64 i = 0; i < count; i++) out[i] = in[i];
+}
+
+static void vs__f32_to_u8_scalar(u8 *out, const f32 *in, s64 count) {
+  for (s64 i = 0; i < count; i++) out[i] = in[i] > 0.0f ? (in[i] < 255.0f ? (u8)in[i] : 255) : 0;
+}
+
+static void vs__u16_to_f32_scalar(f32 *out, const u16 *in, s64 count) {
+  for (s64 i = 0; i < count; i++) out[i] = in[i];
+}
+
+static void vs__f32_to_u16_scalar(u16 *out, const f32 *in, s64 count) {
+  for (s64 i = 0; i < count; i++) out[i] = in[i] > 0.0f ? (in[i] < 65535.0f ? (u16)in[i] : 65535) : 0;
+}
+
+// the mean of the 8 voxels is rounded to nearest
+static void vs__u8_pool2_mean_scalar(u8 *out, const u8 *const rows[4], s64 count) {
+  for (s64 i = 0; i < count; i++) {
+    u32 sum = 4;
+    for (int r = 0; r < 4; r++) sum += rows[r][2 * i] + rows[r][2 * i + 1];
+    out[i] = (u8)(sum >> 3);
+  }
+}
+
+static void vs__u8_pool2_max_scalar(u8 *out, const u8 *const rows[4], s64 count) {
+  for (s64 i = 0; i < count; i++) {
+    u8 max = 0;
+    for (int r = 0; r < 4; r++) max = MAX(max, MAX(rows[r][2 * i], rows[r][2 * i + 1]));
+    out[i] = max;
+  }
+}
+
+#if defined(__SSE2__)
+static void vs__u8_to_f32_sse2(f32 *out, const u8 *in, s64 count) {
+  s64 i = 0;
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_ps(out + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+  }
+  vs__u8_to_f32_scalar(out + i, in + i, count - i);
+}
+
+static void vs__f32_to_u8_sse2(u8 *out, const f32 *in, s64 count) {
+  s64 i = 0;
+  __m128 lo = _mm_setzero_ps();
+  __m128 hi = _mm_set1_ps(255.0f);
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi));
+    __m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi));
+    __m128i c = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 8), lo), hi));
+    __m128i d = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 12), lo), hi));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+  }
+  vs__f32_to_u8_scalar(out + i, in + i, count - i);
+}
+
+static void vs__u16_to_f32_sse2(f32 *out, const u16 *in, s64 count) {
+  s64 i = 0;
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+    _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+  }
+  vs__u16_to_f32_scalar(out + i, in + i, count - i);
+}
+
+static void vs__f32_to_u16_sse2(u16 *out, const f32 *in, s64 count) {
+  s64 i = 0;
+  // SSE2 can only pack with signed saturation, so the values are shifted into the s16 range and back
+  __m128 lo = _mm_setzero_ps();
+  __m128 hi = _mm_set1_ps(65535.0f);
+  __m128i bias = _mm_set1_epi32(32768);
+  __m128i unbias = _mm_set1_epi16((short)0x8000);
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi));
+    __m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi));
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(packed, unbias));
+  }
+  vs__f32_to_u16_scalar(out + i, in + i, count - i);
+}
+
+// the voxels of each pair are split into the low and high byte of a 16 bit lane and summed there
+static void vs__u8_pool2_mean_sse2(u8 *out, const u8 *const rows[4], s64 count) {
+  s64 i = 0;
+  __m128i low = _mm_set1_epi16(0x00ff);
+  __m128i round = _mm_set1_epi16(4);
+  for (; i + 16 <= count; i += 16) {
+    __m128i sum_a = round;
+    __m128i sum_b = round;
+    for (int r = 0; r < 4; r++) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(rows[r] + 2 * i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(rows[r] + 2 * i + 16));
+      sum_a = _mm_add_epi16(sum_a, _mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)));
+      sum_b = _mm_add_epi16(sum_b, _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+    }
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(_mm_srli_epi16(sum_a, 3), _mm_srli_epi16(sum_b, 3)));
+  }
+  const u8 *tail[4] = {rows[0] + 2 * i, rows[1] + 2 * i, rows[2] + 2 * i, rows[3] + 2 * i};
+  vs__u8_pool2_mean_scalar(out + i, tail, count - i);
+}
+
+static void vs__u8_pool2_max_sse2(u8 *out, const u8 *const rows[4], s64 count) {
+  s64 i = 0;
+  __m128i low = _mm_set1_epi16(0x00ff);
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(rows[0] + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(rows[0] + 2 * i + 16));
+    for (int r = 1; r < 4; r++) {
+      a = _mm_max_epu8(a, _mm_loadu_si128((const __m128i *)(rows[r] + 2 * i)));
+      b = _mm_max_epu8(b, _mm_loadu_si128((const __m128i *)(rows[r] + 2 * i + 16)));
+    }
+    a = _mm_and_si128(_mm_max_epu8(a, _mm_srli_epi16(a, 8)), low);
+    b = _mm_and_si128(_mm_max_epu8(b, _mm_srli_epi16(b, 8)), low);
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+  }
+  const u8 *tail[4] = {rows[0] + 2 * i, rows[1] + 2 * i, rows[2] + 2 * i, rows[3] + 2 * i};
+  vs__u8_pool2_max_scalar(out + i, tail, count - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+// built for avx2 regardless of the compiler flags, vs__pick_convert_kernels only uses them if the cpu has it
+__attribute__((target("avx2"))) static void vs__u8_to_f32_avx2(f32 *out, const u8 *in, s64 count) {
+  s64 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+    _mm256_storeu_ps(out + i + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+  }
+  vs__u8_to_f32_scalar(out + i, in + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void vs__f32_to_u8_avx2(u8 *out, const f32 *in, s64 count) {
+  s64 i = 0;
+  __m256 lo = _mm256_setzero_ps();
+  __m256 hi = _mm256_set1_ps(255.0f);
+  // the packs work within 128 bit lanes, this puts the 32 bit groups back in order
+  __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  for (; i + 32 <= count; i += 32) {
+    __m256i a = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), lo), hi));
+    __m256i b = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 8), lo), hi));
+    __m256i c = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 16), lo), hi));
+    __m256i d = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 24), lo), hi));
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  vs__f32_to_u8_scalar(out + i, in + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void vs__u16_to_f32_avx2(f32 *out, const u16 *in, s64 count) {
+  s64 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v))));
+    _mm256_storeu_ps(out + i + 8, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1))));
+  }
+  vs__u16_to_f32_scalar(out + i, in + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void vs__f32_to_u16_avx2(u16 *out, const f32 *in, s64 count) {
+  s64 i = 0;
+  __m256 lo = _mm256_setzero_ps();
+  __m256 hi = _mm256_set1_ps(65535.0f);
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), lo), hi));
+    __m256i b = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 8), lo), hi));
+    // packus works within 128 bit lanes, the 64 bit groups are put back in order afterwards
+    __m256i packed = _mm256_packus_epi32(a, b);
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  vs__f32_to_u16_scalar(out + i, in + i, count - i);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void vs__u8_to_f32_neon(f32 *out, const u8 *in, s64 count) {
+  s64 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t v = vld1q_u8(in + i);
+    uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+    vst1q_f32(out + i, vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))));
+    vst1q_f32(out + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))));
+    vst1q_f32(out + i + 8, vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))));
+    vst1q_f32(out + i + 12, vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))));
+  }
+  vs__u8_to_f32_scalar(out + i, in + i, count - i);
+}
+
+// the conversions saturate and map NaN to 0, the narrowing saturates to the integer range
+static void vs__f32_to_u8_neon(u8 *out, const f32 *in, s64 count) {
+  s64 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint16x8_t lo = vcombine_u16(vqmovn_u32(vcvtq_u32_f32(vld1q_f32(in + i))),
+                                 vqmovn_u32(vcvtq_u32_f32(vld1q_f32(in + i + 4))));
+    uint16x8_t hi = vcombine_u16(vqmovn_u32(vcvtq_u32_f32(vld1q_f32(in + i + 8))),
+                                 vqmovn_u32(vcvtq_u32_f32(vld1q_f32(in + i + 12))));
+    vst1q_u8(out + i, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+  }
+  vs__f32_to_u8_scalar(out + i, in + i, count - i);
+}
+
+static void vs__u16_to_f32_neon(f32 *out, const u16 *in, s64 count) {
+  s64 i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint16x8_t v = vld1q_u16(in + i);
+    vst1q_f32(out + i, vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))));
+    vst1q_f32(out + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))));
+  }
+  vs__u16_to_f32_scalar(out + i, in + i, count - i);
+}
+
+static void vs__f32_to_u16_neon(u16 *out, const f32 *in, s64 count) {
+  s64 i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint32x4_t a = vcvtq_u32_f32(vld1q_f32(in + i));
+    uint32x4_t b = vcvtq_u32_f32(vld1q_f32(in + i + 4));
+    vst1q_u16(out + i, vcombine_u16(vqmovn_u32(a), vqmovn_u32(b)));
+  }
+  vs__f32_to_u16_scalar(out + i, in + i, count - i);
+}
+
+static void vs__u8_pool2_mean_neon(u8 *out, const u8 *const rows[4], s64 count) {
+  s64 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint16x8_t sum_a = vdupq_n_u16(4);
+    uint16x8_t sum_b = vdupq_n_u16(4);
+    for (int r = 0; r < 4; r++) {
+      sum_a = vaddq_u16(sum_a, vpaddlq_u8(vld1q_u8(rows[r] + 2 * i)));
+      sum_b = vaddq_u16(sum_b, vpaddlq_u8(vld1q_u8(rows[r] + 2 * i + 16)));
+    }
+    vst1q_u8(out + i, vcombine_u8(vshrn_n_u16(sum_a, 3), vshrn_n_u16(sum_b, 3)));
+  }
+  const u8 *tail[4] = {rows[0] + 2 * i, rows[1] + 2 * i, rows[2] + 2 * i, rows[3] + 2 * i};
+  vs__u8_pool2_mean_scalar(out + i, tail, count - i);
+}
+
+static void vs__u8_pool2_max_neon(u8 *out, const u8 *const rows[4], s64 count) {
+  s64 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t a = vld1q_u8(rows[0] + 2 * i);
+    uint8x16_t b = vld1q_u8(rows[0] + 2 * i + 16);
+    for (int r = 1; r < 4; r++) {
+      a = vmaxq_u8(a, vld1q_u8(rows[r] + 2 * i));
+      b = vmaxq_u8(b, vld1q_u8(rows[r] + 2 * i + 16));
+    }
+    // split into the even and odd voxels of the 32
+    uint8x16x2_t pairs = vuzpq_u8(a, b);
+    vst1q_u8(out + i, vmaxq_u8(pairs.val[0], pairs.val[1]));
+  }
+  const u8 *tail[4] = {rows[0] + 2 * i, rows[1] + 2 * i, rows[2] + 2 * i, rows[3] + 2 * i};
+  vs__u8_pool2_max_scalar(out + i, tail, count - i);
+}
+#endif
+
+// picks the widest kernels the cpu supports. VS_SIMD=scalar or VS_SIMD=sse2 in the environment caps the choice
+static void vs__pick_convert_kernels(void) {
+  vs__convert_kernels = (vs__convert_kernel_set){
+    "scalar", vs__u8_to_f32_scalar, vs__f32_to_u8_scalar, vs__u16_to_f32_scalar, vs__f32_to_u16_scalar,
+    vs__u8_pool2_mean_scalar, vs__u8_pool2_max_scalar
+  };
+  const char *forced = getenv("VS_SIMD");
+  if (forced != NULL && strcmp(forced, "scalar") == 0) {
+    LOG_INFO("using scalar conversion kernels");
+    return;
+  }
+#if defined(__SSE2__)
+  vs__convert_kernels = (vs__convert_kernel_set){
+    "sse2", vs__u8_to_f32_sse2, vs__f32_to_u8_sse2, vs__u16_to_f32_sse2, vs__f32_to_u16_sse2,
+    vs__u8_pool2_mean_sse2, vs__u8_pool2_max_sse2
+  };
+#elif defined(__ARM_NEON)
+  vs__convert_kernels = (vs__convert_kernel_set){
+    "neon", vs__u8_to_f32_neon, vs__f32_to_u8_neon, vs__u16_to_f32_neon, vs__f32_to_u16_neon,
+    vs__u8_pool2_mean_neon, vs__u8_pool2_max_neon
+  };
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && (forced == NULL || strcmp(forced, "sse2") != 0)) {
+    // downsampling is bound by memory bandwidth already with sse2, so those kernels are kept
+    vs__convert_kernels = (vs__convert_kernel_set){
+      "avx2", vs__u8_to_f32_avx2, vs__f32_to_u8_avx2, vs__u16_to_f32_avx2, vs__f32_to_u16_avx2,
+      vs__convert_kernels.u8_pool2_mean, vs__convert_kernels.u8_pool2_max
+    };
+  }
+#endif
+  // only worth reporting when the choice was asked for
+  if (forced != NULL) {
+    LOG_INFO("using %s conversion kernels", vs__convert_kernels.name);
+  }
+}
+
+static void vs__bswap16(u16 *data, s64 count) {
+  for (s64 i = 0; i < count; i++) data[i] = (u16)(data[i] << 8 | data[i] >> 8);
+}
+
+// like vs_chunk_graft, but copies whole rows and converts them if the dtypes differ
+int vs_tchunk_graft(tchunk *dest, tchunk *src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3]) {
+  if (!dest || !src || !src_start || !dest_start || !dims) {
+    LOG_ERROR("a param is NULL");
+    return -1;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (dims[i] <= 0) {
+      LOG_ERROR("a dimension is <= 0");
+      return -1;
+    }
+    if (src_start[i] < 0 || src_start[i] + dims[i] > src->dims[i]) {
+      LOG_ERROR("out of bounds src dimension");
+      return -1;
+    }
+    if (dest_start[i] < 0 || dest_start[i] + dims[i] > dest->dims[i]) {
+      LOG_ERROR("out of bounds dest dimension");
+      return -1;
+    }
+  }
+
+  s32 src_size = vs_dtype_size(src->dtype);
+  s32 dest_size = vs_dtype_size(dest->dtype);
+  for (s32 z = 0; z < dims[0]; z++) {
+    for (s32 y = 0; y < dims[1]; y++) {
+      s64 src_i = ((s64)(src_start[0] + z) * src->dims[1] + src_start[1] + y) * src->dims[2] + src_start[2];
+      s64 dest_i = ((s64)(dest_start[0] + z) * dest->dims[1] + dest_start[1] + y) * dest->dims[2] + dest_start[2];
+      vs__convert(dest->data + dest_i * dest_size, dest->dtype, src->data + src_i * src_size, src->dtype, dims[2]);
+    }
+  }
+  return 0;
+}
+
+// a z range of the region copied by vs_chunk_graft_mt, each thread copies one
+typedef struct {
+  chunk *dest;
+  chunk *src;
+  s32 *src_start;
+  s32 *dest_start;
+  s32 *dims;
+  s32 z0, z1;
+} vs__graft_slab;
+
+static void *vs__graft_rows(void *arg) {
+  vs__graft_slab *slab = arg;
+  chunk *dest = slab->dest;
+  chunk *src = slab->src;
+  s32 *dims = slab->dims;
+  // src and dest may be the same chunk
+  void *(*copy)(void *, const void *, size_t) = dest == src ? memmove : memcpy;
+
+  // when the rows span both chunks in x, each z plane of the region is contiguous and copied at once
+  bool planes = dims[2] == src->dims[2] && dims[2] == dest->dims[2];
+  s32 rows = planes ? 1 : dims[1];
+  size_t row_bytes = (size_t)(planes ? dims[1] * dims[2] : dims[2]) * sizeof(f32);
+  for (s32 z = slab->z0; z < slab->z1; z++) {
+    for (s32 y = 0; y < rows; y++) {
+      s64 src_i = ((s64)(slab->src_start[0] + z) * src->dims[1] + slab->src_start[1] + y) * src->dims[2] + slab->src_start[2];
+      s64 dest_i = ((s64)(slab->dest_start[0] + z) * dest->dims[1] + slab->dest_start[1] + y) * dest->dims[2] + slab->dest_start[2];
+      copy(dest->data + dest_i, src->data + src_i, row_bytes);
+    }
+  }
+  return NULL;
+}
+
+// copies the dims sized region at src_start in src to dest_start in dest, row by row
+int vs_chunk_graft(chunk* dest, chunk* src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3]) {
+  return vs_chunk_graft_mt(dest, src, src_start, dest_start, dims, 1);
+}
+
+// like vs_chunk_graft, but the z range is split between nthreads threads, the calling thread being one of them
+//   - nthreads <= 0 uses one thread per online cpu
+//   - fewer threads are used when the region is too small for the split to pay off
+int vs_chunk_graft_mt(chunk* dest, chunk* src, s32 src_start[static 3], s32 dest_start[static 3], s32 dims[static 3], int nthreads) {
+  if (!dest || !src || !src_start || !dest_start || !dims) {
+    LOG_ERROR("a param is NULL");
+    return -1;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (dims[i] <= 0) {
+      LOG_ERROR("a dimension is <= 0");
+      return -1;
+    }
+    if (src_start[i] < 0 || src_start[i] + dims[i] > src->dims[i]) {
+      LOG_ERROR("out of bounds src dimension");
+      return -1;
+    }
+    if (dest_start[i] < 0 || dest_start[i] + dims[i] > dest->dims[i]) {
+      LOG_ERROR("out of bounds dest dimension");
+      return -1;
+    }
+  }
+
+  if (nthreads <= 0) {
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  // overlapping regions of the same chunk are only safe to copy in order
+  if (dest == src) {
+    nthreads = 1;
+  }
+  s64 voxels = (s64)dims[0] * dims[1] * dims[2];
+  nthreads = (int)MIN((s64)nthreads, voxels / VS_GRAFT_THREAD_VOXELS);
+  nthreads = MAX(1, MIN(nthreads, MIN(dims[0], VS_GRAFT_MAX_THREADS)));
+
+  pthread_t threads[VS_GRAFT_MAX_THREADS];
+  bool started[VS_GRAFT_MAX_THREADS] = {0};
+  vs__graft_slab slabs[VS_GRAFT_MAX_THREADS];
+  for (int i = 0; i < nthreads; i++) {
+    slabs[i] = (vs__graft_slab){dest, src, src_start, dest_start, dims,
+                                (s32)((s64)dims[0] * i / nthreads), (s32)((s64)dims[0] * (i + 1) / nthreads)};
+  }
+  // slab 0 is copied on this thread, and so is any slab whose thread could not be started
+  for (int i = 1; i < nthreads; i++) {
+    started[i] = pthread_create(&threads[i], NULL, vs__graft_rows, &slabs[i]) == 0;
+  }
+  vs__graft_rows(&slabs[0]);
+  for (int i = 1; i < nthreads; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      vs__graft_rows(&slabs[i]);
+    }
+  }
+  return 0;
+}
+
+
+chunk* vs_maxpool(chunk* inchunk, s32 kernel, s32 stride) {
+  s32 dims[3] = {
+    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
+    (inchunk->dims[2] + stride - 1) / stride
+  };
+  chunk *ret = vs_chunk_new(dims);
+  for (s32 z = 0; z < ret->dims[0]; z++)
+    for (s32 y = 0; y < ret->dims[1]; y++)
+      for (s32 x = 0; x < ret->dims[2]; x++) {
+        f32 max32 = -INFINITY;
+        f32 val32;
+        for (s32 zi = 0; zi < kernel; zi++)
+          for (s32 yi = 0; yi < kernel; yi++)
+            for (s32 xi = 0; xi < kernel; xi++) {
+              if (z + zi > inchunk->dims[0] || y + yi > inchunk->dims[1] || x + xi > inchunk->dims[2]) { continue; }
+
+              if ((val32 = vs_chunk_get(inchunk, z * stride + zi, y * stride + yi,
+                                                                       x * stride + xi)) > max32) { max32 = val32; }
+            }
+        vs_chunk_set(ret, z, y, x, max32);
+      }
+  return ret;
+}
+
+chunk *vs_avgpool(chunk *inchunk, s32 kernel, s32 stride) {
+  s32 dims[3] = {
+    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
+    (inchunk->dims[2] + stride - 1) / stride
+  };
+  chunk *ret = vs_chunk_new(dims);
+  s32 len = kernel * kernel * kernel;
+  s32 i = 0;
+  f32 *data = malloc(len * sizeof(f32));
+  for (s32 z = 0; z < ret->dims[0]; z++)
+    for (s32 y = 0; y < ret->dims[1]; y++)
+      for (s32 x = 0; x < ret->dims[2]; x++) {
+        len = kernel * kernel * kernel;
+        i = 0;
+        for (s32 zi = 0; zi < kernel; zi++)
+          for (s32 yi = 0; yi < kernel; yi++)
+            for (s32 xi = 0; xi < kernel; xi++) {
+              if (z + zi > inchunk->dims[0] || y + yi > inchunk->dims[1] || x + xi > inchunk->dims[2]) {
+                len--;
+                continue;
+              }
+              data[i++] = vs_chunk_get(inchunk, z * stride + zi, y * stride + yi, x * stride + xi);
+            }
+        vs_chunk_set(ret, z, y, x, vs__avgfloat(data, len));
+      }
+  return ret;
+}
+
+chunk *vs_sumpool(chunk *inchunk, s32 kernel, s32 stride) {
+  s32 dims[3] = {
+    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
+    (inchunk->dims[2] + stride - 1) / stride
+  };
+  chunk *ret = vs_chunk_new(dims);
   for (s32 z = 0; z < ret->dims[0]; z++)
     for (s32 y = 0; y < ret->dims[1]; y++)
       for (s32 x = 0; x < ret->dims[2]; x++) {
@@ -2089,6 +4620,80 @@ chunk *vs_sumpool(chunk *inchunk, s32 kernel, s32 stride) {
   return ret;
 }
 
+// the tchunk pools keep the dtype of their input and work on the stored voxels directly
+//   - POOL_WINDOW runs body for every voxel index i of the kernel window at z, y, x that lies inside the input
+#define POOL_WINDOW(body) \
+  for (s32 zi = z * stride; zi < MIN(z * stride + kernel, inchunk->dims[0]); zi++) \
+    for (s32 yi = y * stride; yi < MIN(y * stride + kernel, inchunk->dims[1]); yi++) \
+      for (s32 xi = x * stride; xi < MIN(x * stride + kernel, inchunk->dims[2]); xi++) { \
+        s64 i = ((s64)zi * inchunk->dims[1] + yi) * inchunk->dims[2] + xi; \
+        body; \
+      }
+
+#define POOL_MAX(T, lowest) { \
+    const T *in = (const T *)inchunk->data; \
+    T *out = (T *)ret->data; \
+    for (s32 z = 0; z < ret->dims[0]; z++) \
+      for (s32 y = 0; y < ret->dims[1]; y++) \
+        for (s32 x = 0; x < ret->dims[2]; x++) { \
+          T max = lowest; \
+          POOL_WINDOW(if (in[i] > max) max = in[i]) \
+          *out++ = max; \
+        } \
+  }
+
+// integer averages are rounded to the nearest value
+#define POOL_AVG(T, acc_type, round) { \
+    const T *in = (const T *)inchunk->data; \
+    T *out = (T *)ret->data; \
+    for (s32 z = 0; z < ret->dims[0]; z++) \
+      for (s32 y = 0; y < ret->dims[1]; y++) \
+        for (s32 x = 0; x < ret->dims[2]; x++) { \
+          acc_type sum = 0; \
+          s32 len = 0; \
+          POOL_WINDOW(sum += in[i]; len++) \
+          *out++ = (T)((sum + (round ? len / 2 : 0)) / len); \
+        } \
+  }
+
+tchunk *vs_tchunk_maxpool(tchunk *inchunk, s32 kernel, s32 stride) {
+  s32 dims[3] = {
+    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
+    (inchunk->dims[2] + stride - 1) / stride
+  };
+  tchunk *ret = vs_tchunk_new(dims, inchunk->dtype);
+  if (ret == NULL) {
+    return NULL;
+  }
+  switch (inchunk->dtype) {
+    case VS_U8: POOL_MAX(u8, 0) break;
+    case VS_U16: POOL_MAX(u16, 0) break;
+    case VS_F32: POOL_MAX(f32, -INFINITY) break;
+  }
+  return ret;
+}
+
+tchunk *vs_tchunk_avgpool(tchunk *inchunk, s32 kernel, s32 stride) {
+  s32 dims[3] = {
+    (inchunk->dims[0] + stride - 1) / stride, (inchunk->dims[1] + stride - 1) / stride,
+    (inchunk->dims[2] + stride - 1) / stride
+  };
+  tchunk *ret = vs_tchunk_new(dims, inchunk->dtype);
+  if (ret == NULL) {
+    return NULL;
+  }
+  switch (inchunk->dtype) {
+    case VS_U8: POOL_AVG(u8, u32, 1) break;
+    case VS_U16: POOL_AVG(u16, u64, 1) break;
+    case VS_F32: POOL_AVG(f32, f64, 0) break;
+  }
+  return ret;
+}
+
+#undef POOL_AVG
+#undef POOL_MAX
+#undef POOL_WINDOW
+
 
 static chunk *vs__create_box_kernel(s32 size) {
   int dims[3] = {size,size,size};
@@ -4454,218 +7059,1605 @@ int vs_vcps_read(const char* filename,
                 ordered = (strcmp(value, "true") == 0);
             }
         }
-    }
+    }
+
+    if (!header_complete || *width == 0 || *height == 0 || *dim == 0 ||
+        (strcmp(src_type, "float") != 0 && strcmp(src_type, "double") != 0) ||
+        !ordered) {
+        LOG_ERROR("Error: Invalid header (w=%zu h=%zu d=%zu t=%s o=%d)\n",
+                *width, *height, *dim, src_type, ordered);
+        fclose(fp);
+        return 1;
+    }
+
+    size_t total_points = (*width) * (*height) * (*dim);
+    int status = vs__vcps_read_binary_data(fp, data, src_type, dst_type, total_points);
+
+    fclose(fp);
+    return status;
+}
+
+int vs_vcps_write(const char* filename,
+               size_t width, size_t height, size_t dim,
+               const void* data, const char* src_type, const char* dst_type) {
+    if (!src_type || !dst_type ||
+        (strcmp(src_type, "float") != 0 && strcmp(src_type, "double") != 0) ||
+        (strcmp(dst_type, "float") != 0 && strcmp(dst_type, "double") != 0)) {
+        LOG_ERROR("Error: Invalid type specification\n");
+        return 1;
+    }
+
+    FILE* fp = fopen(filename, "w");
+    if (!fp) return 1;
+
+    // Write header
+    fprintf(fp, "width: %zu\n", width);
+    fprintf(fp, "height: %zu\n", height);
+    fprintf(fp, "dim: %zu\n", dim);
+    fprintf(fp, "ordered: true\n");
+    fprintf(fp, "type: %s\n", dst_type);
+    fprintf(fp, "version: 1\n");
+    fprintf(fp, "<>\n");
+    fclose(fp);
+
+    // Reopen in binary append mode for data
+    fp = fopen(filename, "ab");
+    if (!fp) return 1;
+
+    size_t total_points = width * height * dim;
+    int status = vs__vcps_write_binary_data(fp, data, src_type, dst_type, total_points);
+
+    fclose(fp);
+    return status;
+}
+
+// store
+
+vs_store *vs_store_open(const char *location) {
+  if (vs__str_starts_with(location, "http://") || vs__str_starts_with(location, "https://")) {
+    return vs_store_http_new(location);
+  }
+  if (vs__str_starts_with(location, "file://")) {
+    return vs_store_dir_new(location + strlen("file://"));
+  }
+  return vs_store_dir_new(location);
+}
+
+void vs_store_free(vs_store *store) {
+  if (store) {
+    store->ops->free(store);
+  }
+}
+
+int vs_store_get(vs_store *store, const char *key, void **data, s64 *size) {
+  return store->ops->get(store, key, 0, 0, data, size);
+}
+
+int vs_store_get_range(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size) {
+  return store->ops->get(store, key, offset, length, data, size);
+}
+
+int vs_store_put(vs_store *store, const char *key, const void *data, s64 size) {
+  return store->ops->put(store, key, data, size);
+}
+
+int vs_store_exists(vs_store *store, const char *key) {
+  return store->ops->exists(store, key);
+}
+
+int vs_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys) {
+  *keys = NULL;
+  *nkeys = 0;
+  return store->ops->list(store, prefix ? prefix : "", keys, nkeys);
+}
+
+// reads a whole object as a nul terminated string, for json metadata
+static int vs__store_get_text(vs_store *store, const char *key, char **text) {
+  void *data = NULL;
+  s64 size = 0;
+  int ret = vs_store_get(store, key, &data, &size);
+  if (ret != 0) {
+    return ret;
+  }
+  char *terminated = realloc(data, size + 1);
+  if (terminated == NULL) {
+    free(data);
+    return -1;
+  }
+  terminated[size] = '\0';
+  *text = terminated;
+  return 0;
+}
+
+static int vs__store_add_key(char ***keys, int *nkeys, int *capacity, const char *key) {
+  if (*nkeys == *capacity) {
+    int new_capacity = *capacity ? *capacity * 2 : 64;
+    char **grown = realloc(*keys, new_capacity * sizeof(char *));
+    if (grown == NULL) {
+      return 1;
+    }
+    *keys = grown;
+    *capacity = new_capacity;
+  }
+  if (((*keys)[*nkeys] = strdup(key)) == NULL) {
+    return 1;
+  }
+  (*nkeys)++;
+  return 0;
+}
+
+static int vs__store_compare_keys(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// http: objects are downloaded from <url>/<key> over the shared curl connections. http stores are read only
+
+static const vs_store_ops vs__http_store_ops = {
+  vs__http_store_get, vs__http_store_put, vs__http_store_exists, vs__http_store_list, (void (*)(vs_store *))free
+};
+
+vs_store *vs_store_http_new(const char *url) {
+  vs_store *ret = calloc(1, sizeof(vs_store));
+  if (ret == NULL) {
+    LOG_ERROR("failed to allocate memory");
+    return NULL;
+  }
+  ret->ops = &vs__http_store_ops;
+  strncpy(ret->root, url, sizeof(ret->root) - 1);
+  return ret;
+}
+
+static int vs__http_store_get(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size) {
+  char url[2048];
+  snprintf(url, sizeof(url), "%s/%s", store->root, key);
+  long http_code = 0;
+  long len = vs__download(url, offset, length, data, &http_code);
+  if (len >= 0) {
+    *size = len;
+    return 0;
+  }
+  return http_code == 404 ? 1 : -1;
+}
+
+static int vs__http_store_put(vs_store *store, const char *key, const void *data, s64 size) {
+  (void)data;
+  (void)size;
+  LOG_ERROR("can't write %s, %s is read only", key, store->root);
+  return -1;
+}
+
+// asks for the headers only
+static int vs__http_store_exists(vs_store *store, const char *key) {
+  char url[2048];
+  snprintf(url, sizeof(url), "%s/%s", store->root, key);
+  CURL *curl = acquire_curl_handle(url);
+  if (curl == NULL) {
+    return -1;
+  }
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  CURLcode res = curl_easy_perform(curl);
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  release_curl_handle(curl);
+  if (res != CURLE_OK) {
+    LOG_ERROR("curl_easy_perform() failed: %s", curl_easy_strerror(res));
+    return -1;
+  }
+  return http_code == 200 ? 0 : http_code == 404 ? 1 : -1;
+}
+
+static int vs__http_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys) {
+  (void)prefix;
+  (void)keys;
+  (void)nkeys;
+  LOG_ERROR("%s can't be listed over http", store->root);
+  return -1;
+}
+
+// dir: every key is a file under the directory, written atomically so concurrent readers never see half a file
+
+static const vs_store_ops vs__dir_store_ops = {
+  vs__dir_store_get, vs__dir_store_put, vs__dir_store_exists, vs__dir_store_list, (void (*)(vs_store *))free
+};
+
+vs_store *vs_store_dir_new(const char *path) {
+  vs_store *ret = calloc(1, sizeof(vs_store));
+  if (ret == NULL) {
+    LOG_ERROR("failed to allocate memory");
+    return NULL;
+  }
+  ret->ops = &vs__dir_store_ops;
+  strncpy(ret->root, path, sizeof(ret->root) - 1);
+  return ret;
+}
+
+static int vs__dir_store_get(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size) {
+  char path[2048];
+  snprintf(path, sizeof(path), "%s/%s", store->root, key);
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    if (errno == ENOENT || errno == ENOTDIR) {
+      return 1;
+    }
+    LOG_ERROR("could not open %s", path);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  s64 file_size = ftell(fp);
+  s64 start = 0, count = file_size;
+  if (length > 0) {
+    start = offset < 0 ? file_size - length : offset;
+    count = length;
+  }
+  if (start < 0 || start + count > file_size) {
+    LOG_ERROR("%s is too short for the requested range", path);
+    fclose(fp);
+    return -1;
+  }
+
+  u8 *buf = malloc(count > 0 ? count : 1);
+  fseek(fp, start, SEEK_SET);
+  if (buf == NULL || fread(buf, 1, count, fp) != (size_t)count) {
+    LOG_ERROR("could not read %s", path);
+    free(buf);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  *data = buf;
+  *size = count;
+  return 0;
+}
+
+static int vs__dir_store_put(vs_store *store, const char *key, const void *data, s64 size) {
+  char path[2048];
+  snprintf(path, sizeof(path), "%s/%s", store->root, key);
+  return vs_zarr_write_block(path, (void *)data, size) ? -1 : 0;
+}
+
+static int vs__dir_store_exists(vs_store *store, const char *key) {
+  char path[2048];
+  snprintf(path, sizeof(path), "%s/%s", store->root, key);
+  return vs__path_exists(path) ? 0 : 1;
+}
+
+// adds the files below root/dir whose key starts with prefix, skipping directories that can't hold any
+static int vs__dir_store_walk(const char *root, const char *dir, const char *prefix, char ***keys, int *nkeys, int *capacity) {
+  char path[2048];
+  snprintf(path, sizeof(path), "%s/%s", root, dir);
+  DIR *d = opendir(path);
+  if (d == NULL) {
+    return errno == ENOENT ? 0 : 1;
+  }
+
+  int ret = 0;
+  struct dirent *entry;
+  while (ret == 0 && (entry = readdir(d)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    // files being written by vs__write_file_atomic
+    size_t namelen = strlen(entry->d_name);
+    if (namelen > 4 && strcmp(entry->d_name + namelen - 4, ".tmp") == 0) {
+      continue;
+    }
+    char key[1024];
+    snprintf(key, sizeof(key), "%s%s%s", dir, *dir ? "/" : "", entry->d_name);
+    size_t keylen = strlen(key);
+    if (strncmp(key, prefix, MIN(keylen, strlen(prefix))) != 0) {
+      continue;
+    }
+
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", root, key);
+    if (stat(path, &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      ret = vs__dir_store_walk(root, key, prefix, keys, nkeys, capacity);
+    } else if (keylen >= strlen(prefix)) {
+      ret = vs__store_add_key(keys, nkeys, capacity, key);
+    }
+  }
+  closedir(d);
+  return ret;
+}
+
+static int vs__dir_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys) {
+  int capacity = 0;
+  if (vs__dir_store_walk(store->root, "", prefix, keys, nkeys, &capacity)) {
+    LOG_ERROR("could not list %s", store->root);
+    for (int i = 0; i < *nkeys; i++) free((*keys)[i]);
+    free(*keys);
+    *keys = NULL;
+    *nkeys = 0;
+    return -1;
+  }
+  qsort(*keys, *nkeys, sizeof(char *), vs__store_compare_keys);
+  return 0;
+}
+
+// mem: a hash table of copies of the objects behind one lock
+
+typedef struct vs__mem_object {
+  char *key;
+  u8 *data;
+  s64 size;
+  struct vs__mem_object *next;
+} vs__mem_object;
+
+typedef struct {
+  pthread_mutex_t lock;
+  vs__mem_object **buckets;  // bucket_count is always a power of two
+  size_t bucket_count;
+  size_t count;
+} vs__mem_store;
+
+static const vs_store_ops vs__mem_store_ops = {
+  vs__mem_store_get, vs__mem_store_put, vs__mem_store_exists, vs__mem_store_list, vs__mem_store_free
+};
+
+vs_store *vs_store_mem_new(void) {
+  vs_store *ret = calloc(1, sizeof(vs_store));
+  vs__mem_store *mem = calloc(1, sizeof(vs__mem_store));
+  vs__mem_object **buckets = calloc(64, sizeof(vs__mem_object *));
+  if (ret == NULL || mem == NULL || buckets == NULL) {
+    LOG_ERROR("failed to allocate memory");
+    free(ret);
+    free(mem);
+    free(buckets);
+    return NULL;
+  }
+  pthread_mutex_init(&mem->lock, NULL);
+  mem->buckets = buckets;
+  mem->bucket_count = 64;
+  ret->ops = &vs__mem_store_ops;
+  ret->impl = mem;
+  return ret;
+}
+
+static size_t vs__mem_store_hash(const char *key) {
+  size_t hash = 14695981039346656037ULL;  // fnv-1a
+  for (; *key; key++) {
+    hash = (hash ^ (u8)*key) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// the link to key's object, or to the end of its bucket. the lock must be held
+static vs__mem_object **vs__mem_store_find(vs__mem_store *mem, const char *key) {
+  vs__mem_object **link = &mem->buckets[vs__mem_store_hash(key) & (mem->bucket_count - 1)];
+  while (*link && strcmp((*link)->key, key) != 0) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static int vs__mem_store_get(vs_store *store, const char *key, s64 offset, s64 length, void **data, s64 *size) {
+  vs__mem_store *mem = store->impl;
+  int ret = 0;
+  pthread_mutex_lock(&mem->lock);
+  vs__mem_object *object = *vs__mem_store_find(mem, key);
+  if (object == NULL) {
+    ret = 1;
+  } else {
+    s64 start = 0, count = object->size;
+    if (length > 0) {
+      start = offset < 0 ? object->size - length : offset;
+      count = length;
+    }
+    u8 *buf = start < 0 || start + count > object->size ? NULL : malloc(count > 0 ? count : 1);
+    if (buf == NULL) {
+      ret = -1;
+    } else {
+      memcpy(buf, object->data + start, count);
+      *data = buf;
+      *size = count;
+    }
+  }
+  pthread_mutex_unlock(&mem->lock);
+  if (ret < 0) {
+    LOG_ERROR("could not read %s", key);
+  }
+  return ret;
+}
+
+static int vs__mem_store_put(vs_store *store, const char *key, const void *data, s64 size) {
+  vs__mem_store *mem = store->impl;
+  u8 *copy = malloc(size > 0 ? size : 1);
+  if (copy == NULL) {
+    LOG_ERROR("failed to allocate memory");
+    return -1;
+  }
+  memcpy(copy, data, size);
+
+  pthread_mutex_lock(&mem->lock);
+  vs__mem_object **link = vs__mem_store_find(mem, key);
+  if (*link) {
+    free((*link)->data);
+    (*link)->data = copy;
+    (*link)->size = size;
+    pthread_mutex_unlock(&mem->lock);
+    return 0;
+  }
+
+  vs__mem_object *object = malloc(sizeof(vs__mem_object));
+  char *key_copy = strdup(key);
+  if (object == NULL || key_copy == NULL) {
+    pthread_mutex_unlock(&mem->lock);
+    LOG_ERROR("failed to allocate memory");
+    free(object);
+    free(key_copy);
+    free(copy);
+    return -1;
+  }
+  *object = (vs__mem_object){key_copy, copy, size, NULL};
+  *link = object;
+  mem->count++;
+
+  // keep the chains short, a table that can't grow just gets longer chains
+  if (mem->count > mem->bucket_count) {
+    size_t bucket_count = mem->bucket_count * 2;
+    vs__mem_object **buckets = calloc(bucket_count, sizeof(vs__mem_object *));
+    if (buckets != NULL) {
+      for (size_t i = 0; i < mem->bucket_count; i++) {
+        while (mem->buckets[i]) {
+          vs__mem_object *moved = mem->buckets[i];
+          mem->buckets[i] = moved->next;
+          size_t b = vs__mem_store_hash(moved->key) & (bucket_count - 1);
+          moved->next = buckets[b];
+          buckets[b] = moved;
+        }
+      }
+      free(mem->buckets);
+      mem->buckets = buckets;
+      mem->bucket_count = bucket_count;
+    }
+  }
+  pthread_mutex_unlock(&mem->lock);
+  return 0;
+}
+
+static int vs__mem_store_exists(vs_store *store, const char *key) {
+  vs__mem_store *mem = store->impl;
+  pthread_mutex_lock(&mem->lock);
+  int ret = *vs__mem_store_find(mem, key) ? 0 : 1;
+  pthread_mutex_unlock(&mem->lock);
+  return ret;
+}
+
+static int vs__mem_store_list(vs_store *store, const char *prefix, char ***keys, int *nkeys) {
+  vs__mem_store *mem = store->impl;
+  int capacity = 0;
+  int failed = 0;
+  size_t prefix_len = strlen(prefix);
+  pthread_mutex_lock(&mem->lock);
+  for (size_t i = 0; i < mem->bucket_count && !failed; i++) {
+    for (vs__mem_object *object = mem->buckets[i]; object && !failed; object = object->next) {
+      if (strncmp(object->key, prefix, prefix_len) == 0) {
+        failed = vs__store_add_key(keys, nkeys, &capacity, object->key);
+      }
+    }
+  }
+  pthread_mutex_unlock(&mem->lock);
+  if (failed) {
+    LOG_ERROR("failed to allocate memory");
+    for (int i = 0; i < *nkeys; i++) free((*keys)[i]);
+    free(*keys);
+    *keys = NULL;
+    *nkeys = 0;
+    return -1;
+  }
+  qsort(*keys, *nkeys, sizeof(char *), vs__store_compare_keys);
+  return 0;
+}
+
+static void vs__mem_store_free(vs_store *store) {
+  vs__mem_store *mem = store->impl;
+  for (size_t i = 0; i < mem->bucket_count; i++) {
+    while (mem->buckets[i]) {
+      vs__mem_object *object = mem->buckets[i];
+      mem->buckets[i] = object->next;
+      free(object->key);
+      free(object->data);
+      free(object);
+    }
+  }
+  free(mem->buckets);
+  pthread_mutex_destroy(&mem->lock);
+  free(mem);
+  free(store);
+}
+
+// vol
+
+volume *vs_vol_new(char *cache_dir, char *url) {
+  if (cache_dir != NULL) {
+    if (vs__mkdir_p(cache_dir)) {
+      LOG_ERROR("Could not mkdir %s",cache_dir);
+      return NULL;
+    }
+  }
+
+  vs_store *store = vs_store_open(url);
+  if (store == NULL) {
+    return NULL;
+  }
+  vs_store *cache_store = NULL;
+  if (cache_dir != NULL && (cache_store = vs_store_dir_new(cache_dir)) == NULL) {
+    vs_store_free(store);
+    return NULL;
+  }
+  return vs_vol_new_store(store, cache_store);
+}
+
+// opens the zarr array at the root of store, caching its blocks in cache_store unless it is NULL
+//   - the volume owns both stores and frees them with itself, or right away if it can't be opened
+volume *vs_vol_new_store(vs_store *store, vs_store *cache_store) {
+  volume *ret = calloc(1, sizeof(volume));
+  if (ret == NULL) {
+    vs_store_free(store);
+    vs_store_free(cache_store);
+    return NULL;
+  }
+
+  char *zarray_buf = NULL;
+  LOG_INFO("trying to read .zarray from %s", store->root);
+  if (vs__store_get_text(store, ".zarray", &zarray_buf) != 0) {
+    // zarr v3 arrays have a zarr.json instead
+    LOG_INFO("trying to read zarr.json from %s", store->root);
+    if (vs__store_get_text(store, "zarr.json", &zarray_buf) != 0) {
+      LOG_ERROR("could not read .zarray or zarr.json file!");
+      vs_store_free(store);
+      vs_store_free(cache_store);
+      free(ret);
+      return NULL;
+    }
+  }
+  zarr_metadata metadata = {0};
+  if (vs_zarr_parse_metadata(zarray_buf,&metadata)) {
+    LOG_ERROR("failed to parse .zarray");
+    free(zarray_buf);
+    vs_store_free(store);
+    vs_store_free(cache_store);
+    free(ret);
+    return NULL;
+  }
+
+  strncpy(ret->url,store->root,sizeof(ret->url) - 1);
+  if (cache_store) {
+    strncpy(ret->cache_dir,cache_store->root,sizeof(ret->cache_dir) - 1);
+  }
+  ret->store = store;
+  ret->cache_store = cache_store;
+  ret->metadata = metadata;
+  ret->cache = init_cache();
+  ret->shard_index = metadata.shard_shape[0] > 0 ? init_cache() : NULL;
+  if (ret->cache == NULL || (metadata.shard_shape[0] > 0 && ret->shard_index == NULL)) {
+    LOG_ERROR("failed to allocate the block cache");
+    if (ret->cache) free_cache(ret->cache);
+    free(zarray_buf);
+    vs_store_free(store);
+    vs_store_free(cache_store);
+    free(ret);
+    return NULL;
+  }
+
+  ret->prefetch.readahead = DEFAULT_READAHEAD_DEPTH;
+  pthread_mutex_init(&ret->prefetch.lock, NULL);
+  pthread_cond_init(&ret->prefetch.work, NULL);
+  pthread_cond_init(&ret->prefetch.idle, NULL);
+
+  free(zarray_buf);
+  return ret;
+}
+
+void vs_vol_free(volume* vol) {
+    if (vol) {
+        // queued prefetches are dropped, blocks that are already loading are finished first
+        vs__prefetcher *pf = &vol->prefetch;
+        pthread_mutex_lock(&pf->lock);
+        pf->stop = true;
+        pthread_cond_broadcast(&pf->work);
+        pthread_mutex_unlock(&pf->lock);
+        for (int i = 0; i < pf->nthreads; i++) {
+            pthread_join(pf->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->work);
+        pthread_cond_destroy(&pf->idle);
+        free(pf->queue);
+
+        free_cache(vol->cache);
+        if (vol->shard_index) {
+            free_cache(vol->shard_index);
+        }
+        vs_store_free(vol->store);
+        vs_store_free(vol->cache_store);
+        free(vol);
+    }
+}
+
+void vs_vol_set_cache_size(volume* vol, size_t max_bytes) {
+    set_cache_max_bytes(vol->cache, max_bytes);
+}
+
+// reads block z, y, x from the disk cache
+//   - a block recorded as missing by vs__vol_write_missing is read as vs__vol_missing_block
+//   - 0 on success, 1 if the block is not in the disk cache, -1 if it could not be read
+static int vs__vol_read_block(volume *vol, s32 z, s32 y, s32 x, tchunk **out) {
+    if (vol->cache_store == NULL) {
+        return 1;
+    }
+    char key[64];
+    snprintf(key, sizeof(key), "%d/%d/%d", z, y, x);
+    LOG_INFO("checking for zarr block %s in %s", key, vol->cache_store->root);
+    void *compressed_data = NULL;
+    s64 size = 0;
+    int status = vs_store_get(vol->cache_store, key, &compressed_data, &size);
+    if (status > 0) {
+        char missingkey[80];
+        snprintf(missingkey, sizeof(missingkey), "%s.missing", key);
+        if (vs_store_exists(vol->cache_store, missingkey) != 0) {
+            return 1;
+        }
+        LOG_INFO("%s is recorded as missing", key);
+        *out = vs__vol_missing_block();
+        if (*out == NULL) {
+            return -1;
+        }
+        stats_add(&STATS.disk_cache_hits, 1);
+        return 0;
+    }
+    *out = status == 0 ? vs_zarr_decompress_tchunk(size, compressed_data, vol->metadata) : NULL;
+    free(compressed_data);
+    if (*out == NULL) {
+        LOG_ERROR("failed to read zarr chunk %s from %s", key, vol->cache_store->root);
+        return -1;
+    }
+    stats_add(&STATS.disk_cache_hits, 1);
+    return 0;
+}
+
+// reads block z, y, x from the disk cache straight into dest, see vs__vol_block_dest
+//   - 0 on success, 1 if the block is not in the disk cache, -1 if it could not be read
+//   - blocks recorded as missing count as not in the disk cache, vs__vol_read_block handles those
+static int vs__vol_read_block_into(volume *vol, s32 z, s32 y, s32 x, void *dest) {
+    if (vol->cache_store == NULL) {
+        return 1;
+    }
+    char key[64];
+    snprintf(key, sizeof(key), "%d/%d/%d", z, y, x);
+    void *compressed_data = NULL;
+    s64 size = 0;
+    int status = vs_store_get(vol->cache_store, key, &compressed_data, &size);
+    if (status > 0) {
+        return 1;
+    }
+    LOG_INFO("reading %s from disk into the region", key);
+    int failed = status != 0 || vs__zarr_decompress_into(size, compressed_data, &vol->metadata, dest);
+    free(compressed_data);
+    if (failed) {
+        LOG_ERROR("failed to read zarr chunk %s from %s", key, vol->cache_store->root);
+        return -1;
+    }
+    stats_add(&STATS.disk_cache_hits, 1);
+    return 0;
+}
+
+// writes a downloaded block to the disk cache exactly as it was served, so it doesn't have to be recompressed
+static int vs__vol_write_block(volume *vol, s32 z, s32 y, s32 x, void *compressed_data, long size) {
+    if (vol->cache_store == NULL) {
+        return 0;
+    }
+    char key[64];
+    snprintf(key, sizeof(key), "%d/%d/%d", z, y, x);
+    LOG_INFO("writing chunk %s to %s", key, vol->cache_store->root);
+    if (vs_store_put(vol->cache_store, key, compressed_data, size)) {
+        LOG_ERROR("failed to write zarr chunk %s to %s", key, vol->cache_store->root);
+        return -1;
+    }
+    return 0;
+}
+
+// the stand-in for a block the server doesn't have, a tchunk without voxels
+//   - zarr leaves out blocks that only hold the fill value, so vs__vol_graft_block fills their region with it
+//   - it is cached like any other block, so a missing block costs one request, not one per read
+static tchunk *vs__vol_missing_block(void) {
+    tchunk *c = vs_tchunk_new((int[3]){0, 0, 0}, VS_U8);
+    if (c == NULL) {
+        LOG_ERROR("failed to allocate memory");
+    }
+    return c;
+}
+
+// records in the disk cache that block z, y, x doesn't exist, as an empty object next to where the block would be
+static int vs__vol_write_missing(volume *vol, s32 z, s32 y, s32 x) {
+    if (vol->cache_store == NULL) {
+        return 0;
+    }
+    char missingkey[64];
+    snprintf(missingkey, sizeof(missingkey), "%d/%d/%d.missing", z, y, x);
+    LOG_INFO("recording %s in %s", missingkey, vol->cache_store->root);
+    if (vs_store_put(vol->cache_store, missingkey, "", 0)) {
+        LOG_ERROR("failed to write %s to %s", missingkey, vol->cache_store->root);
+        return -1;
+    }
+    return 0;
+}
+
+// completes a load claimed with claim_cache. The cache takes ownership of c, NULL marks the load as failed
+//   - returns the cached block pinned for the caller, NULL on failure or when c is NULL
+static LRUNode *vs__vol_cache_block(volume *vol, s32 z, s32 y, s32 x, tchunk *c) {
+    if (c == NULL) {
+        complete_cache(vol->cache, x, y, z, NULL);
+        return NULL;
+    }
+
+    MemoryChunk mem = {
+        .data = (unsigned char *)c,
+        .size = sizeof(tchunk) + (size_t)c->dims[0] * c->dims[1] * c->dims[2] * vs_dtype_size(c->dtype)
+    };
+    LRUNode *node = complete_cache(vol->cache, x, y, z, &mem);
+    if (node == NULL) {
+        LOG_ERROR("failed to cache block %d/%d/%d", z, y, x);
+    }
+    return node;
+}
+
+// completes a load claimed with claim_cache with a copy of a block that was decompressed straight into dest, see vs__vol_block_dest
+//   - without memory for the copy the claim is abandoned, waiters load the block themselves
+static void vs__vol_cache_block_copy(volume *vol, s32 z, s32 y, s32 x, const void *voxels) {
+    vs_dtype dtype;
+    tchunk *c = NULL;
+    if (vs__zarr_dtype(&vol->metadata, &dtype, NULL) == 0) {
+        c = vs_tchunk_new(vol->metadata.chunks, dtype);
+    }
+    if (c == NULL) {
+        abandon_cache(vol->cache, x, y, z);
+        return;
+    }
+    memcpy(c->data, voxels, (size_t)c->dims[0] * c->dims[1] * c->dims[2] * vs_dtype_size(dtype));
+    LRUNode *node = vs__vol_cache_block(vol, z, y, x, c);
+    if (node != NULL) {
+        release_cache(vol->cache, node);
+    }
+}
+
+// the key in vol->store of the object holding block z, y, x, which is the block itself unless the zarr is sharded
+static void vs__vol_object_key(volume *vol, s32 z, s32 y, s32 x, char *key, size_t size) {
+    zarr_metadata *m = &vol->metadata;
+    if (m->shard_shape[0] > 0) {
+        z /= m->shard_shape[0] / m->chunks[0];
+        y /= m->shard_shape[1] / m->chunks[1];
+        x /= m->shard_shape[2] / m->chunks[2];
+    }
+    char sep = m->separator ? m->separator : '/';
+    if (m->key_prefix) {
+        snprintf(key, size, "c%c%d%c%d%c%d", sep, z, sep, y, sep, x);
+    } else {
+        snprintf(key, size, "%d%c%d%c%d", z, sep, y, sep, x);
+    }
+}
+
+static u64 vs__read_le64(const u8 *p) {
+    u64 ret = 0;
+    for (int i = 7; i >= 0; i--) ret = ret << 8 | p[i];
+    return ret;
+}
+
+// returns the index of the shard holding block z, y, x pinned in the shard index cache, NULL if it can't be downloaded
+//   - the index holds an offset and a length for every inner chunk, in C order. both are all ones for empty chunks
+//   - a shard that doesn't exist gets an index of empty chunks, so it is only asked for once
+static LRUNode *vs__vol_get_shard_index(volume *vol, s32 z, s32 y, s32 x) {
+    zarr_metadata *m = &vol->metadata;
+    s32 per[3] = {m->shard_shape[0] / m->chunks[0], m->shard_shape[1] / m->chunks[1], m->shard_shape[2] / m->chunks[2]};
+    s32 sz = z / per[0], sy = y / per[1], sx = x / per[2];
+
+    LRUNode *node = NULL;
+    int claim = claim_cache(vol->shard_index, sx, sy, sz, 1, &node);
+    if (claim == CACHE_HIT) {
+        return node;
+    } else if (claim == CACHE_FAILED) {
+        return NULL;
+    }
+
+    s64 nchunks = (s64)per[0] * per[1] * per[2];
+    s64 index_size = nchunks * 16 + (m->shard_index_crc ? 4 : 0);
+    char key[256];
+    vs__vol_object_key(vol, z, y, x, key, sizeof(key));
+    LOG_INFO("downloading the index of shard %s", key);
+    u8 *buf = NULL;
+    s64 len = 0;
+    int status = vs_store_get_range(vol->store, key, m->shard_index_at_start ? 0 : -1, index_size, (void **)&buf, &len);
+
+    u64 *entries = malloc(nchunks * 2 * sizeof(u64));
+    if (entries != NULL && status == 0 && len == index_size) {
+        for (s64 i = 0; i < nchunks * 2; i++) {
+            entries[i] = vs__read_le64(buf + i * 8);
+        }
+    } else if (entries != NULL && status > 0) {
+        LOG_INFO("shard %s does not exist", key);
+        memset(entries, 0xff, nchunks * 2 * sizeof(u64));
+    } else {
+        LOG_ERROR("could not download the index of shard %s from %s", key, vol->store->root);
+        free(entries);
+        entries = NULL;
+    }
+    free(buf);
+
+    if (entries == NULL) {
+        complete_cache(vol->shard_index, sx, sy, sz, NULL);
+        return NULL;
+    }
+    MemoryChunk mem = {.data = (unsigned char *)entries, .size = nchunks * 2 * sizeof(u64)};
+    return complete_cache(vol->shard_index, sx, sy, sz, &mem);
+}
+
+// finds the bytes of block z, y, x in its shard
+//   - 0 on success, 1 if the block is empty, -1 if the shard index could not be downloaded
+static int vs__vol_shard_range(volume *vol, s32 z, s32 y, s32 x, s64 *offset, s64 *length) {
+    LRUNode *node = vs__vol_get_shard_index(vol, z, y, x);
+    if (node == NULL) {
+        return -1;
+    }
+    zarr_metadata *m = &vol->metadata;
+    s32 per[3] = {m->shard_shape[0] / m->chunks[0], m->shard_shape[1] / m->chunks[1], m->shard_shape[2] / m->chunks[2]};
+    s64 i = ((s64)(z % per[0]) * per[1] + y % per[1]) * per[2] + x % per[2];
+    const u64 *entries = (const u64 *)node->chunk.data;
+    u64 off = entries[i * 2];
+    u64 len = entries[i * 2 + 1];
+    release_cache(vol->shard_index, node);
+
+    if (off == UINT64_MAX && len == UINT64_MAX) {
+        return 1;
+    }
+    *offset = (s64)off;
+    *length = (s64)len;
+    return 0;
+}
+
+// returns the decompressed zarr block at block index z, y, x pinned in the volume cache, as a tchunk in the volume's dtype
+//   - 0 on success, 1 if the block could not be downloaded, -1 on any other failure
+static int vs__vol_get_block(volume *vol, s32 z, s32 y, s32 x, LRUNode **out) {
+    // concurrent callers asking for the same missing block wait here for the first one to load it
+    LRUNode *node = NULL;
+    int claim = claim_cache(vol->cache, x, y, z, 1, &node);
+    stats_chunk_read(claim);
+    if (claim == CACHE_HIT) {
+        *out = node;
+        return 0;
+    } else if (claim == CACHE_FAILED) {
+        return 1;
+    }
+
+    tchunk *c = NULL;
+    int status = vs__vol_read_block(vol, z, y, x, &c);
+    if (status > 0) {
+        char key[256] = {'\0'};
+        vs__vol_object_key(vol, z, y, x, key, sizeof(key));
+        LOG_INFO("downloading block %s from %s", key, vol->store->root);
+        void *compressed_buf = NULL;
+        s64 compressed_size = 0;
+        s64 offset = 0, length = 0;
+        int shard = vol->shard_index ? vs__vol_shard_range(vol, z, y, x, &offset, &length) : 0;
+        int found = shard == 0 ? vs_store_get_range(vol->store, key, offset, length, &compressed_buf, &compressed_size) : -1;
+        if (found == 0 && compressed_size > 0) {
+            c = vs_zarr_decompress_tchunk(compressed_size, compressed_buf, vol->metadata);
+        }
+        if (c == NULL && (shard > 0 || found > 0)) {
+            // zarr doesn't store blocks that only hold the fill value
+            LOG_INFO("block %s does not exist", key);
+            c = vs__vol_missing_block();
+            status = c != NULL && vs__vol_write_missing(vol, z, y, x) == 0 ? 0 : -1;
+            if (status) {
+                vs_tchunk_free(c);
+                c = NULL;
+            }
+        } else if (c == NULL) {
+            //NOTE: the block is skipped and its region left at 0, the next read tries again
+            LOG_ERROR("could not download block %s from %s", key, vol->store->root);
+        } else {
+            LOG_INFO("downloaded block %s from %s", key, vol->store->root);
+            status = 0;
+            if (vs__vol_write_block(vol, z, y, x, compressed_buf, compressed_size)) {
+                vs_tchunk_free(c);
+                c = NULL;
+                status = -1;
+            }
+        }
+        free(compressed_buf);
+    }
+
+    node = vs__vol_cache_block(vol, z, y, x, c);
+    if (node == NULL) {
+        return status != 0 ? status : -1;
+    }
+    *out = node;
+    return 0;
+}
+
+// copies the part of block z, y, x that overlaps the requested region into dest, row by row
+//   - dest holds chunk_dims voxels of dest_dtype, block voxels are converted if their dtype differs
+//   - dest starts out zeroed. for a missing block, see vs__vol_missing_block, the overlap is set to the fill value
+static void vs__vol_graft_block(volume *vol, void *dest, vs_dtype dest_dtype, s32 vol_start[static 3], s32 chunk_dims[static 3], s32 z, s32 y, s32 x, tchunk *block) {
+    s32 src_start[3] = {
+        MAX(0, vol_start[0] - z * vol->metadata.chunks[0]),
+        MAX(0, vol_start[1] - y * vol->metadata.chunks[1]),
+        MAX(0, vol_start[2] - x * vol->metadata.chunks[2])
+      };
+
+    s32 dest_start[3] = {
+        MAX(0, z * vol->metadata.chunks[0] - vol_start[0]),
+        MAX(0, y * vol->metadata.chunks[1] - vol_start[1]),
+        MAX(0, x * vol->metadata.chunks[2] - vol_start[2])
+      };
+
+    // edge blocks are stored padded to the full block size, the padding past the volume shape is not copied
+    s32 copy_dims[3] = {
+        MIN(MIN(vol->metadata.chunks[0] - src_start[0], chunk_dims[0] - dest_start[0]), vol->metadata.shape[0] - vol_start[0] - dest_start[0]),
+        MIN(MIN(vol->metadata.chunks[1] - src_start[1], chunk_dims[1] - dest_start[1]), vol->metadata.shape[1] - vol_start[1] - dest_start[1]),
+        MIN(MIN(vol->metadata.chunks[2] - src_start[2], chunk_dims[2] - dest_start[2]), vol->metadata.shape[2] - vol_start[2] - dest_start[2])
+      };
+
+    s32 dest_size = vs_dtype_size(dest_dtype);
+    u64 start = stats_now_ns();
+    if (block->dims[0] == 0) {
+        if (vol->metadata.fill_value == 0) {
+            // dest is already zeroed
+            stats_record(&STATS.graft, stats_now_ns() - start);
+            return;
+        }
+        f32 fill = (f32)vol->metadata.fill_value;
+        u8 value[sizeof(f32)];
+        vs__convert(value, dest_dtype, &fill, VS_F32, 1);
+        for (s32 i = 0; i < copy_dims[0]; i++) {
+            for (s32 j = 0; j < copy_dims[1]; j++) {
+                s64 dest_i = ((s64)(dest_start[0] + i) * chunk_dims[1] + dest_start[1] + j) * chunk_dims[2] + dest_start[2];
+                for (s32 k = 0; k < copy_dims[2]; k++) {
+                    memcpy((u8 *)dest + (dest_i + k) * dest_size, value, dest_size);
+                }
+            }
+        }
+        stats_record(&STATS.graft, stats_now_ns() - start);
+        return;
+    }
+
+    s32 src_size = vs_dtype_size(block->dtype);
+    for (s32 i = 0; i < copy_dims[0]; i++) {
+        for (s32 j = 0; j < copy_dims[1]; j++) {
+            s64 src_i = ((s64)(src_start[0] + i) * block->dims[1] + src_start[1] + j) * block->dims[2] + src_start[2];
+            s64 dest_i = ((s64)(dest_start[0] + i) * chunk_dims[1] + dest_start[1] + j) * chunk_dims[2] + dest_start[2];
+            vs__convert((u8 *)dest + dest_i * dest_size, dest_dtype, block->data + src_i * src_size, block->dtype, copy_dims[2]);
+        }
+    }
+    stats_record(&STATS.graft, stats_now_ns() - start);
+}
+
+// where block z, y, x can be decompressed straight into dest instead of being grafted row by row, NULL if it can't
+//   - dest has to be in the zarr's dtype, and exactly one block wide and high and lined up with the blocks,
+//     so a block it covers is one contiguous run of dest
+//   - edge blocks padded past the volume shape don't qualify
+static void *vs__vol_block_dest(volume *vol, void *dest, vs_dtype dest_dtype, s32 vol_start[static 3], s32 chunk_dims[static 3], s32 z, s32 y, s32 x) {
+    zarr_metadata *m = &vol->metadata;
+    vs_dtype dtype;
+    if (dest == NULL || vs__zarr_dtype(m, &dtype, NULL) || dtype != dest_dtype ||
+        chunk_dims[1] != m->chunks[1] || chunk_dims[2] != m->chunks[2]) {
+        return NULL;
+    }
+    s32 pos[3] = {z, y, x};
+    for (int i = 0; i < 3; i++) {
+        s32 origin = pos[i] * m->chunks[i];
+        if (origin < vol_start[i] || origin + m->chunks[i] > vol_start[i] + chunk_dims[i] || origin + m->chunks[i] > m->shape[i]) {
+            return NULL;
+        }
+    }
+    return (u8 *)dest + (s64)(z * m->chunks[0] - vol_start[0]) * m->chunks[1] * m->chunks[2] * vs_dtype_size(dtype);
+}
+
+// state shared by vs_vol_get_chunk with the callback of its parallel block downloads
+typedef struct {
+    volume *vol;
+    void *dest;
+    vs_dtype dest_dtype;
+    s32 *vol_start;
+    s32 *chunk_dims;
+    s32 *blocks;  // z, y, x of every downloaded block
+    int failed;
+} vs__block_download;
+
+// decompresses, caches and grafts a block as soon as its download finishes
+static void vs__vol_block_downloaded(int index, MemoryChunk *body, long http_code, void *userdata) {
+    vs__block_download *dl = userdata;
+    s32 z = dl->blocks[index * 3];
+    s32 y = dl->blocks[index * 3 + 1];
+    s32 x = dl->blocks[index * 3 + 2];
+
+    // a block that lands in dest whole is decompressed straight into it and a copy is cached
+    void *direct = vs__vol_block_dest(dl->vol, dl->dest, dl->dest_dtype, dl->vol_start, dl->chunk_dims, z, y, x);
+    if (direct != NULL && body->data != NULL && (http_code == 200 || http_code == 206)) {
+        if (vs__zarr_decompress_into(body->size, body->data, &dl->vol->metadata, direct) == 0) {
+            int written = vs__vol_write_block(dl->vol, z, y, x, body->data, body->size);
+            free(body->data);
+            body->data = NULL;
+            if (written) {
+                vs__vol_cache_block(dl->vol, z, y, x, NULL);
+                dl->failed = 1;
+            } else {
+                vs__vol_cache_block_copy(dl->vol, z, y, x, direct);
+            }
+            return;
+        }
+        // a failed block is skipped, its region has to go back to 0
+        zarr_metadata *m = &dl->vol->metadata;
+        memset(direct, 0, (size_t)m->chunks[0] * m->chunks[1] * m->chunks[2] * vs_dtype_size(dl->dest_dtype));
+    }
+
+    tchunk *c = NULL;
+    if (body->data != NULL && (http_code == 200 || http_code == 206)) {
+        c = vs_zarr_decompress_tchunk(body->size, body->data, dl->vol->metadata);
+    }
+    bool missing = c == NULL && http_code == 404;
+    if (missing) {
+        LOG_INFO("block %d/%d/%d does not exist", z, y, x);
+        c = vs__vol_missing_block();
+    } else if (c == NULL) {
+        //NOTE: blocks that fail to download are skipped, see vs__vol_get_block
+        LOG_ERROR("could not download block %d/%d/%d, http status %ld", z, y, x, http_code);
+    }
+    if (c == NULL) {
+        free(body->data);
+        body->data = NULL;
+        vs__vol_cache_block(dl->vol, z, y, x, NULL);
+        dl->failed |= missing;
+        return;
+    }
+
+    int written = missing ? vs__vol_write_missing(dl->vol, z, y, x)
+                          : vs__vol_write_block(dl->vol, z, y, x, body->data, body->size);
+    free(body->data);
+    body->data = NULL;
+    if (written) {
+        vs_tchunk_free(c);
+        vs__vol_cache_block(dl->vol, z, y, x, NULL);
+        dl->failed = 1;
+        return;
+    }
+
+    LRUNode *node = vs__vol_cache_block(dl->vol, z, y, x, c);
+    if (node == NULL) {
+        dl->failed = 1;
+        return;
+    }
+    if (dl->dest) {
+        vs__vol_graft_block(dl->vol, dl->dest, dl->dest_dtype, dl->vol_start, dl->chunk_dims, z, y, x, (tchunk *)node->chunk.data);
+    }
+    release_cache(dl->vol->cache, node);
+}
+
+// reads the objects at keys from vol->store, calling on_done with each one like download_parallel_ranges does
+//   - ranges holds an offset and a length per object, or is NULL to read them whole
+//   - http stores download MAX_PARALLEL_DOWNLOADS objects at a time, other stores are read one after another.
+//     objects a store doesn't have are reported as a 404, failed reads as 0
+static void vs__vol_fetch_objects(volume *vol, char **keys, s64 *ranges, int count, download_callback on_done, void *userdata) {
+    if (vol->store->ops == &vs__http_store_ops) {
+        char **urls = malloc(count * sizeof(char *));
+        char *buf = malloc((size_t)count * 1300);
+        if (count > 0 && (urls == NULL || buf == NULL)) {
+            LOG_ERROR("failed to allocate memory");
+            free(urls);
+            free(buf);
+            for (int i = 0; i < count; i++) {
+                on_done(i, &(MemoryChunk){0}, 0, userdata);
+            }
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            urls[i] = buf + (size_t)i * 1300;
+            snprintf(urls[i], 1300, "%s/%s", vol->store->root, keys[i]);
+        }
+        download_parallel_ranges(urls, ranges, count, MAX_PARALLEL_DOWNLOADS, on_done, userdata);
+        free(urls);
+        free(buf);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        MemoryChunk body = {0};
+        s64 size = 0;
+        void *data = NULL;
+        int status = vs_store_get_range(vol->store, keys[i], ranges ? ranges[i * 2] : 0, ranges ? ranges[i * 2 + 1] : 0, &data, &size);
+        if (status == 0) {
+            body.data = data;
+            body.size = size;
+        }
+        on_done(i, &body, status == 0 ? 200 : status > 0 ? 404 : 0, userdata);
+        free(body.data);
+    }
+}
+
+// loads the listed blocks (z, y, x triples) into the caches and grafts them into dest
+//   - blocks missing from both caches are downloaded, see vs__vol_fetch_objects, and grafted as each one arrives.
+//     blocks another thread is already loading are picked up afterwards
+//   - with dest NULL the blocks are only cached, and blocks another thread is loading are skipped
+//   - blocks that fill a contiguous run of dest are decompressed straight into it and a copy is cached, see vs__vol_block_dest
+//   - 0 on success, 1 on failure. blocks that could not be downloaded are skipped, not failures, and blocks that
+//     don't exist are grafted as the fill value
+static int vs__vol_fetch_blocks(volume *vol, s32 *blocks, int nblocks, void *dest, vs_dtype dest_dtype, s32 vol_start[static 3], s32 chunk_dims[static 3]) {
+    vs__block_download dl = {vol, dest, dest_dtype, vol_start, chunk_dims, malloc(nblocks * 3 * sizeof(s32)), 0};
+    s32 *deferred = malloc(nblocks * 3 * sizeof(s32));
+    char **keys = malloc(nblocks * sizeof(char *));
+    // offset and length of every download within its shard
+    s64 *ranges = vol->shard_index ? malloc(nblocks * 2 * sizeof(s64)) : NULL;
+    if (dl.blocks == NULL || deferred == NULL || keys == NULL || (vol->shard_index && ranges == NULL)) {
+        LOG_ERROR("failed to allocate memory");
+        free(dl.blocks);
+        free(deferred);
+        free(keys);
+        free(ranges);
+        return 1;
+    }
+    int ndownloads = 0;
+    int ndeferred = 0;
+
+    for (int i = 0; i < nblocks; i++) {
+        s32 z = blocks[i * 3];
+        s32 y = blocks[i * 3 + 1];
+        s32 x = blocks[i * 3 + 2];
+        LRUNode *block = NULL;
+        int claim = claim_cache(vol->cache, x, y, z, 0, &block);
+        // pending blocks are counted when vs__vol_get_block picks them up below
+        if (dest && claim != CACHE_PENDING) {
+            stats_chunk_read(claim);
+        }
+        if (claim == CACHE_CLAIMED) {
+            void *direct = vs__vol_block_dest(vol, dest, dest_dtype, vol_start, chunk_dims, z, y, x);
+            if (direct != NULL && vs__vol_read_block_into(vol, z, y, x, direct) == 0) {
+                vs__vol_cache_block_copy(vol, z, y, x, direct);
+                continue;
+            }
+            tchunk *c = NULL;
+            int status = vs__vol_read_block(vol, z, y, x, &c);
+            int shard = status > 0 && ranges ? vs__vol_shard_range(vol, z, y, x, &ranges[ndownloads * 2], &ranges[ndownloads * 2 + 1]) : 0;
+            if (shard < 0) {
+                // without the shard index the block is skipped like a failed download
+                vs__vol_cache_block(vol, z, y, x, NULL);
+                continue;
+            }
+            if (shard > 0) {
+                // empty inner chunks are missing blocks
+                c = vs__vol_missing_block();
+                status = c != NULL && vs__vol_write_missing(vol, z, y, x) == 0 ? 0 : -1;
+                if (status) {
+                    vs_tchunk_free(c);
+                    c = NULL;
+                }
+            }
+            char *key = status > 0 ? malloc(256) : NULL;
+            if (key != NULL) {
+                vs__vol_object_key(vol, z, y, x, key, 256);
+                LOG_INFO("downloading block %s from %s", key, vol->store->root);
+                keys[ndownloads] = key;
+                dl.blocks[ndownloads * 3] = z;
+                dl.blocks[ndownloads * 3 + 1] = y;
+                dl.blocks[ndownloads * 3 + 2] = x;
+                ndownloads++;
+                continue;
+            }
+            block = vs__vol_cache_block(vol, z, y, x, c);
+            if (block == NULL) {
+                dl.failed = 1;
+                continue;
+            }
+            claim = CACHE_HIT;
+        }
 
-    if (!header_complete || *width == 0 || *height == 0 || *dim == 0 ||
-        (strcmp(src_type, "float") != 0 && strcmp(src_type, "double") != 0) ||
-        !ordered) {
-        LOG_ERROR("Error: Invalid header (w=%zu h=%zu d=%zu t=%s o=%d)\n",
-                *width, *height, *dim, src_type, ordered);
-        fclose(fp);
-        return 1;
+        if (claim == CACHE_HIT) {
+            if (dest) {
+                vs__vol_graft_block(vol, dest, dest_dtype, vol_start, chunk_dims, z, y, x, (tchunk *)block->chunk.data);
+            }
+            release_cache(vol->cache, block);
+        } else if (claim == CACHE_PENDING && dest) {
+            deferred[ndeferred * 3] = z;
+            deferred[ndeferred * 3 + 1] = y;
+            deferred[ndeferred * 3 + 2] = x;
+            ndeferred++;
+        }
+        // CACHE_FAILED: another thread could not download the block, skip it like vs__vol_get_block does
+    }
+
+    // every block claimed above is completed in here, so waiting on other threads afterwards can't deadlock
+    vs__vol_fetch_objects(vol, keys, ranges, ndownloads, vs__vol_block_downloaded, &dl);
+    for (int i = 0; i < ndownloads; i++) {
+        free(keys[i]);
+    }
+
+    for (int i = 0; i < ndeferred && !dl.failed; i++) {
+        s32 z = deferred[i * 3];
+        s32 y = deferred[i * 3 + 1];
+        s32 x = deferred[i * 3 + 2];
+        LRUNode *block = NULL;
+        int status = vs__vol_get_block(vol, z, y, x, &block);
+        if (status < 0) {
+            dl.failed = 1;
+        } else if (status == 0) {
+            vs__vol_graft_block(vol, dest, dest_dtype, vol_start, chunk_dims, z, y, x, (tchunk *)block->chunk.data);
+            release_cache(vol->cache, block);
+        }
     }
 
-    size_t total_points = (*width) * (*height) * (*dim);
-    int status = vs__vcps_read_binary_data(fp, data, src_type, dst_type, total_points);
-
-    fclose(fp);
-    return status;
+    free(dl.blocks);
+    free(deferred);
+    free(keys);
+    free(ranges);
+    return dl.failed;
 }
 
-int vs_vcps_write(const char* filename,
-               size_t width, size_t height, size_t dim,
-               const void* data, const char* src_type, const char* dst_type) {
-    if (!src_type || !dst_type ||
-        (strcmp(src_type, "float") != 0 && strcmp(src_type, "double") != 0) ||
-        (strcmp(dst_type, "float") != 0 && strcmp(dst_type, "double") != 0)) {
-        LOG_ERROR("Error: Invalid type specification\n");
-        return 1;
+// reads the region into dest, which holds chunk_dims voxels of dest_dtype. 0 on success, 1 on failure
+//   - vol_start can be anywhere in the volume and chunk_dims any size, neither has to line up with the zarr blocks
+//   - voxels past the edge of the volume are 0, voxels in blocks that don't exist are the zarr's fill_value
+static int vs__vol_read_region(volume *vol, s32 vol_start[static 3], s32 chunk_dims[static 3], void *dest, vs_dtype dest_dtype) {
+    // the part of the region inside the volume, only the blocks it overlaps are read
+    s32 read_dims[3];
+    for (int i = 0; i < 3; i++) {
+        if (vol_start[i] < 0 || vol_start[i] >= vol->metadata.shape[i] || chunk_dims[i] <= 0) {
+            LOG_ERROR("region starting at %d/%d/%d with dims %d/%d/%d is not in the volume",
+                      vol_start[0], vol_start[1], vol_start[2], chunk_dims[0], chunk_dims[1], chunk_dims[2]);
+            return 1;
+        }
+        read_dims[i] = MIN(chunk_dims[i], vol->metadata.shape[i] - vol_start[i]);
     }
+    memset(dest, 0, (size_t)chunk_dims[0] * chunk_dims[1] * chunk_dims[2] * vs_dtype_size(dest_dtype));
 
-    FILE* fp = fopen(filename, "w");
-    if (!fp) return 1;
-
-    // Write header
-    fprintf(fp, "width: %zu\n", width);
-    fprintf(fp, "height: %zu\n", height);
-    fprintf(fp, "dim: %zu\n", dim);
-    fprintf(fp, "ordered: true\n");
-    fprintf(fp, "type: %s\n", dst_type);
-    fprintf(fp, "version: 1\n");
-    fprintf(fp, "<>\n");
-    fclose(fp);
+    int nblocks = 0;
+    s32 *blocks = vs__vol_blocks_in(vol, vol_start, read_dims, &nblocks);
+    if (blocks == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        return 1;
+    }
 
-    // Reopen in binary append mode for data
-    fp = fopen(filename, "ab");
-    if (!fp) return 1;
+    int failed = vs__vol_fetch_blocks(vol, blocks, nblocks, dest, dest_dtype, vol_start, chunk_dims);
+    free(blocks);
+    if (failed) {
+        return 1;
+    }
+    vs__vol_readahead(vol, vol_start, read_dims);
+    return 0;
+}
 
-    size_t total_points = width * height * dim;
-    int status = vs__vcps_write_binary_data(fp, data, src_type, dst_type, total_points);
+chunk *vs_vol_get_chunk(volume *vol, s32 vol_start[static 3], s32 chunk_dims[static 3]) {
+    chunk *ret = vs_chunk_new(chunk_dims);
+    if (ret == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        return NULL;
+    }
+    if (vs__vol_read_region(vol, vol_start, chunk_dims, ret->data, VS_F32)) {
+        vs_chunk_free(ret);
+        return NULL;
+    }
+    return ret;
+}
 
-    fclose(fp);
-    return status;
+// like vs_vol_get_chunk, but the voxels keep the volume's dtype
+tchunk *vs_vol_get_tchunk(volume *vol, s32 vol_start[static 3], s32 chunk_dims[static 3]) {
+    vs_dtype dtype;
+    if (vs__zarr_dtype(&vol->metadata, &dtype, NULL)) {
+        return NULL;
+    }
+    tchunk *ret = vs_tchunk_new(chunk_dims, dtype);
+    if (ret == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        return NULL;
+    }
+    if (vs__vol_read_region(vol, vol_start, chunk_dims, ret->data, dtype)) {
+        vs_tchunk_free(ret);
+        return NULL;
+    }
+    return ret;
 }
 
-// vol
+// opens the OME-Zarr group at url, reading its multiscales from .zattrs, or from zarr.json for zarr v3
+//   - url can also be a local directory, see vs_store_open
+//   - the levels are opened by vs_multiscale_level, each level caches its blocks in cache_dir/<level path>.
+//     cache_dir NULL or empty opens the levels without a disk cache
+multiscale *vs_multiscale_new(char *cache_dir, char *url) {
+  vs_store *store = vs_store_open(url);
+  if (store == NULL) {
+    return NULL;
+  }
+  char *attrs_buf = NULL;
+  LOG_INFO("trying to read .zattrs from %s", url);
+  if (vs__store_get_text(store, ".zattrs", &attrs_buf) != 0) {
+    LOG_INFO("trying to read zarr.json from %s", url);
+    if (vs__store_get_text(store, "zarr.json", &attrs_buf) != 0) {
+      LOG_ERROR("could not read .zattrs or zarr.json file!");
+      vs_store_free(store);
+      return NULL;
+    }
+  }
+  vs_store_free(store);
 
-volume *vs_vol_new(char *cache_dir, char *url) {
-  volume *ret = malloc(sizeof(volume));
+  multiscale *ret = calloc(1, sizeof(multiscale));
   if (ret == NULL) {
+    LOG_ERROR("failed to allocate memory");
+    free(attrs_buf);
     return NULL;
   }
+  if (vs_zarr_parse_multiscales(attrs_buf, ret)) {
+    LOG_ERROR("failed to parse the multiscales of %s", url);
+    free(attrs_buf);
+    free(ret);
+    return NULL;
+  }
+  free(attrs_buf);
 
-
-  if (cache_dir != NULL) {
-    if (vs__mkdir_p(cache_dir)) {
-      LOG_ERROR("Could not mkdir %s",cache_dir);
-      return NULL;
-    }
+  strncpy(ret->url, url, sizeof(ret->url) - 1);
+  ret->disk_cache = cache_dir != NULL && cache_dir[0] != '\0';
+  if (ret->disk_cache) {
+    strncpy(ret->cache_dir, cache_dir, sizeof(ret->cache_dir) - 1);
   }
+  pthread_mutex_init(&ret->lock, NULL);
+  return ret;
+}
 
-  void* zarray_buf = NULL;
-  if (url != NULL) {
-    char zarray_url[1024] = {'\0'};
-    snprintf(zarray_url,1023,"%s/.zarray",url);
-    LOG_INFO("trying to read .zarray from %s",zarray_url);
-    if (vs_download(zarray_url, &zarray_buf) <= 0) {
-      LOG_ERROR("could not download .zarray file!");
-      return NULL;
+void vs_multiscale_free(multiscale *ms) {
+  if (ms) {
+    for (int i = 0; i < ms->nlevels; i++) {
+      vs_vol_free(ms->levels[i]);
     }
+    pthread_mutex_destroy(&ms->lock);
+    free(ms);
   }
-  zarr_metadata metadata;
-  if (vs_zarr_parse_metadata(zarray_buf,&metadata)) {
-    LOG_ERROR("failed to parse .zarray");
+}
+
+// returns level of the multiscale, opening it on first use. the multiscale keeps ownership of the volume
+//   - NULL if the level doesn't exist or can't be opened
+volume *vs_multiscale_level(multiscale *ms, int level) {
+  if (level < 0 || level >= ms->nlevels) {
+    LOG_ERROR("level %d is not in the multiscale, it has %d levels", level, ms->nlevels);
     return NULL;
   }
 
-  strncpy(ret->url,url,sizeof(ret->url));
-  strncpy(ret->cache_dir,cache_dir,sizeof(ret->cache_dir));
-  ret->metadata = metadata;
-
-  free(zarray_buf);
+  pthread_mutex_lock(&ms->lock);
+  if (ms->levels[level] == NULL) {
+    char url[1024], cache_dir[1024];
+    snprintf(url, sizeof(url), "%s/%s", ms->url, ms->paths[level]);
+    snprintf(cache_dir, sizeof(cache_dir), "%s/%s", ms->cache_dir, ms->paths[level]);
+    ms->levels[level] = vs_vol_new(ms->disk_cache ? cache_dir : NULL, url);
+  }
+  volume *ret = ms->levels[level];
+  pthread_mutex_unlock(&ms->lock);
   return ret;
 }
 
-void vs_vol_free(volume* vol) {
-    if (vol) {
-        free(vol);
+// how many level 0 voxels along axis (0 = z, 1 = y, 2 = x) one voxel of level spans
+s32 vs_multiscale_factor(multiscale *ms, int level, int axis) {
+  return MAX(1, (s32)lroundf(ms->scales[level][axis] / ms->scales[0][axis]));
+}
+
+// returns the coarsest level whose voxels are no larger than voxel_size level 0 voxels along every axis
+//   - e.g. 8 picks the level downsampled 8 times if there is one, 1 or less always picks level 0
+int vs_multiscale_pick_level(multiscale *ms, f32 voxel_size) {
+  int ret = 0;
+  for (int level = 1; level < ms->nlevels; level++) {
+    bool fits = true;
+    for (int i = 0; i < 3; i++) {
+      // a little slack so that scales like 7.91 * 8 / 7.91 don't miss because of rounding
+      fits &= ms->scales[level][i] / ms->scales[0][i] <= voxel_size * 1.001f;
+    }
+    if (fits) {
+      ret = level;
     }
+  }
+  return ret;
 }
 
-chunk *vs_vol_get_chunk(volume *vol, s32 vol_start[static 3], s32 chunk_dims[static 3]) {
-    //TODO: support arbitrary starts and sizes within the volume
-    //for now, we will assume that the volume starts and chunk dimensions are aligned with the zarr block sizes within
-    // volume because it makes the index calculations much easier
+// reads the region at start with dims, both in level 0 voxels, from the coarsest level that resolves voxel_size,
+// see vs_multiscale_pick_level
+//   - the chunk is in that level's voxels: start and start + dims are divided by the level's downsampling factor,
+//     rounding outwards, so it covers the whole region
+//   - the level read is stored in *level unless level is NULL
+chunk *vs_multiscale_get_chunk(multiscale *ms, s32 start[static 3], s32 dims[static 3], f32 voxel_size, int *level) {
+  int l = vs_multiscale_pick_level(ms, voxel_size);
+  volume *vol = vs_multiscale_level(ms, l);
+  if (vol == NULL) {
+    return NULL;
+  }
 
-    //TODO: make sure that we aren't readng past the end of the chunk if the chunk happens to be the last chunk
-    //in a given dimension
+  s32 level_start[3], level_dims[3];
+  for (int i = 0; i < 3; i++) {
+    s32 factor = vs_multiscale_factor(ms, l, i);
+    level_start[i] = start[i] / factor;
+    level_dims[i] = (start[i] + dims[i] + factor - 1) / factor - level_start[i];
+  }
+  LOG_INFO("reading level %d for a voxel size of %g", l, voxel_size);
+  if (level) {
+    *level = l;
+  }
+  return vs_vol_get_chunk(vol, level_start, level_dims);
+}
 
-    if (vol_start[0] % vol->metadata.chunks[0] != 0) {
-        LOG_ERROR("vol_start indices must be a multiple of the zrr block size %d", vol->metadata.chunks[0]);
-        return NULL;
-    }
+// returns the z, y, x index of every block overlapping the region, NULL if out of memory
+static s32 *vs__vol_blocks_in(volume *vol, s32 start[static 3], s32 dims[static 3], int *nblocks) {
+    int zstart = start[0] / vol->metadata.chunks[0];
+    int ystart = start[1] / vol->metadata.chunks[1];
+    int xstart = start[2] / vol->metadata.chunks[2];
+    int zend = (start[0] + dims[0]-1) / vol->metadata.chunks[0];
+    int yend = (start[1] + dims[1]-1) / vol->metadata.chunks[1];
+    int xend = (start[2] + dims[2]-1) / vol->metadata.chunks[2];
+    *nblocks = (zend - zstart + 1) * (yend - ystart + 1) * (xend - xstart + 1);
 
-    if (vol_start[1] % vol->metadata.chunks[1] != 0) {
-        LOG_ERROR("vol_start indices must be a multiple of the zrr block size %d", vol->metadata.chunks[1]);
+    s32 *blocks = malloc(*nblocks * 3 * sizeof(s32));
+    if (blocks == NULL) {
         return NULL;
     }
-
-    if (vol_start[2] % vol->metadata.chunks[2] != 0) {
-        LOG_ERROR("vol_start indices must be a multiple of the zrr block size %d", vol->metadata.chunks[2]);
-        return NULL;
+    int i = 0;
+    for (int z = zstart; z <= zend; z++) {
+        for (int y = ystart; y <= yend; y++) {
+            for (int x = xstart; x <= xend; x++) {
+                blocks[i++] = z;
+                blocks[i++] = y;
+                blocks[i++] = x;
+            }
+        }
     }
+    return blocks;
+}
 
-    if (chunk_dims[0] % vol->metadata.chunks[0] != 0) {
-        LOG_ERROR("chunk_dims must be a multiple of the zrr block size %d", vol->metadata.chunks[0]);
-        return NULL;
+// feeds a read to the volume's sweep tracker and prefetches the block layers ahead of a sweep
+static void vs__vol_readahead(volume *vol, s32 start[static 3], s32 dims[static 3]) {
+    s32 ahead_start[3], ahead_dims[3];
+    pthread_mutex_lock(&vol->prefetch.lock);
+    int ahead = track_sweep(&vol->prefetch.sweep, start, dims, vol->metadata.chunks, vol->prefetch.readahead,
+                            ahead_start, ahead_dims);
+    pthread_mutex_unlock(&vol->prefetch.lock);
+    if (ahead) {
+        vs_vol_prefetch(vol, ahead_start, ahead_dims);
     }
+}
 
-    if (chunk_dims[1] % vol->metadata.chunks[1] != 0) {
-        LOG_ERROR("chunk_dims must be a multiple of the zrr block size %d", vol->metadata.chunks[1]);
-        return NULL;
-    }
+// sets how many block layers are prefetched ahead of reads that sweep along an axis, 0 disables read-ahead
+void vs_vol_set_readahead(volume *vol, int depth) {
+    pthread_mutex_lock(&vol->prefetch.lock);
+    vol->prefetch.readahead = MAX(0, depth);
+    pthread_mutex_unlock(&vol->prefetch.lock);
+}
 
-    if (chunk_dims[2] % vol->metadata.chunks[2] != 0) {
-        LOG_ERROR("chunk_dims must be a multiple of the zrr block size %d", vol->metadata.chunks[2]);
+static void *vs__vol_prefetch_worker(void *arg) {
+    volume *vol = arg;
+    vs__prefetcher *pf = &vol->prefetch;
+    // the threads split the download budget between them
+    int batch = MAX(1, MAX_PARALLEL_DOWNLOADS / VS_PREFETCH_THREADS);
+    s32 *blocks = malloc(batch * 3 * sizeof(s32));
+    if (blocks == NULL) {
+        LOG_ERROR("failed to allocate memory");
         return NULL;
     }
+    s32 zero[3] = {0, 0, 0};
 
-    chunk *ret = vs_chunk_new(chunk_dims);
+    pthread_mutex_lock(&pf->lock);
+    for (;;) {
+        while (!pf->stop && pf->head == pf->count) {
+            pthread_cond_wait(&pf->work, &pf->lock);
+        }
+        if (pf->stop) {
+            break;
+        }
 
-    int zstart = vol_start[0] / vol->metadata.chunks[0];
-    int ystart = vol_start[1] / vol->metadata.chunks[1];
-    int xstart = vol_start[2] / vol->metadata.chunks[2];
-    int zend = (vol_start[0] + chunk_dims[0]-1) / vol->metadata.chunks[0];
-    int yend = (vol_start[1] + chunk_dims[1]-1) / vol->metadata.chunks[1];
-    int xend = (vol_start[2] + chunk_dims[2]-1) / vol->metadata.chunks[2];
+        int n = MIN(batch, pf->count - pf->head);
+        memcpy(blocks, &pf->queue[pf->head * 3], n * 3 * sizeof(s32));
+        pf->head += n;
+        if (pf->head == pf->count) {
+            pf->head = pf->count = 0;
+        }
+        pf->busy++;
+        pthread_mutex_unlock(&pf->lock);
 
+        if (vs__vol_fetch_blocks(vol, blocks, n, NULL, VS_F32, zero, zero)) {
+            LOG_ERROR("failed to prefetch blocks");
+        }
 
-    for (int z = zstart; z <= zend; z++) {
-        for (int y = ystart; y <= yend; y++) {
-            for (int x = xstart; x <= xend; x++) {
-                char blockpath[1024] = {'\0'};
-                chunk *c = NULL;
-                snprintf(blockpath, 1023, "%s/%d/%d/%d", vol->cache_dir, z, y, x);
-                LOG_INFO("checking for zarr block at %s", blockpath);
-                if (vs__path_exists(blockpath)) {
-                    LOG_INFO("reading %s from disk", blockpath);
-                    c = vs_zarr_read_chunk(blockpath, vol->metadata);
-                    if (c == NULL) {
-                        LOG_ERROR("failed to read zarr chunk from %s", blockpath);
-                        vs_chunk_free(ret);
-                        return NULL;
-                    }
-                } else {
-                    char url[1024] = {'\0'};
-                    snprintf(url, 1023, "%s/%d/%d/%d", vol->url, z, y, x);
-                    LOG_INFO("downloading block from %s", url);
-                    c = vs_zarr_fetch_block(url, vol->metadata);
-                    if (c == NULL) {
-                        //NOTE: this is not necessarily an error. Some logical blocks do not exist physically because
-                        //they are all zero, and zarr will by default not keep all zero chunk files. so for now we'll assume
-                        //that is the case and just skip it
-                        LOG_ERROR("could not download block from %s", url);
-                        continue;
-                    }
-                    LOG_INFO("downloaded block from %s", url);
-                    LOG_INFO("writing chunk to %s", blockpath);
-                    if (vs_zarr_write_chunk(blockpath, vol->metadata, c)) {
-                        LOG_ERROR("failed to write zarr chunk to %s", blockpath);
-                        vs_chunk_free(c);
-                        vs_chunk_free(ret);
-                        return NULL;
-                    }
+        pthread_mutex_lock(&pf->lock);
+        pf->busy--;
+        if (pf->busy == 0 && pf->head == pf->count) {
+            pthread_cond_broadcast(&pf->idle);
+        }
+    }
+    pthread_mutex_unlock(&pf->lock);
+    free(blocks);
+    return NULL;
+}
+
+// queues the blocks covering the region on the background prefetch threads and returns right away
+//   - the region is clipped to the volume
+//   - blocks that are already in memory or queued are skipped
+int vs_vol_prefetch(volume *vol, s32 start[static 3], s32 dims[static 3]) {
+    s32 first[3], last[3];
+    for (int i = 0; i < 3; i++) {
+        s32 lo = MAX(0, start[i]);
+        s32 hi = MIN(vol->metadata.shape[i], start[i] + dims[i]) - 1;
+        if (hi < lo) {
+            return 0;
+        }
+        first[i] = lo / vol->metadata.chunks[i];
+        last[i] = hi / vol->metadata.chunks[i];
+    }
+
+    vs__prefetcher *pf = &vol->prefetch;
+    pthread_mutex_lock(&pf->lock);
+    if (pf->stop) {
+        pthread_mutex_unlock(&pf->lock);
+        return 1;
+    }
+    while (pf->nthreads < VS_PREFETCH_THREADS) {
+        if (pthread_create(&pf->threads[pf->nthreads], NULL, vs__vol_prefetch_worker, vol)) {
+            break;
+        }
+        pf->nthreads++;
+    }
+    if (pf->nthreads == 0) {
+        pthread_mutex_unlock(&pf->lock);
+        LOG_ERROR("failed to start prefetch threads");
+        return 1;
+    }
+
+    int queued = pf->count - pf->head;
+    for (s32 z = first[0]; z <= last[0]; z++) {
+        for (s32 y = first[1]; y <= last[1]; y++) {
+            for (s32 x = first[2]; x <= last[2]; x++) {
+                LRUNode *cached = get_cache(vol->cache, x, y, z);
+                if (cached) {
+                    release_cache(vol->cache, cached);
+                    continue;
+                }
+                bool dup = false;
+                for (int i = pf->head; i < pf->count && !dup; i++) {
+                    dup = pf->queue[i * 3] == z && pf->queue[i * 3 + 1] == y && pf->queue[i * 3 + 2] == x;
+                }
+                if (dup) {
+                    continue;
                 }
 
-                s32 src_start[3] = {
-                    MAX(0, vol_start[0] - z * vol->metadata.chunks[0]),
-                    MAX(0, vol_start[1] - y * vol->metadata.chunks[1]),
-                    MAX(0, vol_start[2] - x * vol->metadata.chunks[2])
-                  };
-
-                s32 dest_start[3] = {
-                    z * vol->metadata.chunks[0] - vol_start[0],
-                    y * vol->metadata.chunks[1] - vol_start[1],
-                    x * vol->metadata.chunks[2] - vol_start[2]
-                  };
-
-                s32 copy_dims[3] = {
-                    MIN(vol->metadata.chunks[0] - src_start[0], chunk_dims[0] - dest_start[0]),
-                    MIN(vol->metadata.chunks[1] - src_start[1], chunk_dims[1] - dest_start[1]),
-                    MIN(vol->metadata.chunks[2] - src_start[2], chunk_dims[2] - dest_start[2])
-                  };
-
-                if (vs_chunk_graft(ret, c, src_start, dest_start, copy_dims)) {
-                    vs_chunk_free(c);
-                    vs_chunk_free(ret);
-                    LOG_ERROR("failed to graft chunk");
-                    return NULL;
+                if (pf->count == pf->capacity) {
+                    if (pf->head > 0) {
+                        memmove(pf->queue, &pf->queue[pf->head * 3], (pf->count - pf->head) * 3 * sizeof(s32));
+                        pf->count -= pf->head;
+                        pf->head = 0;
+                    } else {
+                        int capacity = pf->capacity ? pf->capacity * 2 : 64;
+                        s32 *queue = realloc(pf->queue, capacity * 3 * sizeof(s32));
+                        if (queue == NULL) {
+                            pthread_cond_broadcast(&pf->work);
+                            pthread_mutex_unlock(&pf->lock);
+                            LOG_ERROR("failed to allocate memory");
+                            return 1;
+                        }
+                        pf->queue = queue;
+                        pf->capacity = capacity;
+                    }
                 }
-                vs_chunk_free(c);
+                pf->queue[pf->count * 3] = z;
+                pf->queue[pf->count * 3 + 1] = y;
+                pf->queue[pf->count * 3 + 2] = x;
+                pf->count++;
             }
         }
     }
-    return ret;
+    if (pf->count - pf->head > queued) {
+        pthread_cond_broadcast(&pf->work);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return 0;
+}
+
+// blocks until every prefetch queued so far has been loaded
+void vs_vol_prefetch_wait(volume *vol) {
+    vs__prefetcher *pf = &vol->prefetch;
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->stop && (pf->busy > 0 || pf->head < pf->count)) {
+        pthread_cond_wait(&pf->idle, &pf->lock);
+    }
+    pthread_mutex_unlock(&pf->lock);
 }
 
 
@@ -4741,39 +8733,270 @@ int vs_zarr_parse_metadata(const char *json_string, zarr_metadata *metadata) {
             strncpy(metadata->compressor.id, id_str, sizeof(metadata->compressor.id) - 1);
             metadata->compressor.id[sizeof(metadata->compressor.id) - 1] = '\0';
         }
-
-        json_object *shuffle;
-        if (json_object_object_get_ex(compressor_value, "shuffle", &shuffle)) {
-            metadata->compressor.shuffle = json_object_get_int(shuffle);
+
+        json_object *shuffle;
+        if (json_object_object_get_ex(compressor_value, "shuffle", &shuffle)) {
+            metadata->compressor.shuffle = json_object_get_int(shuffle);
+        }
+    }
+
+    json_object *dtype_value;
+    if (json_object_object_get_ex(root, "dtype", &dtype_value)) {
+        const char *dtype_str = json_object_get_string(dtype_value);
+        strncpy(metadata->dtype, dtype_str, sizeof(metadata->dtype) - 1);
+        metadata->dtype[sizeof(metadata->dtype) - 1] = '\0';
+    }
+
+    json_object *fill_value;
+    if (json_object_object_get_ex(root, "fill_value", &fill_value)) {
+        metadata->fill_value = json_object_get_int(fill_value);
+    }
+
+    json_object *order_value;
+    if (json_object_object_get_ex(root, "order", &order_value)) {
+        const char *order_str = json_object_get_string(order_value);
+        if (order_str && order_str[0]) {
+            metadata->order = order_str[0];
+        }
+    }
+
+    json_object *separator_value;
+    if (json_object_object_get_ex(root, "dimension_separator", &separator_value)) {
+        const char *separator_str = json_object_get_string(separator_value);
+        if (separator_str && separator_str[0]) {
+            metadata->separator = separator_str[0];
+        }
+    }
+
+    json_object *format_value;
+    if (json_object_object_get_ex(root, "zarr_format", &format_value)) {
+        metadata->zarr_format = json_object_get_int(format_value);
+    }
+
+    if (metadata->zarr_format == 3 && vs__zarr_parse_v3(root, metadata)) {
+        json_object_put(root);
+        return 1;
+    }
+
+    json_object_put(root);
+    return 0;
+}
+
+// reads the last three values of the scale transformation in an OME-Zarr coordinateTransformations list,
+// which are the z, y and x scale. false if there is none
+static bool vs__zarr_parse_scale(json_object *transforms, f32 scale[3]) {
+    if (!json_object_is_type(transforms, json_type_array)) {
+        return false;
+    }
+    for (size_t i = 0; i < json_object_array_length(transforms); i++) {
+        json_object *transform = json_object_array_get_idx(transforms, i);
+        json_object *type, *values;
+        if (json_object_object_get_ex(transform, "type", &type) && strcmp(json_object_get_string(type), "scale") == 0 &&
+            json_object_object_get_ex(transform, "scale", &values) && json_object_array_length(values) >= 3) {
+            size_t n = json_object_array_length(values);
+            for (int j = 0; j < 3; j++) {
+                scale[j] = (f32)json_object_get_double(json_object_array_get_idx(values, n - 3 + j));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// parses the first multiscale image of an OME-Zarr group's attributes into ms->nlevels, ms->paths and ms->scales
+//   - json_string is a .zattrs, or a zarr v3 zarr.json which holds them under attributes.ome
+//   - levels without a scale transformation are assumed to be downsampled 2x per level
+int vs_zarr_parse_multiscales(const char *json_string, multiscale *ms) {
+    json_object *root = json_tokener_parse(json_string);
+    if (!root) {
+        LOG_ERROR("failed to parse JSON");
+        return 1;
+    }
+
+    json_object *attrs = root, *value;
+    if (json_object_object_get_ex(attrs, "attributes", &value)) {
+        attrs = value;
+    }
+    if (json_object_object_get_ex(attrs, "ome", &value)) {
+        attrs = value;
+    }
+    json_object *multiscales, *datasets;
+    if (!json_object_object_get_ex(attrs, "multiscales", &multiscales) ||
+        !json_object_is_type(multiscales, json_type_array) || json_object_array_length(multiscales) == 0 ||
+        !json_object_object_get_ex(json_object_array_get_idx(multiscales, 0), "datasets", &datasets) ||
+        !json_object_is_type(datasets, json_type_array) || json_object_array_length(datasets) == 0) {
+        LOG_ERROR("no multiscales datasets in the attributes");
+        json_object_put(root);
+        return 1;
+    }
+
+    // a scale applied to the whole image on top of each dataset's
+    f32 global[3] = {1.0f, 1.0f, 1.0f};
+    if (json_object_object_get_ex(json_object_array_get_idx(multiscales, 0), "coordinateTransformations", &value)) {
+        vs__zarr_parse_scale(value, global);
+    }
+
+    ms->nlevels = (int)MIN(json_object_array_length(datasets), VS_MAX_LEVELS);
+    for (int level = 0; level < ms->nlevels; level++) {
+        json_object *dataset = json_object_array_get_idx(datasets, level);
+        json_object *path;
+        if (!json_object_object_get_ex(dataset, "path", &path)) {
+            LOG_ERROR("multiscales dataset %d has no path", level);
+            json_object_put(root);
+            return 1;
+        }
+        snprintf(ms->paths[level], sizeof(ms->paths[level]), "%s", json_object_get_string(path));
+
+        f32 *scale = ms->scales[level];
+        if (!json_object_object_get_ex(dataset, "coordinateTransformations", &value) || !vs__zarr_parse_scale(value, scale)) {
+            scale[0] = scale[1] = scale[2] = (f32)(1 << level);
+        }
+        for (int i = 0; i < 3; i++) {
+            scale[i] *= global[i];
+            if (!(scale[i] > 0.0f)) {
+                LOG_ERROR("multiscales dataset %d has an invalid scale", level);
+                json_object_put(root);
+                return 1;
+            }
+        }
+    }
+
+    json_object_put(root);
+    return 0;
+}
+
+// zarr v3 describes chunking and compression with a chunk grid and a chain of codecs, these are mapped
+// onto the v2 fields. a sharded array is described by a single sharding_indexed codec whose own codec
+// chain applies to the inner chunks
+static int vs__zarr_parse_v3(json_object *root, zarr_metadata *metadata) {
+    metadata->separator = '/';
+    metadata->key_prefix = true;
+    json_object *encoding, *name, *config, *value;
+    if (json_object_object_get_ex(root, "chunk_key_encoding", &encoding)) {
+        if (json_object_object_get_ex(encoding, "name", &name) && strcmp(json_object_get_string(name), "v2") == 0) {
+            metadata->key_prefix = false;
+            metadata->separator = '.';
+        }
+        if (json_object_object_get_ex(encoding, "configuration", &config) &&
+            json_object_object_get_ex(config, "separator", &value)) {
+            metadata->separator = json_object_get_string(value)[0];
+        }
+    }
+
+    json_object *grid;
+    if (json_object_object_get_ex(root, "chunk_grid", &grid) &&
+        json_object_object_get_ex(grid, "configuration", &config) &&
+        json_object_object_get_ex(config, "chunk_shape", &value)) {
+        vs__json_parse_int32_array(value, metadata->chunks);
+    }
+
+    json_object *codecs;
+    if (!json_object_object_get_ex(root, "codecs", &codecs) || !json_object_is_type(codecs, json_type_array)) {
+        LOG_ERROR("zarr.json has no codecs");
+        return 1;
+    }
+    json_object *first = json_object_array_get_idx(codecs, 0);
+    if (first && json_object_object_get_ex(first, "name", &name) &&
+        strcmp(json_object_get_string(name), "sharding_indexed") == 0) {
+        if (json_object_array_length(codecs) != 1 || !json_object_object_get_ex(first, "configuration", &config)) {
+            LOG_ERROR("unsupported sharding_indexed configuration");
+            return 1;
+        }
+        memcpy(metadata->shard_shape, metadata->chunks, sizeof(metadata->shard_shape));
+        if (json_object_object_get_ex(config, "chunk_shape", &value)) {
+            vs__json_parse_int32_array(value, metadata->chunks);
+        }
+        for (int i = 0; i < 3; i++) {
+            if (metadata->chunks[i] <= 0 || metadata->shard_shape[i] % metadata->chunks[i] != 0) {
+                LOG_ERROR("the shard shape must be a multiple of the inner chunk shape");
+                return 1;
+            }
+        }
+        metadata->shard_index_at_start = json_object_object_get_ex(config, "index_location", &value) &&
+                                         strcmp(json_object_get_string(value), "start") == 0;
+
+        json_object *index_codecs;
+        if (json_object_object_get_ex(config, "index_codecs", &index_codecs)) {
+            for (size_t i = 0; i < json_object_array_length(index_codecs); i++) {
+                json_object *codec = json_object_array_get_idx(index_codecs, i);
+                json_object *codec_config, *endian;
+                if (!json_object_object_get_ex(codec, "name", &name)) continue;
+                if (strcmp(json_object_get_string(name), "crc32c") == 0) {
+                    metadata->shard_index_crc = true;
+                } else if (strcmp(json_object_get_string(name), "bytes") != 0 ||
+                           (json_object_object_get_ex(codec, "configuration", &codec_config) &&
+                            json_object_object_get_ex(codec_config, "endian", &endian) &&
+                            strcmp(json_object_get_string(endian), "little") != 0)) {
+                    LOG_ERROR("unsupported shard index codec %s", json_object_get_string(name));
+                    return 1;
+                }
+            }
+        }
+        if (!json_object_object_get_ex(config, "codecs", &codecs)) {
+            LOG_ERROR("sharding_indexed has no codecs");
+            return 1;
         }
     }
 
-    json_object *dtype_value;
-    if (json_object_object_get_ex(root, "dtype", &dtype_value)) {
-        const char *dtype_str = json_object_get_string(dtype_value);
-        strncpy(metadata->dtype, dtype_str, sizeof(metadata->dtype) - 1);
-        metadata->dtype[sizeof(metadata->dtype) - 1] = '\0';
-    }
-
-    json_object *fill_value;
-    if (json_object_object_get_ex(root, "fill_value", &fill_value)) {
-        metadata->fill_value = json_object_get_int(fill_value);
+    bool big_endian = false;
+    if (vs__zarr_parse_v3_codecs(codecs, metadata, &big_endian)) {
+        return 1;
     }
 
-    json_object *order_value;
-    if (json_object_object_get_ex(root, "order", &order_value)) {
-        const char *order_str = json_object_get_string(order_value);
-        if (order_str && order_str[0]) {
-            metadata->order = order_str[0];
+    json_object *data_type;
+    if (json_object_object_get_ex(root, "data_type", &data_type)) {
+        const char *type = json_object_get_string(data_type);
+        if (strcmp(type, "uint8") == 0) {
+            strcpy(metadata->dtype, "|u1");
+        } else if (strcmp(type, "uint16") == 0) {
+            strcpy(metadata->dtype, big_endian ? ">u2" : "<u2");
+        } else {
+            strncpy(metadata->dtype, type, sizeof(metadata->dtype) - 1);
+            metadata->dtype[sizeof(metadata->dtype) - 1] = '\0';
         }
     }
+    metadata->order = 'C';
+    return 0;
+}
 
-    json_object *format_value;
-    if (json_object_object_get_ex(root, "zarr_format", &format_value)) {
-        metadata->zarr_format = json_object_get_int(format_value);
+// reads the bytes and blosc codecs of a chunk, anything else is unsupported
+static int vs__zarr_parse_v3_codecs(json_object *codecs, zarr_metadata *metadata, bool *big_endian) {
+    for (size_t i = 0; i < json_object_array_length(codecs); i++) {
+        json_object *codec = json_object_array_get_idx(codecs, i);
+        json_object *name, *config, *value;
+        if (!json_object_object_get_ex(codec, "name", &name)) {
+            LOG_ERROR("zarr codec without a name");
+            return 1;
+        }
+        const char *codec_name = json_object_get_string(name);
+        bool has_config = json_object_object_get_ex(codec, "configuration", &config);
+
+        if (strcmp(codec_name, "bytes") == 0) {
+            *big_endian = has_config && json_object_object_get_ex(config, "endian", &value) &&
+                          strcmp(json_object_get_string(value), "big") == 0;
+        } else if (strcmp(codec_name, "blosc") == 0) {
+            strcpy(metadata->compressor.id, "blosc");
+            if (!has_config) continue;
+            if (json_object_object_get_ex(config, "cname", &value)) {
+                strncpy(metadata->compressor.cname, json_object_get_string(value), sizeof(metadata->compressor.cname) - 1);
+                metadata->compressor.cname[sizeof(metadata->compressor.cname) - 1] = '\0';
+            }
+            if (json_object_object_get_ex(config, "clevel", &value)) {
+                metadata->compressor.clevel = json_object_get_int(value);
+            }
+            if (json_object_object_get_ex(config, "blocksize", &value)) {
+                metadata->compressor.blocksize = json_object_get_int(value);
+            }
+            if (json_object_object_get_ex(config, "shuffle", &value)) {
+                const char *shuffle = json_object_get_string(value);
+                metadata->compressor.shuffle = strcmp(shuffle, "shuffle") == 0 ? 1 :
+                                               strcmp(shuffle, "bitshuffle") == 0 ? 2 : 0;
+            }
+        } else {
+            LOG_ERROR("unsupported zarr codec %s", codec_name);
+            return 1;
+        }
     }
-
-    json_object_put(root);
     return 0;
 }
 
@@ -4816,65 +9039,129 @@ zarr_metadata vs_zarr_parse_zarray(char *path) {
 }
 
 chunk* vs_zarr_read_chunk(char* path, zarr_metadata metadata) {
+    tchunk *block = vs_zarr_read_tchunk(path, metadata);
+    if (block == NULL) {
+        return NULL;
+    }
+    chunk *ret = vs_tchunk_to_chunk(block);
+    vs_tchunk_free(block);
+    return ret;
+}
 
+// reads a whole block file, the caller frees it. NULL if it can't be read
+static u8 *vs__zarr_read_file(const char *path, long *size) {
     FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG_ERROR("could not open %s", path);
+        return NULL;
+    }
     fseek(fp, 0, SEEK_END);
-    long size = ftell(fp);
+    *size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
-    u8* compressed_data = malloc(size);
-    fread(compressed_data,1,size,fp);
+    u8* data = malloc(*size);
+    if (data == NULL || fread(data,1,*size,fp) != (size_t)*size) {
+        LOG_ERROR("could not read %s", path);
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    return data;
+}
 
-    chunk* ret= vs_zarr_decompress_chunk(size, compressed_data, metadata);
+tchunk* vs_zarr_read_tchunk(char* path, zarr_metadata metadata) {
+    long size = 0;
+    u8* compressed_data = vs__zarr_read_file(path, &size);
+    if (compressed_data == NULL) {
+        return NULL;
+    }
+    tchunk* ret= vs_zarr_decompress_tchunk(size, compressed_data, metadata);
     free(compressed_data);
     return ret;
 }
 
-chunk* vs_zarr_decompress_chunk(long size, void* compressed_data, zarr_metadata metadata) {
+// maps the zarr dtype to the dtype of a tchunk, 0 on success
+//   - swap (may be NULL) is set if the stored byte order differs from the host's. '|' is read as little endian
+static int vs__zarr_dtype(const zarr_metadata *metadata, vs_dtype *dtype, bool *swap) {
+    const char *order = metadata->dtype;
+    if (*order != '|' && *order != '<' && *order != '>') {
+        LOG_ERROR("unsupported zarr format %s. Only unsigned 8 and unsigned 16 are supported", metadata->dtype);
+        return 1;
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bool big_endian_host = true;
+#else
+    bool big_endian_host = false;
+#endif
+    if (strcmp(order + 1, "u1") == 0) {
+        *dtype = VS_U8;
+        if (swap) *swap = false;
+        return 0;
+    } else if (strcmp(order + 1, "u2") == 0) {
+        *dtype = VS_U16;
+        if (swap) *swap = (*order == '>') != big_endian_host;
+        return 0;
+    }
+    LOG_ERROR("unsupported zarr format %s. Only unsigned 8 and unsigned 16 are supported", metadata->dtype);
+    return 1;
+}
 
-    int z = metadata.chunks[0];
-    int y = metadata.chunks[1];
-    int x = metadata.chunks[2];
-    int dtype_size = 0;
-    if(strcmp(metadata.dtype,"|u1") == 0) {
-        dtype_size = 1;
-    } else if (strcmp(metadata.dtype, "|u2") == 0) {
-        ASSERT(false,"16 bit zarr not currently supported");
-        dtype_size = 2;
-    } else {
-        LOG_ERROR("unsupported zarr format. Only unsigned 8 and unsigned 16 are supported\n");
+// decompresses a zarr block into dest, which has room for a whole block of the zarr's dtype. 0 on success
+static int vs__zarr_decompress_into(long size, void *compressed_data, const zarr_metadata *metadata, void *dest) {
+    vs_dtype dtype;
+    bool swap;
+    if (vs__zarr_dtype(metadata, &dtype, &swap)) {
+        return 1;
     }
+    long nbytes = (long)metadata->chunks[0] * metadata->chunks[1] * metadata->chunks[2] * vs_dtype_size(dtype);
 
-    unsigned char* decompressed_data;
-    int decompressed_size;
-    // the data may not actually be compressed. if so, just use the compressed data
-    if(strnlen(metadata.compressor.cname,32) == 0) {
-        decompressed_data = compressed_data;
-        decompressed_size = size;
+    // the data may not actually be compressed. if so, just copy it
+    if (strnlen(metadata->compressor.cname, 32) == 0) {
+        if (size < nbytes) {
+            LOG_ERROR("uncompressed block is %ld bytes, expected %ld", size, nbytes);
+            return 1;
+        }
+        memcpy(dest, compressed_data, nbytes);
     } else {
-        decompressed_data = malloc(z * y * x * dtype_size);
-        decompressed_size = blosc2_decompress(compressed_data, size, decompressed_data, z * y * x * dtype_size);
+        int decompressed_size = decompress_blosc(compressed_data, size, dest, nbytes);
         if (decompressed_size < 0) {
             LOG_ERROR("Blosc2 decompression failed: %d\n", decompressed_size);
-            free(decompressed_data);
-            return NULL;
+            return 1;
         }
     }
-    chunk *ret = vs_chunk_new((s32[3]){z, y, x});
+    if (swap) {
+        vs__bswap16((u16 *)dest, nbytes / sizeof(u16));
+    }
+    return 0;
+}
 
-    for (int z = 0; z < ret->dims[0]; z++) {
-        for (int y = 0; y < ret->dims[1]; y++) {
-            for (int x = 0; x < ret->dims[2]; x++) {
-                vs_chunk_set(ret, z, y, x, (f32) decompressed_data[z * ret->dims[1] * ret->dims[2] + y * ret->dims[2] + x]);
-            }
-        }
+// decompresses a zarr block straight into a tchunk of the zarr's dtype
+tchunk* vs_zarr_decompress_tchunk(long size, void* compressed_data, zarr_metadata metadata) {
+    vs_dtype dtype;
+    if (vs__zarr_dtype(&metadata, &dtype, NULL)) {
+        return NULL;
     }
-    if(decompressed_data != compressed_data) {
-        free(decompressed_data);
+    tchunk *ret = vs_tchunk_new(metadata.chunks, dtype);
+    if (ret == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        return NULL;
+    }
+    if (vs__zarr_decompress_into(size, compressed_data, &metadata, ret->data)) {
+        vs_tchunk_free(ret);
+        return NULL;
     }
-
     return ret;
 }
 
+chunk* vs_zarr_decompress_chunk(long size, void* compressed_data, zarr_metadata metadata) {
+    tchunk *block = vs_zarr_decompress_tchunk(size, compressed_data, metadata);
+    if (block == NULL) {
+        return NULL;
+    }
+    chunk *ret = vs_tchunk_to_chunk(block);
+    vs_tchunk_free(block);
+    return ret;
+}
 
 int vs_zarr_write_chunk(char *path, zarr_metadata metadata, chunk* c) {
     // the directory to the file path might not exist so we will mkdir for it here
@@ -4886,65 +9173,489 @@ int vs_zarr_write_chunk(char *path, zarr_metadata metadata, chunk* c) {
         LOG_ERROR("failed to mkdirs to %s",dirname);
         return 1;
     }
+    free(dirname);
     void* compressed_buf;
     int len = vs_zarr_compress_chunk(c,metadata,&compressed_buf);
     if (len <= 0) {
         //TODO: len == 0 is probably an error, right?
         return 1;
     }
-    FILE* fp = fopen(path, "wb");
-    fwrite(compressed_buf,1,len,fp);
+    if (vs__write_file_atomic(path, compressed_buf, len)) {
+        LOG_ERROR("failed to write chunk to %s", path);
+        free(compressed_buf);
+        return 1;
+    }
     LOG_INFO("wrote chunk to %s",path);
-    fclose(fp);
-    free(dirname);
     free(compressed_buf);
     return 0;
 }
 
-int vs_zarr_compress_chunk(chunk* c, zarr_metadata metadata, void** compressed_data) {
-    if (c->dims[0] != metadata.chunks[0]) {
-        LOG_ERROR("zarr block size mismatch with chunk dims");
+// writes an already compressed block, e.g. as downloaded from the server, without touching its contents
+int vs_zarr_write_block(char *path, void* compressed_data, long size) {
+    char* dirname = vs__basename(path);
+    if (vs__mkdir_p(dirname)) {
+        LOG_ERROR("failed to mkdirs to %s",dirname);
+        free(dirname);
         return 1;
     }
-    if (c->dims[1] != metadata.chunks[1]) {
-        LOG_ERROR("zarr block size mismatch with chunk dims");
+    free(dirname);
+    if (vs__write_file_atomic(path, compressed_data, size)) {
+        LOG_ERROR("failed to write chunk to %s", path);
         return 1;
     }
-    if (c->dims[2] != metadata.chunks[2]) {
-        LOG_ERROR("zarr block size mismatch with chunk dims");
+    LOG_INFO("wrote chunk to %s",path);
+    return 0;
+}
+
+// the path of block z, y, x of the zarr v2 array in array_dir
+static void vs__zarr_block_path(const char *array_dir, const zarr_metadata *metadata, s32 z, s32 y, s32 x, char *path, size_t size) {
+    char sep = metadata->separator ? metadata->separator : '/';
+    snprintf(path, size, "%s/%d%c%d%c%d", array_dir, z, sep, y, sep, x);
+}
+
+// writes metadata as the .zarray of the zarr v2 array in array_dir, creating the directory
+static int vs__zarr_write_zarray(const char *array_dir, const zarr_metadata *metadata) {
+    char json[1024];
+    int len = snprintf(json, sizeof(json),
+        "{\"zarr_format\": 2, \"shape\": [%d, %d, %d], \"chunks\": [%d, %d, %d], \"dtype\": \"%s\", "
+        "\"fill_value\": %d, \"order\": \"%c\", \"dimension_separator\": \"%c\", \"filters\": null, \"compressor\": ",
+        metadata->shape[0], metadata->shape[1], metadata->shape[2],
+        metadata->chunks[0], metadata->chunks[1], metadata->chunks[2],
+        metadata->dtype, metadata->fill_value, metadata->order ? metadata->order : 'C',
+        metadata->separator ? metadata->separator : '/');
+    if (strnlen(metadata->compressor.cname, 32) == 0) {
+        len += snprintf(json + len, sizeof(json) - len, "null}");
+    } else {
+        len += snprintf(json + len, sizeof(json) - len,
+            "{\"id\": \"blosc\", \"cname\": \"%s\", \"clevel\": %d, \"shuffle\": %d, \"blocksize\": %d}}",
+            metadata->compressor.cname, metadata->compressor.clevel, metadata->compressor.shuffle,
+            metadata->compressor.blocksize);
+    }
+
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/.zarray", array_dir);
+    if (vs__mkdir_p(array_dir) || vs__write_file_atomic(path, json, len)) {
+        LOG_ERROR("failed to write %s", path);
         return 1;
     }
-  int z = metadata.chunks[0];
-  int y = metadata.chunks[1];
-  int x = metadata.chunks[2];
-  int dtype_size = 0;
-  u8* decompressed_data = NULL;
-  if (strcmp(metadata.dtype, "|u1") == 0) {
-    dtype_size = 1;
-    decompressed_data = malloc(z*y*x);
-    for (int _z = 0; _z < z; _z++) {
-      for (int _y = 0; _y < y; _y++) {
-        for (int _x = 0; _x < x; _x++) {
-          decompressed_data[_z*y*x+_y*x+_x] = (u8) vs_chunk_get(c,_z,_y,_x);
+    return 0;
+}
+
+// blocks at the far edges of an array are stored padded to the full block size. the padding is overwritten with
+// copies of the last voxel inside the array, so a 2x2x2 cube that straddles the edge reduces to the mean or max of
+// the voxels inside
+static void vs__pad_edge_block(tchunk *c, s32 valid[static 3]) {
+    s32 size = vs_dtype_size(c->dtype);
+    s64 row = (s64)c->dims[2] * size;
+    s64 plane = row * c->dims[1];
+    for (s32 z = 0; z < valid[0]; z++) {
+        for (s32 y = 0; y < valid[1]; y++) {
+            u8 *r = c->data + z * plane + y * row;
+            for (s32 x = valid[2]; x < c->dims[2]; x++) {
+                memcpy(r + x * size, r + (valid[2] - 1) * size, size);
+            }
+        }
+        for (s32 y = valid[1]; y < c->dims[1]; y++) {
+            memcpy(c->data + z * plane + y * row, c->data + z * plane + (valid[1] - 1) * row, row);
         }
-      }
     }
-  } else if (strcmp(metadata.dtype, "|u2") == 0) {
-      LOG_ERROR("16 bit zarr not currently supported\n");
-      return 1;
-  } else {
-    LOG_ERROR("unsupported zarr format. Only unsigned 8 is supported\n");
-  }
-  *compressed_data = malloc(z*y*x+BLOSC2_MAX_OVERHEAD);
-  int compressed_len = blosc2_compress(metadata.compressor.clevel,metadata.compressor.shuffle,dtype_size,decompressed_data,z*y*x,*compressed_data,z*y*x*BLOSC2_MAX_OVERHEAD);
+    for (s32 z = valid[0]; z < c->dims[0]; z++) {
+        memcpy(c->data + z * plane, c->data + (valid[0] - 1) * plane, plane);
+    }
+}
 
-  if (compressed_len <= 0) {
-    LOG_ERROR("Blosc2 compression failed: %d\n", compressed_len);
-    free(compressed_data);
-    free(decompressed_data);
-    return -1;
-  }
-  return compressed_len;
+// downsamples in 2x along every axis into the in->dims / 2 sized region of out at offset
+//   - in and out have the same dtype, u8 blocks use the simd kernels
+static void vs__downsample_block(tchunk *out, s32 offset[static 3], tchunk *in, vs_downsample mode) {
+    pthread_once(&vs__convert_kernels_once, vs__pick_convert_kernels);
+    s32 half[3] = {in->dims[0] / 2, in->dims[1] / 2, in->dims[2] / 2};
+    for (s32 z = 0; z < half[0]; z++) {
+        for (s32 y = 0; y < half[1]; y++) {
+            s64 rows[4];
+            for (int r = 0; r < 4; r++) {
+                rows[r] = ((s64)(2 * z + r / 2) * in->dims[1] + 2 * y + r % 2) * in->dims[2];
+            }
+            s64 dest = ((s64)(offset[0] + z) * out->dims[1] + offset[1] + y) * out->dims[2] + offset[2];
+
+            if (in->dtype == VS_U8) {
+                const u8 *src[4] = {in->data + rows[0], in->data + rows[1], in->data + rows[2], in->data + rows[3]};
+                if (mode == VS_DOWNSAMPLE_MAX) {
+                    vs__convert_kernels.u8_pool2_max(out->data + dest, src, half[2]);
+                } else {
+                    vs__convert_kernels.u8_pool2_mean(out->data + dest, src, half[2]);
+                }
+            } else if (in->dtype == VS_U16) {
+                const u16 *src = (const u16 *)in->data;
+                u16 *dst = (u16 *)out->data + dest;
+                for (s32 x = 0; x < half[2]; x++) {
+                    u32 sum = 4, max = 0;
+                    for (int r = 0; r < 4; r++) {
+                        u16 a = src[rows[r] + 2 * x], b = src[rows[r] + 2 * x + 1];
+                        sum += a + b;
+                        max = MAX(max, MAX(a, b));
+                    }
+                    dst[x] = (u16)(mode == VS_DOWNSAMPLE_MAX ? max : sum >> 3);
+                }
+            } else {
+                const f32 *src = (const f32 *)in->data;
+                f32 *dst = (f32 *)out->data + dest;
+                for (s32 x = 0; x < half[2]; x++) {
+                    f32 sum = 0.0f, max = -FLT_MAX;
+                    for (int r = 0; r < 4; r++) {
+                        f32 a = src[rows[r] + 2 * x], b = src[rows[r] + 2 * x + 1];
+                        sum += a + b;
+                        max = vs__maxfloat(max, vs__maxfloat(a, b));
+                    }
+                    dst[x] = mode == VS_DOWNSAMPLE_MAX ? max : sum / 8.0f;
+                }
+            }
+        }
+    }
+}
+
+// one level of a vs_zarr_build_pyramid, shared by the threads building it
+typedef struct {
+    char in_dir[1024];
+    char out_dir[1024];
+    zarr_metadata in;
+    zarr_metadata out;
+    vs_dtype dtype;
+    vs_downsample mode;
+    pthread_mutex_t lock;
+    s64 next;       // the next output block to build, in C order
+    s64 nblocks;
+    bool failed;
+} vs__pyramid_level;
+
+// builds output blocks until none are left. each is reduced from the 2x2x2 input blocks it covers, one at a time,
+// so a thread holds at most one input block, one output block and its compressed bytes
+static void *vs__pyramid_worker(void *arg) {
+    vs__pyramid_level *level = arg;
+    s32 *chunks = level->out.chunks;
+    s32 nout[3], nin[3];
+    for (int i = 0; i < 3; i++) {
+        nout[i] = (level->out.shape[i] + chunks[i] - 1) / chunks[i];
+        nin[i] = (level->in.shape[i] + chunks[i] - 1) / chunks[i];
+    }
+    f32 fill = (f32)level->in.fill_value;
+    tchunk *out = vs_tchunk_new(chunks, level->dtype);
+    if (out == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        pthread_mutex_lock(&level->lock);
+        level->failed = true;
+        pthread_mutex_unlock(&level->lock);
+        return NULL;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&level->lock);
+        s64 i = level->failed ? level->nblocks : level->next++;
+        pthread_mutex_unlock(&level->lock);
+        if (i >= level->nblocks) {
+            break;
+        }
+        s32 b[3] = {(s32)(i / ((s64)nout[1] * nout[2])), (s32)(i / nout[2] % nout[1]), (s32)(i % nout[2])};
+
+        s64 nvoxels = (s64)chunks[0] * chunks[1] * chunks[2];
+        s32 size = vs_dtype_size(level->dtype);
+        for (s64 v = 0; v < nvoxels; v++) {
+            vs__convert(out->data + v * size, level->dtype, &fill, VS_F32, 1);
+        }
+
+        bool empty = true;
+        bool failed = false;
+        for (int octant = 0; octant < 8 && !failed; octant++) {
+            s32 d[3] = {octant >> 2, octant >> 1 & 1, octant & 1};
+            s32 in_b[3] = {2 * b[0] + d[0], 2 * b[1] + d[1], 2 * b[2] + d[2]};
+            if (in_b[0] >= nin[0] || in_b[1] >= nin[1] || in_b[2] >= nin[2]) {
+                continue;
+            }
+            char path[1100];
+            vs__zarr_block_path(level->in_dir, &level->in, in_b[0], in_b[1], in_b[2], path, sizeof(path));
+            if (!vs__path_exists(path)) {
+                // zarr leaves out blocks of only the fill value
+                continue;
+            }
+            tchunk *in = vs_zarr_read_tchunk(path, level->in);
+            if (in == NULL) {
+                failed = true;
+                break;
+            }
+            s32 valid[3], offset[3];
+            for (int j = 0; j < 3; j++) {
+                valid[j] = MIN(chunks[j], level->in.shape[j] - in_b[j] * chunks[j]);
+                offset[j] = d[j] * chunks[j] / 2;
+            }
+            if (valid[0] < chunks[0] || valid[1] < chunks[1] || valid[2] < chunks[2]) {
+                vs__pad_edge_block(in, valid);
+            }
+            vs__downsample_block(out, offset, in, level->mode);
+            vs_tchunk_free(in);
+            empty = false;
+        }
+
+        if (!failed && !empty) {
+            void *compressed = NULL;
+            int len = vs_zarr_compress_tchunk(out, level->out, &compressed);
+            char path[1100];
+            vs__zarr_block_path(level->out_dir, &level->out, b[0], b[1], b[2], path, sizeof(path));
+            failed = len <= 0 || vs_zarr_write_block(path, compressed, len);
+            free(compressed);
+        }
+        if (failed) {
+            LOG_ERROR("failed to build block %d/%d/%d of %s", b[0], b[1], b[2], level->out_dir);
+            pthread_mutex_lock(&level->lock);
+            level->failed = true;
+            pthread_mutex_unlock(&level->lock);
+        }
+    }
+    vs_tchunk_free(out);
+    return NULL;
+}
+
+// builds levels 1 to nlevels of a multiscale pyramid from level 0, the zarr v2 array in path/0
+//   - level n is written to path/n, downsampled 2x from level n - 1 by mode, with the same block size, dtype and
+//     compressor. blocks of only the fill value are left out, like zarr does
+//   - path/.zattrs is written with OME-Zarr multiscales metadata listing every level, scales are in level 0 voxels
+//   - the blocks of a level are built by nthreads threads, nthreads <= 0 uses one thread per online cpu
+//   - the block size must be even along every axis
+//   - 0 on success, 1 on failure
+int vs_zarr_build_pyramid(const char *path, int nlevels, vs_downsample mode, int nthreads) {
+    if (nlevels < 1 || nlevels >= VS_MAX_LEVELS) {
+        LOG_ERROR("can't build %d levels, at most %d are supported", nlevels, VS_MAX_LEVELS - 1);
+        return 1;
+    }
+    if (nthreads <= 0) {
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    nthreads = MAX(1, nthreads);
+
+    vs__pyramid_level *level = calloc(1, sizeof(vs__pyramid_level));
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    if (level == NULL || threads == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        free(level);
+        free(threads);
+        return 1;
+    }
+    pthread_mutex_init(&level->lock, NULL);
+    level->mode = mode;
+    int ret = 1;
+
+    char zarray[1100];
+    snprintf(zarray, sizeof(zarray), "%s/0/.zarray", path);
+    if (!vs__path_exists(zarray)) {
+        LOG_ERROR("%s does not exist", zarray);
+        goto cleanup;
+    }
+    level->out = vs_zarr_parse_zarray(zarray);
+    if (level->out.zarr_format != 2 || vs__zarr_dtype(&level->out, &level->dtype, NULL)) {
+        LOG_ERROR("%s is not a zarr v2 array this library can read", zarray);
+        goto cleanup;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (level->out.chunks[i] <= 0 || level->out.chunks[i] % 2 != 0) {
+            LOG_ERROR("the block size of %s is not even", zarray);
+            goto cleanup;
+        }
+    }
+    snprintf(level->out_dir, sizeof(level->out_dir), "%s/0", path);
+
+    for (int l = 1; l <= nlevels; l++) {
+        memcpy(level->in_dir, level->out_dir, sizeof(level->in_dir));
+        level->in = level->out;
+        snprintf(level->out_dir, sizeof(level->out_dir), "%s/%d", path, l);
+        level->nblocks = 1;
+        for (int i = 0; i < 3; i++) {
+            level->out.shape[i] = (level->in.shape[i] + 1) / 2;
+            level->nblocks *= (level->out.shape[i] + level->out.chunks[i] - 1) / level->out.chunks[i];
+        }
+        level->next = 0;
+        if (vs__zarr_write_zarray(level->out_dir, &level->out)) {
+            goto cleanup;
+        }
+        LOG_INFO("building level %d of %s, %d x %d x %d voxels", l, path,
+                 level->out.shape[0], level->out.shape[1], level->out.shape[2]);
+
+        // the calling thread builds blocks too, and builds them all if no thread could be started
+        int started = 0;
+        while (started < nthreads - 1 && pthread_create(&threads[started], NULL, vs__pyramid_worker, level) == 0) {
+            started++;
+        }
+        vs__pyramid_worker(level);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        if (level->failed) {
+            goto cleanup;
+        }
+    }
+
+    // the multiscales metadata, so the pyramid can be opened with vs_multiscale_new
+    char *zattrs = malloc(512 + (size_t)(nlevels + 1) * 128);
+    if (zattrs == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        goto cleanup;
+    }
+    int len = sprintf(zattrs, "{\"multiscales\": [{\"version\": \"0.4\", \"axes\": [{\"name\": \"z\", \"type\": \"space\"}, "
+                              "{\"name\": \"y\", \"type\": \"space\"}, {\"name\": \"x\", \"type\": \"space\"}], \"datasets\": [");
+    for (int l = 0; l <= nlevels; l++) {
+        len += sprintf(zattrs + len, "%s{\"path\": \"%d\", \"coordinateTransformations\": [{\"type\": \"scale\", "
+                                     "\"scale\": [%d.0, %d.0, %d.0]}]}", l ? ", " : "", l, 1 << l, 1 << l, 1 << l);
+    }
+    len += sprintf(zattrs + len, "], \"type\": \"%s\"}]}", mode == VS_DOWNSAMPLE_MAX ? "max" : "mean");
+    char zattrs_path[1100];
+    snprintf(zattrs_path, sizeof(zattrs_path), "%s/.zattrs", path);
+    int written = vs__write_file_atomic(zattrs_path, zattrs, len);
+    free(zattrs);
+    if (written) {
+        LOG_ERROR("failed to write %s", zattrs_path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    pthread_mutex_destroy(&level->lock);
+    free(level);
+    free(threads);
+    return ret;
+}
+
+// every thread that compresses blocks keeps a blosc2 context for the settings it last used, so threads
+// compressing at the same time, like the workers of vs_zarr_build_pyramid, don't queue on blosc's global one.
+// it is freed when the thread exits
+typedef struct {
+    blosc2_context *ctx;
+    int compcode, clevel, shuffle, typesize, blocksize;
+} vs__compress_context;
+
+static pthread_key_t vs__compress_context_key;
+static pthread_once_t vs__compress_context_once = PTHREAD_ONCE_INIT;
+
+static void vs__free_compress_context(void *arg) {
+    vs__compress_context *cc = arg;
+    blosc2_free_ctx(cc->ctx);
+    free(cc);
+}
+
+static void vs__create_compress_context_key(void) {
+    pthread_key_create(&vs__compress_context_key, vs__free_compress_context);
+}
+
+// the calling thread's context for compressing typesize byte voxels with the zarr's blosc settings,
+// created on first use and again when the settings change. NULL if the compressor is unknown or on failure
+static blosc2_context *vs__get_compress_context(const zarr_compressor_settings *settings, int typesize) {
+    pthread_once(&vs__compress_context_once, vs__create_compress_context_key);
+    blosc2_cparams cparams = BLOSC2_CPARAMS_DEFAULTS;
+    int compcode = cparams.compcode;
+    if (settings->cname[0] != '\0' && (compcode = blosc2_compname_to_compcode(settings->cname)) < 0) {
+        LOG_ERROR("unsupported blosc compressor %s", settings->cname);
+        return NULL;
+    }
+    // numcodecs' AUTOSHUFFLE (-1) bit shuffles single byte voxels and byte shuffles wider ones
+    int shuffle = settings->shuffle >= 0 ? settings->shuffle : typesize == 1 ? BLOSC_BITSHUFFLE : BLOSC_SHUFFLE;
+
+    vs__compress_context *cc = pthread_getspecific(vs__compress_context_key);
+    if (cc != NULL && cc->compcode == compcode && cc->clevel == settings->clevel && cc->shuffle == shuffle &&
+        cc->typesize == typesize && cc->blocksize == settings->blocksize) {
+        return cc->ctx;
+    }
+
+    cparams.compcode = (uint8_t)compcode;
+    cparams.clevel = (uint8_t)settings->clevel;
+    cparams.typesize = typesize;
+    cparams.blocksize = settings->blocksize;
+    cparams.nthreads = 1;
+    cparams.filters[BLOSC2_MAX_FILTERS - 1] = (uint8_t)shuffle;
+    blosc2_context *ctx = blosc2_create_cctx(cparams);
+    if (ctx == NULL) {
+        return NULL;
+    }
+    if (cc == NULL) {
+        cc = malloc(sizeof(vs__compress_context));
+        if (cc == NULL || pthread_setspecific(vs__compress_context_key, cc) != 0) {
+            free(cc);
+            blosc2_free_ctx(ctx);
+            return NULL;
+        }
+    } else {
+        blosc2_free_ctx(cc->ctx);
+    }
+    *cc = (vs__compress_context){ctx, compcode, settings->clevel, shuffle, typesize, settings->blocksize};
+    return ctx;
+}
+
+// compresses c as a block of the zarr, converting its voxels to the zarr's dtype and byte order
+//   - compresses with the zarr's cname, clevel, shuffle and blocksize on the calling thread's context
+//   - returns the compressed length, which is <= 0 on failure
+int vs_zarr_compress_tchunk(tchunk* c, zarr_metadata metadata, void** compressed_data) {
+    for (int i = 0; i < 3; i++) {
+        if (c->dims[i] != metadata.chunks[i]) {
+            LOG_ERROR("zarr block size mismatch with chunk dims");
+            return -1;
+        }
+    }
+    vs_dtype dtype;
+    bool swap;
+    if (vs__zarr_dtype(&metadata, &dtype, &swap)) {
+        return -1;
+    }
+
+    s64 count = (s64)c->dims[0] * c->dims[1] * c->dims[2];
+    s32 dtype_size = vs_dtype_size(dtype);
+    long nbytes = count * dtype_size;
+    const void *src = c->data;
+    void *converted = NULL;
+    if (c->dtype != dtype || swap) {
+        converted = malloc(nbytes);
+        if (converted == NULL) {
+            LOG_ERROR("failed to allocate memory");
+            return -1;
+        }
+        vs__convert(converted, dtype, c->data, c->dtype, count);
+        if (swap) {
+            vs__bswap16(converted, count);
+        }
+        src = converted;
+    }
+
+    blosc2_context *ctx = vs__get_compress_context(&metadata.compressor, dtype_size);
+    if (ctx == NULL) {
+        free(converted);
+        return -1;
+    }
+    *compressed_data = malloc(nbytes + BLOSC2_MAX_OVERHEAD);
+    if (*compressed_data == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        free(converted);
+        return -1;
+    }
+    int compressed_len = blosc2_compress_ctx(ctx, src, nbytes, *compressed_data, nbytes + BLOSC2_MAX_OVERHEAD);
+    free(converted);
+
+    if (compressed_len <= 0) {
+        LOG_ERROR("Blosc2 compression failed: %d\n", compressed_len);
+        free(*compressed_data);
+        *compressed_data = NULL;
+        return -1;
+    }
+    return compressed_len;
+}
+
+int vs_zarr_compress_chunk(chunk* c, zarr_metadata metadata, void** compressed_data) {
+    vs_dtype dtype;
+    if (vs__zarr_dtype(&metadata, &dtype, NULL)) {
+        return -1;
+    }
+    tchunk *converted = vs_chunk_to_tchunk(c, dtype);
+    if (converted == NULL) {
+        LOG_ERROR("failed to allocate memory");
+        return -1;
+    }
+    int compressed_len = vs_zarr_compress_tchunk(converted, metadata, compressed_data);
+    vs_tchunk_free(converted);
+    return compressed_len;
 }
 
 
@@ -5008,6 +9719,54 @@ slice *vs_tiff_to_slice(const char *tiffpath, int index) {
   return ret;
 }
 
+// fills slice with the plane of the volume perpendicular to axis (0 = z, 1 = y, 2 = x) that starts at start
+//   - start is in z y x order, the slice dims are the extent along the two remaining axes in z y x order
+//   - voxels in blocks that don't exist are the zarr's fill_value
+//   - successive calls stepping start along axis are detected as a sweep and read ahead, see vs_vol_set_readahead
+int vs_slice_fill(slice *slice, volume *vol, int start[static 3], int axis) {
+  if (axis < 0 || axis > 2) {
+    LOG_ERROR("invalid axis %d", axis);
+    return 1;
+  }
+
+  s32 dims[3];
+  for (int i = 0, j = 0; i < 3; i++) {
+    dims[i] = i == axis ? 1 : slice->dims[j++];
+    if (start[i] < 0 || start[i] + dims[i] > vol->metadata.shape[i]) {
+      LOG_ERROR("slice does not fit in the volume");
+      return 1;
+    }
+  }
+
+  // the plane is gathered as a chunk that is one voxel thick along axis, which has the same layout as the slice
+  chunk *plane = vs_chunk_new(dims);
+  int nblocks = 0;
+  s32 *blocks = vs__vol_blocks_in(vol, start, dims, &nblocks);
+  if (plane == NULL || blocks == NULL) {
+    LOG_ERROR("failed to allocate memory");
+    vs_chunk_free(plane);
+    free(blocks);
+    return 1;
+  }
+  memset(plane->data, 0, (size_t)dims[0] * dims[1] * dims[2] * sizeof(f32));
+
+  int failed = vs__vol_fetch_blocks(vol, blocks, nblocks, plane->data, VS_F32, start, dims);
+  free(blocks);
+  if (!failed) {
+    memcpy(slice->data, plane->data, (size_t)slice->dims[0] * slice->dims[1] * sizeof(f32));
+    vs__vol_readahead(vol, start, dims);
+  }
+  vs_chunk_free(plane);
+  return failed;
+}
+
+// fills chunk with the region of the volume that starts at start, the chunk dims give its size
+//   - start is in z y x order and must be inside the volume, neither start nor the dims need to line up with the zarr blocks
+//   - voxels past the edge of the volume are 0, voxels in blocks that don't exist are the zarr's fill_value
+int vs_chunk_fill(chunk *chunk, volume *vol, int start[static 3]) {
+  return vs__vol_read_region(vol, start, chunk->dims, chunk->data, VS_F32);
+}
+
 
 #endif // defined(VESUVIUS_IMPL)
 #endif // VESUVIUS_H